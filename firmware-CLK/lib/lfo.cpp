@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+
+// Tempo-synced LFO for the CV outputs
+// A 32bit phase accumulator covers one cycle per output period. The clock engine advances it
+// every tick and restarts it on each period start, so the waveform never drifts off the clock.
+
+enum OutputMode
+{
+  OUT_GATE = 0,
+  OUT_SAW,
+  OUT_TRIANGLE,
+  OUT_SINE,
+  OUT_RANDOM,
+  NUM_OUTPUT_MODES
+};
+
+char const *outputModeNames[] = {"GATE", "SAW", "TRI", "SINE", "RAND"};
+
+// One sine cycle, 12bit. const so it stays in flash.
+const uint16_t lfoSineTable[256] = {
+    2048, 2098, 2148, 2198, 2248, 2298, 2348, 2398, 2447, 2496, 2545, 2594, 2642, 2690, 2737, 2784,
+    2831, 2877, 2923, 2968, 3013, 3057, 3100, 3143, 3185, 3226, 3267, 3307, 3346, 3385, 3423, 3459,
+    3495, 3530, 3565, 3598, 3630, 3662, 3692, 3722, 3750, 3777, 3804, 3829, 3853, 3876, 3898, 3919,
+    3939, 3958, 3975, 3992, 4007, 4021, 4034, 4045, 4056, 4065, 4073, 4080, 4085, 4089, 4093, 4094,
+    4095, 4094, 4093, 4089, 4085, 4080, 4073, 4065, 4056, 4045, 4034, 4021, 4007, 3992, 3975, 3958,
+    3939, 3919, 3898, 3876, 3853, 3829, 3804, 3777, 3750, 3722, 3692, 3662, 3630, 3598, 3565, 3530,
+    3495, 3459, 3423, 3385, 3346, 3307, 3267, 3226, 3185, 3143, 3100, 3057, 3013, 2968, 2923, 2877,
+    2831, 2784, 2737, 2690, 2642, 2594, 2545, 2496, 2447, 2398, 2348, 2298, 2248, 2198, 2148, 2098,
+    2048, 1997, 1947, 1897, 1847, 1797, 1747, 1697, 1648, 1599, 1550, 1501, 1453, 1405, 1358, 1311,
+    1264, 1218, 1172, 1127, 1082, 1038, 995, 952, 910, 869, 828, 788, 749, 710, 672, 636,
+    600, 565, 530, 497, 465, 433, 403, 373, 345, 318, 291, 266, 242, 219, 197, 176,
+    156, 137, 120, 103, 88, 74, 61, 50, 39, 30, 22, 15, 10, 6, 2, 1,
+    0, 1, 2, 6, 10, 15, 22, 30, 39, 50, 61, 74, 88, 103, 120, 137,
+    156, 176, 197, 219, 242, 266, 291, 318, 345, 373, 403, 433, 465, 497, 530, 565,
+    600, 636, 672, 710, 749, 788, 828, 869, 910, 952, 995, 1038, 1082, 1127, 1172, 1218,
+    1264, 1311, 1358, 1405, 1453, 1501, 1550, 1599, 1648, 1697, 1747, 1797, 1847, 1897, 1947, 1997};
+
+struct Lfo
+{
+  uint32_t phase = 0;
+  uint32_t increment = 0;
+  uint16_t randomValue = 2048;
+  uint32_t rng = 0x9E3779B9;
+
+  // Restart the cycle, called on every output period start
+  void sync(uint32_t periodTicks)
+  {
+    if (periodTicks < 2)
+    {
+      periodTicks = 2;
+    }
+    increment = uint32_t((1ULL << 32) / periodTicks);
+    phase = 0;
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    randomValue = rng >> 20;
+  }
+
+  void advance()
+  {
+    phase += increment;
+  }
+
+  // 12bit sample for the current phase
+  uint16_t sample(uint8_t mode) const
+  {
+    switch (mode)
+    {
+    case OUT_SAW:
+      return phase >> 20;
+    case OUT_TRIANGLE:
+    {
+      uint32_t p = phase >> 19;
+      return p < 4096 ? p : 8191 - p;
+    }
+    case OUT_SINE:
+    {
+      // Linear interpolation between table entries
+      uint8_t index = phase >> 24;
+      uint32_t frac = (phase >> 16) & 0xFF;
+      int32_t a = lfoSineTable[index];
+      int32_t b = lfoSineTable[uint8_t(index + 1)];
+      return a + (((b - a) * int32_t(frac)) >> 8);
+    }
+    case OUT_RANDOM:
+      return randomValue;
+    default:
+      return 0;
+    }
+  }
+};
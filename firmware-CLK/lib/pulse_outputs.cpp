@@ -0,0 +1,108 @@
+#pragma once
+#include <stdint.h>
+
+#include "hal.h"
+#include "ratchet.cpp"
+
+// Outputs of the clock
+// Outputs 1 and 2 are the gate jacks, 3 is the internal DAC and 4 the MCP4725. The clock
+// engine tick drives them from here. The MCP4725 shares the I2C bus with the display, so a
+// tick only queues its value and the loop sends it.
+
+#define NUM_OUTPUTS 4
+#define OUT_1 OUT_PIN_2 // output 1 is wired to pin 2
+#define OUT_2 OUT_PIN_1
+
+// Values for the MCP4725, queued by the clock tick and sent by the loop one at a time. A gate
+// edge never replaces the edge before it, so a ratchet pulse that rises and falls before the
+// loop gets to the bus still goes out. Only when a third edge comes do the two pending ones
+// cancel, leaving the output where the edges end. Used with the tick interrupt masked.
+struct McpQueue
+{
+  volatile int value[2] = {-1, -1}; // value[0] goes out first, -1 = empty
+
+  bool pending() const
+  {
+    return value[0] >= 0;
+  }
+
+  // Queue a gate level
+  void edge(int code)
+  {
+    if (value[0] < 0)
+    {
+      value[0] = code;
+    }
+    else if (value[1] < 0)
+    {
+      if (code != value[0])
+      {
+        value[1] = code;
+      }
+    }
+    else if (code != value[1])
+    {
+      value[1] = -1; // back to the level of value[0]
+    }
+  }
+
+  // Queue a CV sample, only the newest one counts
+  void sample(int code)
+  {
+    value[0] = code;
+    value[1] = -1;
+  }
+
+  // Next value to send, -1 when none
+  int take()
+  {
+    int code = value[0];
+    value[0] = value[1];
+    value[1] = -1;
+    return code;
+  }
+};
+
+// Set output 0..3 high or low. Output 3 only queues its value.
+inline void setPin(int pin, int value, McpQueue &mcp)
+{
+  if (pin == 0) // Gate Output 1
+  {
+    Pin<OUT_1>::write(value);
+  }
+  else if (pin == 1) // Gate Output 2
+  {
+    Pin<OUT_2>::write(value);
+  }
+  else if (pin == 2) // Internal DAC Output
+  {
+    intDAC(value ? 4095 : 0);
+  }
+  else if (pin == 3) // MCP DAC Output
+  {
+    mcp.edge(value ? 4095 : 0);
+  }
+}
+
+// Pulse state of a gate output, stepped on every clock engine tick
+struct PulseOutput
+{
+  bool high = false;    // output state, avoids rewriting LOW every tick
+  uint32_t offTick = 0; // tick where the current pulse ends
+
+  // Start the next burst pulse when one is due, end the current one after width ticks
+  void tick(int pin, uint32_t tick, uint32_t period, uint8_t count, uint8_t density, uint32_t width, McpQueue &mcp)
+  {
+    if (burstPulseAt(tick % period, period, count, density))
+    {
+      setPin(pin, 1, mcp);
+      high = true;
+      offTick = tick + burstPulseWidth(period, count, density, width);
+    }
+    else if (high && tick >= offTick)
+    {
+      setPin(pin, 0, mcp);
+      high = false;
+    }
+  }
+};
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+
+// Ratchet / burst generator
+// Each output period can start with a burst of `count` pulses spread over the first
+// `density`/8 of the period. Everything is integer math so it can run from the tick callback.
+
+#define MAX_RATCHETS 8
+#define MAX_DENSITY 8
+
+// Number of ticks the burst is spread over, at least two ticks per pulse (one high, one low)
+// when the period allows it
+inline uint32_t burstSpan(uint32_t period, uint8_t count, uint8_t density)
+{
+  uint32_t span = period * density / MAX_DENSITY;
+  uint32_t needed = 2u * count;
+  if (span < needed)
+  {
+    span = needed < period ? needed : period;
+  }
+  return span;
+}
+
+// Pulses the burst really fires. A period shorter than two ticks per pulse cannot separate
+// them (they would merge into one long high), so the count is clamped to what fits.
+inline uint8_t burstCount(uint32_t period, uint8_t count, uint8_t density)
+{
+  uint32_t fit = burstSpan(period, count, density) / 2;
+  if (fit < 1)
+  {
+    fit = 1;
+  }
+  return count < fit ? count : fit;
+}
+
+// Returns true when a burst pulse starts `phase` ticks into an output period of `period` ticks.
+// Pulse k of the burst starts at ceil(k * span / count), so pulses are evenly spread on the tick grid.
+inline bool burstPulseAt(uint32_t phase, uint32_t period, uint8_t count, uint8_t density)
+{
+  if (phase == 0)
+  {
+    return true;
+  }
+  count = burstCount(period, count, density);
+  if (count <= 1)
+  {
+    return false;
+  }
+  uint32_t span = burstSpan(period, count, density);
+  if (phase >= span)
+  {
+    return false;
+  }
+  return (phase * count) / span != ((phase - 1) * count) / span;
+}
+
+// Pulse width in ticks, shortened inside a burst so consecutive pulses stay separated
+inline uint32_t burstPulseWidth(uint32_t period, uint8_t count, uint8_t density, uint32_t maxWidth)
+{
+  count = burstCount(period, count, density);
+  if (count <= 1)
+  {
+    return maxWidth;
+  }
+  uint32_t spacing = burstSpan(period, count, density) / count;
+  uint32_t width = spacing / 2;
+  if (width > maxWidth)
+  {
+    width = maxWidth;
+  }
+  return width > 0 ? width : 1;
+}
+
+// Map a 12bit CV reading to a ratchet count or density (1..8)
+inline uint8_t burstLevelFromCV(int cv)
+{
+  if (cv < 0)
+  {
+    cv = 0;
+  }
+  if (cv > 4095)
+  {
+    cv = 4095;
+  }
+  return (cv >> 9) + 1;
+}
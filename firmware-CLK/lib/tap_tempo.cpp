@@ -0,0 +1,121 @@
+#pragma once
+#include <stdint.h>
+
+// Rolling tap tempo estimator
+// Taps are microsecond timestamps (micros(), wrap safe). The intervals of the last taps are
+// compared to their median, intervals off by more than TAP_OUTLIER_PERCENT (missed or double
+// taps) are dropped and the rest are averaged into a fractional BPM.
+
+#define TAP_WINDOW 8                 // Taps kept in the rolling window
+#define TAP_MIN_TAPS 3               // Taps needed before the first estimate
+#define TAP_TIMEOUT_US 2000000UL     // A pause longer than this starts a new tap sequence
+#define TAP_OUTLIER_PERCENT 25
+#define TAP_DEBOUNCE_US 50000UL      // The switch has to read high this long before a press counts
+
+struct TapTempo
+{
+  uint32_t taps[TAP_WINDOW];
+  uint8_t count = 0; // Taps in the window
+  uint8_t head = 0;  // Next slot to write
+  float estimate = 0;
+
+  void reset()
+  {
+    count = 0;
+    head = 0;
+  }
+
+  // Add a tap, returns true when a new BPM estimate is available
+  bool addTap(uint32_t timeUs)
+  {
+    if (count > 0 && timeUs - lastTap() > TAP_TIMEOUT_US)
+    {
+      reset();
+    }
+    taps[head] = timeUs;
+    head = (head + 1) % TAP_WINDOW;
+    if (count < TAP_WINDOW)
+    {
+      count++;
+    }
+    if (count < TAP_MIN_TAPS)
+    {
+      return false;
+    }
+    return computeEstimate();
+  }
+
+  uint32_t lastTap() const
+  {
+    return taps[(head + TAP_WINDOW - 1) % TAP_WINDOW];
+  }
+
+  float bpm() const
+  {
+    return estimate;
+  }
+
+  bool computeEstimate()
+  {
+    // Intervals between consecutive taps, oldest first
+    uint32_t intervals[TAP_WINDOW - 1];
+    uint8_t n = count - 1;
+    uint8_t first = (head + TAP_WINDOW - count) % TAP_WINDOW;
+    for (uint8_t i = 0; i < n; i++)
+    {
+      intervals[i] = taps[(first + i + 1) % TAP_WINDOW] - taps[(first + i) % TAP_WINDOW];
+    }
+
+    // Median by insertion sort on a copy, n is at most 7
+    uint32_t sorted[TAP_WINDOW - 1];
+    for (uint8_t i = 0; i < n; i++)
+    {
+      uint32_t value = intervals[i];
+      uint8_t j = i;
+      while (j > 0 && sorted[j - 1] > value)
+      {
+        sorted[j] = sorted[j - 1];
+        j--;
+      }
+      sorted[j] = value;
+    }
+    uint32_t median = (n & 1) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    uint32_t tolerance = median / 100 * TAP_OUTLIER_PERCENT;
+
+    uint64_t sum = 0;
+    uint8_t used = 0;
+    for (uint8_t i = 0; i < n; i++)
+    {
+      uint32_t diff = intervals[i] > median ? intervals[i] - median : median - intervals[i];
+      if (diff <= tolerance)
+      {
+        sum += intervals[i];
+        used++;
+      }
+    }
+    if (used == 0 || sum == 0)
+    {
+      return false;
+    }
+    estimate = 60000000.0f * used / sum;
+    return true;
+  }
+};
+
+// Debounce of the tap switch on its level. Every edge is seen, and a falling edge is a press
+// only when the switch read high for TAP_DEBOUNCE_US before it. Bounce on the press and on a
+// slow release keeps the high level short, so it never counts as a tap.
+struct TapDebounce
+{
+  bool high = true;      // Level after the last edge
+  uint32_t lastEdge = 0; // Time of the last edge
+
+  // Returns true when this edge is a press
+  bool edge(bool level, uint32_t timeUs)
+  {
+    bool settled = high && timeUs - lastEdge >= TAP_DEBOUNCE_US;
+    high = level;
+    lastEdge = timeUs;
+    return !level && settled;
+  }
+};
@@ -8,35 +8,25 @@
 #include <FlashAsEEPROM.h>
 #include <uClock.h>
 
+// Load local libraries
+#include "ratchet.cpp"
+#include "oled_pages.cpp"
+#include "tap_tempo.cpp"
+#include "lfo.cpp"
+
 // #define IN_SIMULATOR
 
+// Board pins and outputs (simulator pins with IN_SIMULATOR)
+#include "hal.h"
+#include "pulse_outputs.cpp"
+
 // Pin definitions
-#ifndef IN_SIMULATOR
-#define CLK_IN_PIN 7  // Clock input pin
-#define CV_1_IN_PIN 8 // channel 1 analog in
-#define CV_2_IN_PIN 9 // channel 2 analog in
-#define ENC_PIN_1 3   // rotary encoder left pin
-#define ENC_PIN_2 6   // rotary encoder right pin
-#define ENCODER_SW 10 // pin for encoder switch
-#define OUT_1 2
-#define OUT_2 1
-#define DAC_INTERNAL_PIN A0 // DAC output pin (internal). Second DAC output goes to MCP4725 via I2C
-#define NUM_OUTPUTS 1
-const int outputPins[NUM_OUTPUTS] = {LED_BUILTIN};
-#else
-// Pin definitions for simulator
-#define CLK_IN_PIN 12
-#define ENC_PIN_1 4
-#define ENC_PIN_2 3
-#define ENCODER_SW 2
-#define NUM_OUTPUTS 4
+#define ENCODER_SW ENC_CLICK_PIN
+#ifdef IN_SIMULATOR
+// The simulator has an LED per output, the board only the built-in LED for output 1
 const int outputPins[NUM_OUTPUTS] = {5, 6, 7, 8};
 #endif
 
-#define OLED_ADDRESS 0x3C
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
-
 ////////////////////////////////////////////
 // ADC calibration. Change these according to your resistor values to make readings more accurate
 float AD_CH1_calb = 0.98; // reduce resistance error
@@ -73,7 +63,7 @@ volatile bool usingExternalClock = false;
 unsigned long lastClockTime = 0;
 
 // Menu variables
-int menuItems = 8; // BPM, div1, div2, div3, div4, pulse duration, tap tempo, save
+int menuItems = 12; // BPM, div1, div2, div3, div4, pulse duration, tap tempo, save, cv1, cv2, out3 mode, out4 mode
 int menu_index = 0;
 bool SW = 0;
 bool old_SW = 0;
@@ -81,47 +71,58 @@ byte mode = 0;                                          // 0=menu select, 1=bpm,
 bool disp_refresh = 1;                                  // 0=not refresh display , 1= refresh display
 bool output_indicator[] = {false, false, false, false}; // Pulse status for indicator
 
-// -------------------------------------------------------------------------------
-
-// OUTPUTS
-void intDAC(int intDAC_OUT)
-{
-  analogWrite(DAC_INTERNAL_PIN, intDAC_OUT / 4); // "/4" -> 12bit to 10bit
-}
+// Display scheduler. The tick callback only latches output activity, the loop redraws at most
+// once per frame and only sends the changed indicator squares and BPM digits over I2C.
+#define DISPLAY_FRAME_MS 40       // 25 frames per second max
+unsigned long lastFrameTime = 0;
+volatile byte indicatorLatch = 0; // Set from the tick callback when an output pulses, so short pulses are still shown
+byte shownIndicators = 0;         // Indicator squares as currently drawn
+int shownBPM = -1;                // BPM digits as currently drawn
+bool shownExternalClock = false;
+DirtyPages dirtyPages;
+
+// Ratchet / burst settings driven by the CV inputs
+// cvAssign: 0=off, 1..NUM_OUTPUTS=ratchet count of output n, NUM_OUTPUTS+1..2*NUM_OUTPUTS=burst density of output n
+#define CV_OFF 0
+int const numCVAssigns = 2 * NUM_OUTPUTS + 1;
+byte cvAssign[2] = {CV_OFF, CV_OFF};
+volatile byte ratchetCount[NUM_OUTPUTS];             // Pulses per output period (1 = no ratchet)
+volatile byte burstDensity[NUM_OUTPUTS];             // Portion of the period used by the burst, in 1/8ths
+PulseOutput pulses[NUM_OUTPUTS];
+
+// CV outputs 3 (internal DAC) and 4 (MCP4725) can play a tempo-synced waveform instead of a gate
+#define FIRST_CV_OUTPUT 2
+byte outputMode[2] = {OUT_GATE, OUT_GATE};
+Lfo lfos[2];
+int lastCV[2] = {-1, -1};
+
+// MCP4725 writes are queued from the tick callback and sent by the loop, so the tick never
+// touches the I2C bus shared with the display. Gate edges go out in order, a CV sample
+// replaces what is waiting.
+#define MCP_MIN_INTERVAL_US 1000
+McpQueue mcpQueue;
+unsigned long lastMCPWrite = 0;
 
-void MCP(int MCP_OUT)
-{
-  Wire.beginTransmission(0x60);
-  Wire.write((MCP_OUT >> 8) & 0x0F);
-  Wire.write(MCP_OUT);
-  Wire.endTransmission();
-}
+// -------------------------------------------------------------------------------
 
-void PWM1(int duty1)
-{
-  pwm(OUT_1, 46000, duty1);
-}
-void PWM2(int duty2)
+// Output period in ticks for the selected divider, at least one tick
+uint32_t periodTicks(int output)
 {
-  pwm(OUT_2, 46000, duty2);
+  uint32_t period = int(PPQN / valid_dividers[dividers[output]]);
+  return period > 0 ? period : 1;
 }
 
 // This will manage the LEDs and display of the tempo for each output
 void tempoIndication(uint32_t *tick)
 {
-  // Refresh the display every 6 ticks
-  if (!(*tick % 6))
-  {
-    disp_refresh = 1;
-  }
-
   for (int i = 0; i < NUM_OUTPUTS; i++)
   {
     // Check if the current tick is a multiple of the multiplier
-    if (!(*tick % int(PPQN / valid_dividers[dividers[i]])) || (*tick == 0))
+    if (!(*tick % periodTicks(i)) || (*tick == 0))
     {
-      _bpm_blink_timer = int(48 / valid_dividers[dividers[i]]);
+      _bpm_blink_timer = periodTicks(i) > 1 ? periodTicks(i) / 2 : 1;
       output_indicator[i] = true;
+      indicatorLatch |= 1 << i;
       if (i == 0) // Sync the built-in LED with the first output
       {
         digitalWrite(LED_BUILTIN, HIGH);
@@ -145,41 +146,72 @@ void tempoIndication(uint32_t *tick)
   }
 }
 
-// Set the output pins to HIGH or LOW
-void setPin(int pin, int value)
+// Send the queued MCP4725 value, rate limited
+void serviceMCP()
 {
-  if (pin == 0) // Gate Output 1
+  if (!mcpQueue.pending() || micros() - lastMCPWrite < MCP_MIN_INTERVAL_US)
   {
-    value ? digitalWrite(OUT_1, HIGH) : digitalWrite(OUT_1, LOW);
+    return;
   }
-  else if (pin == 1) // Gate Output 2
+  noInterrupts();
+  int value = mcpQueue.take();
+  interrupts();
+  MCP(value);
+  lastMCPWrite = micros();
+}
+
+// Advance the waveform of a CV output and write the sample when it changed
+void lfoOutput(int output, uint32_t phase, uint32_t period)
+{
+  int n = output - FIRST_CV_OUTPUT;
+  if (phase == 0)
   {
-    value ? digitalWrite(OUT_2, HIGH) : digitalWrite(OUT_2, LOW);
+    lfos[n].sync(period);
   }
-  else if (pin == 2) // Internal DAC Output
+  else
+  {
+    lfos[n].advance();
+  }
+  int value = lfos[n].sample(outputMode[n]);
+  if (value == lastCV[n])
+  {
+    return;
+  }
+  lastCV[n] = value;
+  if (output == 2)
+  {
+    intDAC(value);
+  }
+  else
   {
-    value ? intDAC(4095) : intDAC(0);
+    mcpQueue.sample(value);
   }
-  else if (pin == 3) // MCP DAC Output
+}
+
+// Set every output back to a single pulse per period
+void resetBursts()
+{
+  for (int i = 0; i < NUM_OUTPUTS; i++)
   {
-    value ? MCP(4095) : MCP(0);
+    ratchetCount[i] = 1;
+    burstDensity[i] = MAX_DENSITY;
   }
 }
 
-// This will manage the output tick for each output with the configured pulse duration
+// This will manage the output tick for each output with the configured pulse duration.
+// Ratchets fire their burst pulses from here too, so they stay locked to the clock engine ticks.
 void tempoOutput(uint32_t *tick)
 {
   _bpm_output_timer = int(ceil((pulseDuration * bpm * PPQN) / (60000)));
   for (int i = 0; i < NUM_OUTPUTS; i++)
   {
-    if (!(*tick % int(PPQN / valid_dividers[dividers[i]])) || (*tick == 0))
+    uint32_t period = periodTicks(i);
+    if (i >= FIRST_CV_OUTPUT && outputMode[i - FIRST_CV_OUTPUT] != OUT_GATE)
     {
-      setPin(i, HIGH);
-    }
-    else if (!(*tick % _bpm_output_timer))
-    {
-      setPin(i, LOW);
+      lfoOutput(i, *tick % period, period);
+      continue;
     }
+    pulses[i].tick(i, *tick, period, ratchetCount[i], burstDensity[i], _bpm_output_timer, mcpQueue);
   }
 }
 
@@ -200,32 +232,46 @@ void updateBPM()
   uClock.setTempo(bpm);
 }
 
-// Tap tempo function, collects the time between three or more taps and sets the BPM accordingly
-static unsigned long lastTapTime = 0;
-static unsigned long tapTimes[3] = {0, 0, 0};
-static int tapIndex = 0;
-void setTapTempo()
+// Tap tempo. The encoder switch press is timestamped in an interrupt and queued for the loop,
+// so taps don't inherit the loop jitter. Both edges are taken so the switch is debounced on
+// its level.
+#define TAP_QUEUE_SIZE 4
+TapTempo tapTempo;
+volatile bool tapArmed = false; // Taps are only captured on the tap tempo menu item
+volatile uint32_t tapQueue[TAP_QUEUE_SIZE];
+volatile byte tapHead = 0;
+volatile byte tapTail = 0;
+TapDebounce tapDebounce;
+
+void onTapInterrupt()
 {
-  unsigned long currentMillis = millis();
-  if (currentMillis - lastTapTime > 2000)
+  uint32_t now = micros();
+  if (!tapDebounce.edge(digitalRead(ENCODER_SW), now) || !tapArmed)
   {
-    // Reset the tap tempo if no taps have been received for more than 2 seconds
-    tapIndex = 0;
+    return;
   }
-  if (tapIndex < 3)
+  byte next = (tapHead + 1) % TAP_QUEUE_SIZE;
+  if (next != tapTail)
   {
-    // Collect tap times
-    tapTimes[tapIndex] = currentMillis;
-    tapIndex++;
-    lastTapTime = currentMillis;
+    tapQueue[tapHead] = now;
+    tapHead = next;
   }
-  if (tapIndex == 3)
+}
+
+// Feed the captured taps to the estimator and hand the fractional BPM to the clock engine
+void handleTapTempo()
+{
+  tapArmed = (menu_index == 6 && mode == 0);
+  while (tapTail != tapHead)
   {
-    // Calculate the BPM from the tap times
-    unsigned long averageTime = (tapTimes[2] - tapTimes[0]) / 2;
-    bpm = 60000 / averageTime;
-    tapIndex++;
-    updateBPM();
+    uint32_t tapTime = tapQueue[tapTail];
+    tapTail = (tapTail + 1) % TAP_QUEUE_SIZE;
+    if (tapTempo.addTap(tapTime))
+    {
+      bpm = tapTempo.bpm();
+      updateBPM();
+      disp_refresh = 1;
+    }
   }
 }
 
@@ -242,6 +288,25 @@ void load()
     dividers[2] = EEPROM.read(3);
     dividers[3] = EEPROM.read(4);
     pulseDuration = EEPROM.read(5);
+    cvAssign[0] = EEPROM.read(6);
+    cvAssign[1] = EEPROM.read(7);
+    outputMode[0] = EEPROM.read(8);
+    outputMode[1] = EEPROM.read(9);
+    if (cvAssign[0] >= numCVAssigns)
+    {
+      cvAssign[0] = CV_OFF;
+    }
+    if (cvAssign[1] >= numCVAssigns)
+    {
+      cvAssign[1] = CV_OFF;
+    }
+    for (int n = 0; n < 2; n++)
+    {
+      if (outputMode[n] >= NUM_OUTPUT_MODES)
+      {
+        outputMode[n] = OUT_GATE;
+      }
+    }
   }
 }
 
@@ -254,6 +319,10 @@ void save()
   EEPROM.write(3, dividers[2]);
   EEPROM.write(4, dividers[3]);
   EEPROM.write(5, pulseDuration);
+  EEPROM.write(6, cvAssign[0]);
+  EEPROM.write(7, cvAssign[1]);
+  EEPROM.write(8, outputMode[0]);
+  EEPROM.write(9, outputMode[1]);
   EEPROM.commit();
   display.clearDisplay(); // clear display
   display.setTextSize(2);
@@ -320,16 +389,28 @@ void handleEncoderClick()
     {
       mode = 0;
     }
-    // Tap tempo
-    else if (menu_index == 6 && mode == 0)
-    {
-      setTapTempo();
-    }
     // Save settings
     else if (menu_index == 7 && mode == 0)
     {
       save();
     }
+    // CV input assignment, cycles through off / ratchet / density for each output
+    else if (menu_index == 8 && mode == 0)
+    {
+      cvAssign[0] = (cvAssign[0] + 1) % numCVAssigns;
+      resetBursts();
+    }
+    else if (menu_index == 9 && mode == 0)
+    {
+      cvAssign[1] = (cvAssign[1] + 1) % numCVAssigns;
+      resetBursts();
+    }
+    // Output 3 and 4 mode, cycles through gate and the waveforms
+    else if ((menu_index == 10 || menu_index == 11) && mode == 0)
+    {
+      byte &outMode = outputMode[menu_index - 10];
+      outMode = (outMode + 1) % NUM_OUTPUT_MODES;
+    }
   }
 }
 
@@ -404,17 +485,151 @@ void handleEncoderPosition()
   menu_index = constrain(menu_index, 0, menuItems - 1);
 }
 
+// Apply a CV reading to the ratchet count or burst density it is assigned to
+void applyCV(byte assign, float value)
+{
+  byte level = burstLevelFromCV(value);
+  if (assign >= 1 && assign <= NUM_OUTPUTS)
+  {
+    ratchetCount[assign - 1] = level;
+  }
+  else if (assign > NUM_OUTPUTS && assign < numCVAssigns)
+  {
+    burstDensity[assign - NUM_OUTPUTS - 1] = level;
+  }
+}
+
 void handleCVInputs()
 {
-  old_AD_CH1 = AD_CH1;
-  old_AD_CH2 = AD_CH2;
-  AD_CH1 = analogRead(CV_1_IN_PIN) / AD_CH1_calb;
-  AD_CH2 = analogRead(CV_2_IN_PIN) / AD_CH2_calb;
+  // Each reading takes around 0.7ms, so only read the inputs that drive something
+  if (cvAssign[0] != CV_OFF)
+  {
+    old_AD_CH1 = AD_CH1;
+    AD_CH1 = analogRead(CV_1_IN_PIN) / AD_CH1_calb;
+    applyCV(cvAssign[0], AD_CH1);
+  }
+  if (cvAssign[1] != CV_OFF)
+  {
+    old_AD_CH2 = AD_CH2;
+    AD_CH2 = analogRead(CV_2_IN_PIN) / AD_CH2_calb;
+    applyCV(cvAssign[1], AD_CH2);
+  }
+}
+
+// Print the CV assignment as OFF, RAT n or DEN n
+void printCVAssign(byte assign)
+{
+  if (assign == CV_OFF)
+  {
+    display.print("OFF");
+  }
+  else if (assign <= NUM_OUTPUTS)
+  {
+    display.print("RAT ");
+    display.print(assign);
+  }
+  else
+  {
+    display.print("DEN ");
+    display.print(assign - NUM_OUTPUTS);
+  }
 }
 
 //-----------------------------DISPLAY----------------------------------------
+// Indicator squares to draw this frame: output currently high or pulsed since the last frame
+byte takeIndicators()
+{
+  noInterrupts();
+  byte latched = indicatorLatch;
+  indicatorLatch = 0;
+  interrupts();
+  for (int i = 0; i < NUM_OUTPUTS; i++)
+  {
+    if (output_indicator[i])
+    {
+      latched |= 1 << i;
+    }
+  }
+  return latched;
+}
+
+// BPM value shown on the main screen
+int displayedBPM()
+{
+  return usingExternalClock ? int(uClock.getTempo()) : int(bpm);
+}
+
+void drawIndicator(int i, bool on)
+{
+  display.fillRect(i * 32, 40, 8, 8, on ? WHITE : BLACK);
+  display.drawRect(i * 32, 40, 8, 8, WHITE);
+  dirtyPages.mark(i * 32, 40, 8, 8);
+}
+
+void drawBPMDigits(int value)
+{
+  display.fillRect(70, 0, SCREEN_WIDTH - 70, 24, BLACK);
+  display.setTextSize(3);
+  display.setTextColor(WHITE);
+  display.setCursor(70, 0);
+  display.print(value);
+  dirtyPages.mark(70, 0, SCREEN_WIDTH - 70, 24);
+}
+
+// Send only the changed columns of each changed page. Queued MCP4725 writes go out between
+// chunks, and the bus goes back to 100 kHz afterwards.
+void flushDirtyPages()
+{
+  flushDirtyPages(display, Wire, OLED_ADDRESS, dirtyPages, 100000, serviceMCP);
+}
+
+// Update the indicator squares and BPM digits of the main screen in place
+void updateMainScreen()
+{
+  byte indicators = takeIndicators();
+  for (int i = 0; i < NUM_OUTPUTS; i++)
+  {
+    bool on = indicators & (1 << i);
+    if (on != bool(shownIndicators & (1 << i)))
+    {
+      drawIndicator(i, on);
+    }
+  }
+  shownIndicators = indicators;
+
+  int value = displayedBPM();
+  if (value != shownBPM)
+  {
+    drawBPMDigits(value);
+    shownBPM = value;
+  }
+  flushDirtyPages();
+}
+
 void handleOLEDDisplay()
 {
+  // Never redraw faster than the frame rate, the tick callback keeps running meanwhile
+  if (millis() - lastFrameTime < DISPLAY_FRAME_MS)
+  {
+    return;
+  }
+  lastFrameTime = millis();
+
+  if (usingExternalClock != shownExternalClock)
+  {
+    shownExternalClock = usingExternalClock;
+    disp_refresh = 1;
+  }
+
+  if (disp_refresh == 0)
+  {
+    if (menu_index == 0)
+    {
+      updateMainScreen();
+    }
+    return;
+  }
+
   if (disp_refresh == 1)
   {
     display.clearDisplay();
@@ -427,17 +642,14 @@ void handleOLEDDisplay()
       display.setTextSize(3);
       display.print("BPM");
       display.setCursor(70, 0);
-      if (usingExternalClock)
+      shownBPM = displayedBPM();
+      display.print(shownBPM);
+      if (shownExternalClock)
       {
-        display.print(int(uClock.getTempo()));
         display.setTextSize(1);
         display.setCursor(120, 24);
         display.print("E");
       }
-      else
-      {
-        display.print(int(bpm));
-      }
       if (mode == 0) // Draw empty triangle on the left of BPM
       {
         display.drawTriangle(0, 2, 0, 18, 8, 10, WHITE);
@@ -449,12 +661,13 @@ void handleOLEDDisplay()
 
       // Sync small boxes to each output to show the pulse status
       display.setTextSize(1);
+      shownIndicators = takeIndicators();
       for (int i = 0; i < NUM_OUTPUTS; i++)
       {
         display.setCursor(i * 32, 30);
         display.print(i + 1);
         display.drawRect(i * 32, 40, 8, 8, WHITE);
-        if (output_indicator[i])
+        if (shownIndicators & (1 << i))
         {
           display.fillRect(i * 32, 40, 8, 8, WHITE);
         }
@@ -524,7 +737,41 @@ void handleOLEDDisplay()
         display.fillTriangle(1, 49, 1, 57, 5, 53, 1);
       }
     }
-    display.display();
+    else if (menu_index >= 8 && menu_index <= 11)
+    {
+      display.setTextSize(1);
+      display.setCursor(10, 1);
+      display.println("CV IN / CV OUT");
+      for (int ch = 0; ch < 2; ch++)
+      {
+        display.setCursor(10, 20 + (ch * 9));
+        display.print("CV");
+        display.print(ch + 1);
+        display.print(":");
+        display.setCursor(70, 20 + (ch * 9));
+        printCVAssign(cvAssign[ch]);
+        if (menu_index == ch + 8)
+        {
+          display.drawTriangle(1, 19 + (ch * 9), 1, 27 + (ch * 9), 5, 23 + (ch * 9), 1);
+        }
+      }
+      for (int n = 0; n < 2; n++)
+      {
+        display.setCursor(10, 38 + (n * 9));
+        display.print("OUT");
+        display.print(n + 3);
+        display.print(":");
+        display.setCursor(70, 38 + (n * 9));
+        display.print(outputModeNames[outputMode[n]]);
+        if (menu_index == n + 10)
+        {
+          display.drawTriangle(1, 37 + (n * 9), 1, 45 + (n * 9), 5, 41 + (n * 9), 1);
+        }
+      }
+    }
+    // Sent in chunks so queued MCP4725 writes can go out in between
+    dirtyPages.markAll();
+    flushDirtyPages();
     disp_refresh = 0;
   }
 }
@@ -568,8 +815,7 @@ void setup()
   pinMode(LED_BUILTIN, OUTPUT);        // LED
 
   display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS);
-  analogWriteResolution(10);
-  analogReadResolution(12);
+  halBegin();
 
   pinMode(CLK_IN_PIN, INPUT_PULLDOWN); // CLK in
   pinMode(CV_1_IN_PIN, INPUT);         // IN1
@@ -578,22 +824,28 @@ void setup()
   pinMode(OUT_1, OUTPUT);              // CH1 out
   pinMode(OUT_2, OUTPUT);              // CH2 out
   pinMode(LED_BUILTIN, OUTPUT);        // LED
+#ifdef IN_SIMULATOR
+  for (int i = 0; i < NUM_OUTPUTS; i++)
+  {
+    pinMode(outputPins[i], OUTPUT);
+  }
+#endif
 
   attachInterrupt(digitalPinToInterrupt(CLK_IN_PIN), onClockReceived, RISING);
+  attachInterrupt(digitalPinToInterrupt(ENCODER_SW), onTapInterrupt, CHANGE);
 
   // I2C connect (to MCP4725)
   Wire.begin();
 
   display.display();
 
-  // ADC settings. These increase ADC reading stability but at the cost of cycle time. Takes around 0.7ms for one reading with these
-  REG_ADC_AVGCTRL |= ADC_AVGCTRL_SAMPLENUM_1;
-  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_128 | ADC_AVGCTRL_ADJRES(4);
+  adcAveraging();
 
   // inits the clock library
   uClock.init();
 
   // read stored data (before setting the clock BPM)
+  resetBursts();
   load();
 
   updateBPM();
@@ -616,8 +868,12 @@ void loop()
 
   handleEncoderPosition();
 
+  handleTapTempo();
+
   handleCVInputs();
 
+  serviceMCP();
+
   handleOLEDDisplay();
 
   handleExternalClock();
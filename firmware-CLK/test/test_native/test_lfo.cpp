@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include "lfo.cpp"
+
+TEST(lfo, SawCoversFullRange)
+{
+  Lfo lfo;
+  lfo.sync(96);
+  EXPECT_EQ(0, lfo.sample(OUT_SAW));
+  uint16_t last = 0;
+  for (int tick = 1; tick < 96; tick++)
+  {
+    lfo.advance();
+    EXPECT_GT(lfo.sample(OUT_SAW), last);
+    last = lfo.sample(OUT_SAW);
+  }
+  EXPECT_GT(last, 4000);
+}
+
+TEST(lfo, TrianglePeaksHalfway)
+{
+  Lfo lfo;
+  lfo.sync(96);
+  for (int tick = 0; tick < 48; tick++)
+  {
+    lfo.advance();
+  }
+  EXPECT_NEAR(4095, lfo.sample(OUT_TRIANGLE), 2);
+  for (int tick = 0; tick < 47; tick++)
+  {
+    lfo.advance();
+  }
+  EXPECT_LT(lfo.sample(OUT_TRIANGLE), 100);
+}
+
+TEST(lfo, SineQuarterPoints)
+{
+  Lfo lfo;
+  lfo.sync(384);
+  EXPECT_NEAR(2048, lfo.sample(OUT_SINE), 1);
+  for (int tick = 0; tick < 96; tick++)
+  {
+    lfo.advance();
+  }
+  EXPECT_NEAR(4095, lfo.sample(OUT_SINE), 1);
+  for (int tick = 0; tick < 192; tick++)
+  {
+    lfo.advance();
+  }
+  EXPECT_NEAR(0, lfo.sample(OUT_SINE), 1);
+}
+
+TEST(lfo, RandomHoldsForAPeriod)
+{
+  Lfo lfo;
+  lfo.sync(24);
+  uint16_t held = lfo.sample(OUT_RANDOM);
+  for (int tick = 1; tick < 24; tick++)
+  {
+    lfo.advance();
+    EXPECT_EQ(held, lfo.sample(OUT_RANDOM));
+  }
+  bool changed = false;
+  for (int period = 0; period < 8; period++)
+  {
+    lfo.sync(24);
+    changed |= lfo.sample(OUT_RANDOM) != held;
+    EXPECT_LE(lfo.sample(OUT_RANDOM), 4095);
+  }
+  EXPECT_TRUE(changed);
+}
+
+TEST(lfo, ShortPeriodsStayInRange)
+{
+  Lfo lfo;
+  lfo.sync(1);
+  for (int tick = 0; tick < 4; tick++)
+  {
+    EXPECT_LE(lfo.sample(OUT_SAW), 4095);
+    EXPECT_LE(lfo.sample(OUT_TRIANGLE), 4095);
+    EXPECT_LE(lfo.sample(OUT_SINE), 4095);
+    lfo.advance();
+  }
+}
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include "pulse_outputs.cpp"
+
+#define TICK_US 5208 // 96 PPQN at 120 BPM
+
+// Clock engine ticks from `from` up to `to` (excluded) for one output, one virtual tick apart
+static void runTicks(PulseOutput &pulse, int pin, uint32_t from, uint32_t to, uint32_t period, uint8_t count, uint8_t density, uint32_t width, McpQueue &mcp)
+{
+  for (uint32_t tick = from; tick < to; tick++)
+  {
+    halTrace.now = tick * TICK_US;
+    pulse.tick(pin, tick, period, count, density, width, mcp);
+  }
+}
+
+TEST(PulseOutputsTest, OnePulsePerPeriod)
+{
+  PulseOutput pulse;
+  McpQueue queue;
+  halTrace = {};
+  runTicks(pulse, 0, 0, 192, 96, 1, MAX_DENSITY, 10, queue);
+
+  ASSERT_EQ(4, halTrace.count);
+  const uint32_t edges[4] = {0, 10, 96, 106};
+  for (int n = 0; n < 4; n++)
+  {
+    EXPECT_EQ(HAL_PIN, halTrace.events[n].device);
+    EXPECT_EQ(OUT_1, halTrace.events[n].channel);
+    EXPECT_EQ(edges[n] * TICK_US, halTrace.events[n].us) << n;
+    EXPECT_EQ(n % 2 == 0, halTrace.events[n].value) << n;
+  }
+  EXPECT_FALSE(queue.pending());
+}
+
+TEST(PulseOutputsTest, RatchetsSplitTheBurst)
+{
+  PulseOutput pulse;
+  McpQueue queue;
+  halTrace = {};
+  // 4 pulses over the first half of the period, each 6 ticks out of 12
+  runTicks(pulse, 1, 0, 96, 96, 4, MAX_DENSITY / 2, 10, queue);
+
+  ASSERT_EQ(8, halTrace.countOf(HAL_PIN, OUT_2));
+  for (int n = 0; n < 8; n++)
+  {
+    EXPECT_EQ(uint32_t(n / 2 * 12 + n % 2 * 6) * TICK_US, halTrace.events[n].us) << n;
+    EXPECT_EQ(n % 2 == 0, halTrace.events[n].value) << n;
+  }
+  EXPECT_FALSE(Pin<OUT_2>::read());
+}
+
+TEST(PulseOutputsTest, CVOutputsAsGates)
+{
+  PulseOutput dac, mcp;
+  McpQueue queue;
+  halTrace = {};
+  runTicks(dac, 2, 0, 20, 96, 1, MAX_DENSITY, 10, queue);
+  EXPECT_EQ(2, halTrace.count);
+  EXPECT_EQ(0, halTrace.last(HAL_DAC)->value);
+  EXPECT_EQ(10u * TICK_US, halTrace.last(HAL_DAC)->us);
+
+  // the MCP4725 value is only queued, the tick never waits on the bus
+  halTrace.clear();
+  runTicks(mcp, 3, 0, 1, 96, 1, MAX_DENSITY, 10, queue);
+  EXPECT_EQ(4095, queue.value[0]);
+  runTicks(mcp, 3, 1, 20, 96, 1, MAX_DENSITY, 10, queue);
+  EXPECT_EQ(0, halTrace.count);
+  EXPECT_EQ(4095, queue.take());
+  EXPECT_EQ(0, queue.take());
+  EXPECT_FALSE(queue.pending());
+}
+
+TEST(PulseOutputsTest, ShortPulsesReachTheMCP)
+{
+  // 2 tick pulses, the loop only gets to the bus every 5 ticks
+  PulseOutput mcp;
+  McpQueue queue;
+  halTrace = {};
+  for (uint32_t tick = 0; tick < 192; tick++)
+  {
+    halTrace.now = tick * TICK_US;
+    mcp.tick(3, tick, 96, 1, MAX_DENSITY, 2, queue);
+    if (tick % 5 == 4 && queue.pending())
+    {
+      MCP(queue.take());
+    }
+  }
+  ASSERT_EQ(4, halTrace.countOf(HAL_MCP));
+  for (int n = 0; n < 4; n++)
+  {
+    EXPECT_EQ(n % 2 ? 0 : 4095, halTrace.events[n].value) << n;
+  }
+}
+
+TEST(PulseOutputsTest, MCPQueueKeepsTheLastLevel)
+{
+  McpQueue queue;
+  queue.edge(4095);
+  queue.edge(4095); // no change
+  queue.edge(0);
+  queue.edge(4095); // a third edge, the pending pulse is dropped
+  EXPECT_EQ(4095, queue.take());
+  EXPECT_FALSE(queue.pending());
+
+  queue.edge(0);
+  queue.sample(1234); // a CV sample replaces the queue
+  EXPECT_EQ(1234, queue.take());
+  EXPECT_EQ(-1, queue.take());
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include "ratchet.cpp"
+
+// Count the pulses fired over one output period
+static int countPulses(uint32_t period, uint8_t count, uint8_t density)
+{
+  int pulses = 0;
+  for (uint32_t phase = 0; phase < period; phase++)
+  {
+    pulses += burstPulseAt(phase, period, count, density);
+  }
+  return pulses;
+}
+
+TEST(ratchet, SinglePulseWithoutRatchet)
+{
+  EXPECT_EQ(1, countPulses(96, 1, 8));
+  EXPECT_TRUE(burstPulseAt(0, 96, 1, 8));
+  EXPECT_FALSE(burstPulseAt(48, 96, 1, 8));
+}
+
+TEST(ratchet, EvenlySpacedBurst)
+{
+  // 4 pulses over a quarter note at 96 PPQN land every 24 ticks
+  for (uint32_t phase = 0; phase < 96; phase++)
+  {
+    EXPECT_EQ(phase % 24 == 0, burstPulseAt(phase, 96, 4, 8)) << "phase " << phase;
+  }
+}
+
+TEST(ratchet, DensityCompressesBurst)
+{
+  // Half density puts the 4 pulses in the first 48 ticks
+  for (uint32_t phase = 0; phase < 96; phase++)
+  {
+    EXPECT_EQ(phase < 48 && phase % 12 == 0, burstPulseAt(phase, 96, 4, 4)) << "phase " << phase;
+  }
+}
+
+TEST(ratchet, AllCountsFitEveryPeriod)
+{
+  uint32_t periods[] = {1, 3, 6, 12, 24, 96, 384, 12288};
+  for (uint32_t period : periods)
+  {
+    for (uint8_t count = 1; count <= MAX_RATCHETS; count++)
+    {
+      for (uint8_t density = 1; density <= MAX_DENSITY; density++)
+      {
+        // two ticks per pulse at most: one high and one low
+        int fit = period / 2 > 0 ? period / 2 : 1;
+        int expected = count < fit ? count : fit;
+        EXPECT_EQ(expected, countPulses(period, count, density)) << period << " " << int(count) << " " << int(density);
+      }
+    }
+  }
+}
+
+TEST(ratchet, PulseWidthKeepsGaps)
+{
+  EXPECT_EQ(20u, burstPulseWidth(96, 1, 8, 20));
+  EXPECT_EQ(6u, burstPulseWidth(96, 8, 8, 20));
+  EXPECT_EQ(1u, burstPulseWidth(6, 8, 8, 20));
+}
+
+TEST(ratchet, ShortPeriodsNeverMergePulses)
+{
+  // the output level tick by tick. Every pulse has to fall before the next one rises.
+  uint32_t periods[] = {2, 3, 5, 6, 7, 12, 15};
+  for (uint32_t period : periods)
+  {
+    for (uint8_t count = 2; count <= MAX_RATCHETS; count++)
+    {
+      for (uint8_t density = 1; density <= MAX_DENSITY; density++)
+      {
+        uint32_t width = burstPulseWidth(period, count, density, 20);
+        uint32_t offTick = 0;
+        bool high = false;
+        for (uint32_t phase = 0; phase < period; phase++)
+        {
+          if (high && phase >= offTick)
+          {
+            high = false;
+          }
+          if (burstPulseAt(phase, period, count, density))
+          {
+            EXPECT_FALSE(high) << period << " " << int(count) << " " << int(density) << " phase " << phase;
+            high = true;
+            offTick = phase + width;
+          }
+        }
+      }
+    }
+  }
+  EXPECT_EQ(3, burstCount(6, 8, 8));
+  EXPECT_EQ(1, burstCount(1, 4, 8));
+}
+
+TEST(ratchet, LevelFromCV)
+{
+  EXPECT_EQ(1, burstLevelFromCV(-10));
+  EXPECT_EQ(1, burstLevelFromCV(0));
+  EXPECT_EQ(4, burstLevelFromCV(1600));
+  EXPECT_EQ(8, burstLevelFromCV(4095));
+  EXPECT_EQ(8, burstLevelFromCV(5000));
+}
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include "tap_tempo.cpp"
+
+// Small deterministic generator so the humanised sequences are the same on every run
+static uint32_t rngState = 12345;
+static uint32_t nextRandom()
+{
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+// Roughly gaussian jitter (sum of uniforms) with the given spread in microseconds
+static int32_t jitter(int32_t spreadUs)
+{
+  int32_t sum = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    sum += int32_t(nextRandom() % (2 * spreadUs + 1)) - spreadUs;
+  }
+  return sum / 2;
+}
+
+// Feed `taps` humanised taps at `bpm` starting at `start`, returns the final estimate
+static float tapSequence(TapTempo &tap, float bpm, int taps, int32_t spreadUs, uint32_t start = 1000000)
+{
+  double period = 60000000.0 / bpm;
+  for (int i = 0; i < taps; i++)
+  {
+    tap.addTap(start + uint32_t(i * period) + jitter(spreadUs));
+  }
+  return tap.bpm();
+}
+
+TEST(tapTempo, NeedsThreeTaps)
+{
+  TapTempo tap;
+  EXPECT_FALSE(tap.addTap(1000000));
+  EXPECT_FALSE(tap.addTap(1500000));
+  EXPECT_TRUE(tap.addTap(2000000));
+  EXPECT_FLOAT_EQ(120.0f, tap.bpm());
+}
+
+TEST(tapTempo, FractionalTempo)
+{
+  TapTempo tap;
+  EXPECT_NEAR(97.5f, tapSequence(tap, 97.5f, 8, 0), 0.01f);
+}
+
+TEST(tapTempo, HumanisedTapsAcrossTempoRange)
+{
+  float tempos[] = {40, 60, 90, 120, 128, 174, 240, 300, 350};
+  for (float bpm : tempos)
+  {
+    for (int run = 0; run < 20; run++)
+    {
+      TapTempo tap;
+      // 10ms of timing spread, a good human tapper
+      float estimate = tapSequence(tap, bpm, 12, 10000);
+      EXPECT_NEAR(bpm, estimate, bpm * 0.025f) << "bpm " << bpm << " run " << run;
+    }
+  }
+}
+
+TEST(tapTempo, RollingWindowFollowsTempoChange)
+{
+  TapTempo tap;
+  uint32_t t = 1000000;
+  for (int i = 0; i < 8; i++, t += 500000)
+  {
+    tap.addTap(t);
+  }
+  EXPECT_NEAR(120.0f, tap.bpm(), 0.01f);
+  for (int i = 0; i < 8; i++, t += 400000)
+  {
+    tap.addTap(t);
+  }
+  EXPECT_NEAR(150.0f, tap.bpm(), 0.01f);
+}
+
+TEST(tapTempo, RejectsMissedTap)
+{
+  TapTempo tap;
+  uint32_t times[] = {0, 500000, 1000000, 2000000, 2500000, 3000000}; // one beat skipped
+  for (uint32_t t : times)
+  {
+    tap.addTap(t + 100);
+  }
+  EXPECT_NEAR(120.0f, tap.bpm(), 0.01f);
+}
+
+TEST(tapTempo, PauseStartsNewSequence)
+{
+  TapTempo tap;
+  tapSequence(tap, 120, 4, 0, 1000000);
+  EXPECT_FALSE(tap.addTap(10000000));
+  EXPECT_FALSE(tap.addTap(10600000));
+  EXPECT_TRUE(tap.addTap(11200000));
+  EXPECT_NEAR(100.0f, tap.bpm(), 0.01f);
+}
+
+TEST(tapTempo, MicrosWrapAround)
+{
+  TapTempo tap;
+  uint32_t start = 0xFFFFFFFFUL - 1200000UL;
+  EXPECT_NEAR(120.0f, tapSequence(tap, 120, 6, 0, start), 0.01f);
+}
+
+TEST(tapDebounce, BounceOnPressAndReleaseIsNoTap)
+{
+  TapDebounce debounce;
+  uint32_t t = 1000000;
+  EXPECT_TRUE(debounce.edge(false, t)); // press
+  // contact bounce on the press
+  EXPECT_FALSE(debounce.edge(true, t + 300));
+  EXPECT_FALSE(debounce.edge(false, t + 900));
+  // slow release bouncing for 30 ms after a 40 ms hold
+  EXPECT_FALSE(debounce.edge(true, t + 40000));
+  EXPECT_FALSE(debounce.edge(false, t + 52000));
+  EXPECT_FALSE(debounce.edge(true, t + 58000));
+  EXPECT_FALSE(debounce.edge(false, t + 70000));
+  EXPECT_FALSE(debounce.edge(true, t + 71000));
+  // next press after the switch stayed released
+  EXPECT_TRUE(debounce.edge(false, t + 500000));
+}
+
+TEST(tapDebounce, ReleaseMustSettleBeforeTheNextPress)
+{
+  TapDebounce debounce;
+  EXPECT_TRUE(debounce.edge(false, 100000));
+  EXPECT_FALSE(debounce.edge(true, 200000));
+  EXPECT_FALSE(debounce.edge(false, 200000 + TAP_DEBOUNCE_US - 1));
+  EXPECT_FALSE(debounce.edge(true, 300000));
+  EXPECT_TRUE(debounce.edge(false, 300000 + TAP_DEBOUNCE_US));
+}
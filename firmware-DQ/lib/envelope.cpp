@@ -0,0 +1,91 @@
+#pragma once
+#include <stdint.h>
+
+#include "hal.h"
+
+// Clock input and AD envelopes of the quantizer
+// A rising clock input (or a new quantized note, when the output syncs to notes) starts an
+// envelope. It walks the curve up in ENVELOPE_STEPS attack steps, then down again in decay
+// steps, and goes out on PWM1 or PWM2. The PWM is inverted by the output stage, so the
+// envelope at rest is a duty of 1021 and its peak a duty of 1.
+
+#define ENVELOPE_STEPS 200
+#define ATTACK_STEP_US 200 // per attack setting above 1
+#define DECAY_STEP_US 600  // per decay setting above 1
+
+inline const int envelopeCurve[ENVELOPE_STEPS] = {
+    0, 15, 30, 44, 59, 73, 87, 101, 116, 130, 143, 157, 170, 183, 195, 208, 220, 233, 245, 257, 267, 279, 290, 302, 313, 324, 335, 346, 355, 366, 376, 386, 397, 405, 415, 425, 434, 443, 452, 462, 470, 479, 488, 495, 504, 513, 520, 528, 536, 544, 552, 559, 567, 573, 581, 589, 595, 602, 609, 616, 622, 629, 635, 642, 648, 654, 660, 666, 672, 677, 683, 689, 695, 700, 706, 711, 717, 722, 726, 732, 736, 741, 746, 751, 756, 760, 765, 770, 774, 778, 783, 787, 791, 796, 799, 803, 808, 811, 815, 818, 823, 826, 830, 834, 837, 840, 845, 848, 851, 854, 858, 861, 864, 866, 869, 873, 876, 879, 881, 885, 887, 890, 893, 896, 898, 901, 903, 906, 909, 911, 913, 916, 918, 920, 923, 925, 927, 929, 931, 933, 936, 938, 940, 942, 944, 946, 948, 950, 952, 954, 955, 957, 960, 961, 963, 965, 966, 968, 969, 971, 973, 975, 976, 977, 979, 980, 981, 983, 984, 986, 988, 989, 990, 991, 993, 994, 995, 996, 997, 999, 1000, 1002, 1003, 1004, 1005, 1006, 1007, 1008, 1009, 1010, 1012, 1013, 1014, 1014, 1015, 1016, 1017, 1018, 1019, 1020};
+
+// Clock input jack, polled once per loop pass
+struct ClockInput
+{
+  bool level = 0;
+
+  // Reads the jack, returns true on a rising edge
+  bool rose()
+  {
+    bool old = level;
+    level = Pin<CLK_IN_PIN>::read();
+    return level && !old;
+  }
+};
+
+struct Envelope
+{
+  int position = 0;    // attack steps 0..199, decay steps 200..398, 399 = done
+  bool running = 0;
+  uint32_t stepAt = 0; // time of the last step
+
+  // Start over, attack 1 has no attack time
+  void trigger(uint32_t now, int attack)
+  {
+    position = attack == 1 ? ENVELOPE_STEPS : 0;
+    running = 1;
+    stepAt = now;
+  }
+
+  // Take the next step when it is due, returns the PWM duty
+  int update(uint32_t now, int attack, int decay)
+  {
+    if (running && position < ENVELOPE_STEPS && now - stepAt >= uint32_t((attack - 1) * ATTACK_STEP_US))
+    {
+      position++;
+      stepAt = now;
+    }
+    else if (running && position >= ENVELOPE_STEPS && now - stepAt >= uint32_t((decay - 1) * DECAY_STEP_US))
+    {
+      position++;
+      stepAt = now;
+    }
+
+    if (position < ENVELOPE_STEPS)
+    {
+      return 1021 - envelopeCurve[position];
+    }
+    if (position < 2 * ENVELOPE_STEPS - 1)
+    {
+      return envelopeCurve[position - ENVELOPE_STEPS];
+    }
+    running = 0;
+    return 1023;
+  }
+};
+
+// One loop pass of envelope output 0 (PWM1) or 1 (PWM2): a trigger starts it over, then it
+// steps and goes out
+inline void envelopeOutput(Envelope &envelope, uint8_t ch, bool trigger, uint32_t now, int attack, int decay)
+{
+  if (trigger)
+  {
+    envelope.trigger(now, attack);
+  }
+  int duty = envelope.update(now, attack, decay);
+  if (ch == 0)
+  {
+    PWM1(duty);
+  }
+  else
+  {
+    PWM2(duty);
+  }
+}
@@ -6,35 +6,21 @@
 #include <Adafruit_SSD1306.h>
 #include <Adafruit_GFX.h>
 
-// Load local libraries
+// Load shared libraries, pins and outputs from ../shared/hal.h
+#include "hal.h"
 #include "scales.cpp"
 #include "quantizer.cpp"
-
-#define OLED_ADDRESS 0x3C
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
+#include "envelope.cpp"
 
 // rotary encoder setting
 #define ENCODER_OPTIMIZE_INTERRUPTS // counter measure of noise
 
-#define CLK_IN_PIN 7     // Clock input pin
-#define CV_1_IN_PIN 8    // channel 1 analog in
-#define CV_2_IN_PIN 9    // channel 2 analog in
-#define ENC_PIN_1 3      // rotary encoder left pin
-#define ENC_PIN_2 6      // rotary encoder right pin
-#define ENC_CLICK_PIN 10 // pin for encoder switch
-#define ENV_OUT_PIN_1 1
-#define ENV_OUT_PIN_2 2
-#define DAC_INTERNAL_PIN A0 // DAC output pin (internal)
-// Second DAC output goes to MCP4725 via I2C
+#define ENV_OUT_PIN_1 OUT_PIN_1 // envelopes on PWM1 and PWM2
+#define ENV_OUT_PIN_2 OUT_PIN_2
 
 // Declare function prototypes
 void noteDisp(int, int, boolean);
 void OLED_display();
-void intDAC(int);
-void MCP(int);
-void PWM1(int);
-void PWM2(int);
 void save();
 
 ////////////////////////////////////////////
@@ -57,25 +43,14 @@ int i = 1;
 
 bool SW = 0;
 bool old_SW = 0;
-bool CLK_in = 0;
-bool old_CLK_in = 0;
 byte mode = 0; // 0=select,1=atk1,2=dcy1,3=atk2,4=dcy2
 
 float AD_CH1, old_AD_CH1, AD_CH2, old_AD_CH2;
 
 int CV_in1, CV_in2;
 float CV_out1, CV_out2, old_CV_out1, old_CV_out2;
-long gate_timer1, gate_timer2; // EG curve progress speed
-
-int k = 0;
-
-// envelope curve setting
-int ad[200] = { // envelope table
-    0, 15, 30, 44, 59, 73, 87, 101, 116, 130, 143, 157, 170, 183, 195, 208, 220, 233, 245, 257, 267, 279, 290, 302, 313, 324, 335, 346, 355, 366, 376, 386, 397, 405, 415, 425, 434, 443, 452, 462, 470, 479, 488, 495, 504, 513, 520, 528, 536, 544, 552, 559, 567, 573, 581, 589, 595, 602, 609, 616, 622, 629, 635, 642, 648, 654, 660, 666, 672, 677, 683, 689, 695, 700, 706, 711, 717, 722, 726, 732, 736, 741, 746, 751, 756, 760, 765, 770, 774, 778, 783, 787, 791, 796, 799, 803, 808, 811, 815, 818, 823, 826, 830, 834, 837, 840, 845, 848, 851, 854, 858, 861, 864, 866, 869, 873, 876, 879, 881, 885, 887, 890, 893, 896, 898, 901, 903, 906, 909, 911, 913, 916, 918, 920, 923, 925, 927, 929, 931, 933, 936, 938, 940, 942, 944, 946, 948, 950, 952, 954, 955, 957, 960, 961, 963, 965, 966, 968, 969, 971, 973, 975, 976, 977, 979, 980, 981, 983, 984, 986, 988, 989, 990, 991, 993, 994, 995, 996, 997, 999, 1000, 1002, 1003, 1004, 1005, 1006, 1007, 1008, 1009, 1010, 1012, 1013, 1014, 1014, 1015, 1016, 1017, 1018, 1019, 1020};
-int ad1 = 0; // PWM DUTY reference
-int ad2 = 0; // PWM DUTY reference
-bool ad_trg1 = 0;
-bool ad_trg2 = 0;
+ClockInput clockIn;
+Envelope env1, env2;
 int atk1, atk2, dcy1, dcy2;                       // attack time,decay time
 bool sync1, sync2;                                // 0=sync with trig , 1=sync with note change
 int sensitivity_ch1, sensitivity_ch2, oct1, oct2; // sens = AD input attn,amp.oct=octave shift
@@ -97,8 +72,7 @@ bool disp_refresh = 1; // 0=not refresh display , 1= refresh display , counterme
 //-------------------------------Initial setting--------------------------
 void setup()
 {
-  analogWriteResolution(10);
-  analogReadResolution(12);
+  halBegin();
   pinMode(CLK_IN_PIN, INPUT_PULLDOWN);  // CLK in
   pinMode(CV_1_IN_PIN, INPUT);          // IN1
   pinMode(CV_2_IN_PIN, INPUT);          // IN2
@@ -106,15 +80,12 @@ void setup()
   pinMode(ENV_OUT_PIN_1, OUTPUT);       // CH1 EG out
   pinMode(ENV_OUT_PIN_2, OUTPUT);       // CH2 EG out
   // OLED initialize
-  display.begin(SSD1306_SWITCHCAPVCC, 0x3C);
-  display.clearDisplay();
+  displayBegin(display);
 
   // I2C connect
   Wire.begin();
 
-  // ADC settings. These increase ADC reading stability but at the cost of cycle time. Takes around 0.7ms for one reading with these
-  REG_ADC_AVGCTRL |= ADC_AVGCTRL_SAMPLENUM_1;
-  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_128 | ADC_AVGCTRL_ADJRES(4);
+  adcAveraging();
 
   // read stored data
   if (EEPROM.isValid() == 1)
@@ -171,7 +142,6 @@ void setup()
 void loop()
 {
   old_SW = SW;
-  old_CLK_in = CLK_in;
   old_CV_out1 = CV_out1;
   old_CV_out2 = CV_out2;
   old_AD_CH1 = AD_CH1;
@@ -372,104 +342,11 @@ void loop()
   quantizeCV(AD_CH2, cv_qnt_thr_buf2, sensitivity_ch2, oct2, &CV_out2);
 
   //-------------------------------OUTPUT SETTING--------------------------
-  CLK_in = digitalRead(CLK_IN_PIN);
-
-  // trig sync trigger detect
-  if (CLK_in == 1 && old_CLK_in == 0)
-  {
-    if (sync1 == 0)
-    {
-      ad1 = 0;
-      ad_trg1 = 1;
-      gate_timer1 = micros();
-      if (atk1 == 1)
-      {
-        ad1 = 200; // no attack time
-      }
-    }
-    if (sync2 == 0)
-      ad2 = 0;
-    ad_trg2 = 1;
-    gate_timer2 = micros();
-    if (atk2 == 1)
-    {
-      ad2 = 200; // no attack time
-    }
-  }
-
-  // note sync trigger detect
-  if (sync1 == 1 && old_CV_out1 != CV_out1)
-  {
-    ad1 = 0;
-    ad_trg1 = 1;
-    gate_timer1 = micros();
-    if (atk1 == 1)
-    {
-      ad1 = 200; // no attack time
-    }
-  }
-  if (sync2 == 1 && old_CV_out2 != CV_out2)
-  {
-    ad2 = 0;
-    ad_trg2 = 1;
-    gate_timer2 = micros();
-    if (atk2 == 1)
-    {
-      ad2 = 200; // no attack time
-    }
-  }
-
-  // envelope ch1 out
-  if (gate_timer1 + (atk1 - 1) * 200 <= micros() && ad_trg1 == 1 && ad1 <= 199)
-  {
-    ad1++;
-    gate_timer1 = micros();
-  }
-  else if (gate_timer1 + (dcy1 - 1) * 600 <= micros() && ad_trg1 == 1 && ad1 > 199)
-  {
-    ad1++;
-    gate_timer1 = micros();
-  }
-
-  if (ad1 <= 199)
-  {
-    PWM1(1021 - ad[ad1]);
-  }
-  else if (ad1 > 199 && ad1 < 399)
-  {
-    PWM1(ad[ad1 - 200]);
-  }
-  else if (ad1 >= 399)
-  {
-    PWM1(1023);
-    ad_trg1 = 0;
-  }
-
-  // envelope ch2 out
-  if (gate_timer2 + (atk2 - 1) * 200 <= micros() && ad_trg2 == 1 && ad2 <= 199)
-  {
-    ad2++;
-    gate_timer2 = micros();
-  }
-  else if (gate_timer2 + (dcy2 - 1) * 600 <= micros() && ad_trg2 == 1 && ad2 > 199)
-  {
-    ad2++;
-    gate_timer2 = micros();
-  }
-
-  if (ad2 <= 199)
-  {
-    PWM2(1021 - ad[ad2]);
-  }
-  else if (ad2 > 199 && ad2 < 399)
-  {
-    PWM2(ad[ad2 - 200]);
-  }
-  else if (ad2 >= 399)
-  {
-    PWM2(1023);
-    ad_trg2 = 0;
-  }
+  // envelopes: trig sync starts on a clock rise, note sync on a new note
+  bool clock = clockIn.rose();
+  uint32_t now = micros();
+  envelopeOutput(env1, 0, sync1 ? old_CV_out1 != CV_out1 : clock, now, atk1, dcy1);
+  envelopeOutput(env2, 1, sync2 ? old_CV_out2 != CV_out2 : clock, now, atk2, dcy2);
 
   // DAC OUT
   if (old_CV_out1 != CV_out1)
@@ -703,29 +580,6 @@ void OLED_display()
   display.display();
 }
 
-//-----------------------------OUTPUT----------------------------------------
-void intDAC(int intDAC_OUT)
-{
-  analogWrite(DAC_INTERNAL_PIN, intDAC_OUT / 4); // "/4" -> 12bit to 10bit
-}
-
-void MCP(int MCP_OUT)
-{
-  Wire.beginTransmission(0x60);
-  Wire.write((MCP_OUT >> 8) & 0x0F);
-  Wire.write(MCP_OUT);
-  Wire.endTransmission();
-}
-
-void PWM1(int duty1)
-{
-  pwm(ENV_OUT_PIN_1, 46000, duty1);
-}
-void PWM2(int duty2)
-{
-  pwm(ENV_OUT_PIN_2, 46000, duty2);
-}
-
 //-----------------------------store data----------------------------------------
 void save()
 { // save setting data to flash memory
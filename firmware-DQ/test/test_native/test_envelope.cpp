@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+
+#include "envelope.cpp"
+
+// Run loop passes every 100 us until the envelope is done, returns the time it took. The
+// trace keeps only the write of the last pass.
+static uint32_t runOut(Envelope &envelope, uint8_t ch, uint32_t start, int attack, int decay)
+{
+  uint32_t now = start;
+  while (envelope.running)
+  {
+    now += 100;
+    halTrace.clear();
+    envelopeOutput(envelope, ch, false, now, attack, decay);
+  }
+  return now - start;
+}
+
+TEST(EnvelopeTest, ClockInputRisesOnce)
+{
+  halTrace = {};
+  ClockInput clockIn;
+  EXPECT_FALSE(clockIn.rose());
+  halTrace.level[CLK_IN_PIN] = 1;
+  EXPECT_TRUE(clockIn.rose());
+  EXPECT_FALSE(clockIn.rose()); // still high
+  halTrace.level[CLK_IN_PIN] = 0;
+  EXPECT_FALSE(clockIn.rose());
+  halTrace.level[CLK_IN_PIN] = 1;
+  EXPECT_TRUE(clockIn.rose());
+}
+
+TEST(EnvelopeTest, RestsAtTheBottomOfTheCurve)
+{
+  halTrace = {};
+  Envelope envelope;
+  envelopeOutput(envelope, 0, false, 0, 4, 4);
+  EXPECT_EQ(1021, halTrace.last(HAL_PWM, OUT_PIN_1)->value);
+  EXPECT_EQ(nullptr, halTrace.last(HAL_PWM, OUT_PIN_2));
+}
+
+TEST(EnvelopeTest, NoAttackStartsWithTheDecay)
+{
+  halTrace = {};
+  Envelope envelope;
+  envelopeOutput(envelope, 1, true, 1000, 1, 2);
+  EXPECT_EQ(envelopeCurve[0], halTrace.last(HAL_PWM, OUT_PIN_2)->value);
+
+  // 199 decay steps of 600 us, the last one ends at full duty
+  EXPECT_EQ(199u * 600, runOut(envelope, 1, 1000, 1, 2));
+  EXPECT_EQ(1023, halTrace.last(HAL_PWM, OUT_PIN_2)->value);
+  EXPECT_EQ(nullptr, halTrace.last(HAL_PWM, OUT_PIN_1));
+}
+
+TEST(EnvelopeTest, AttackThenDecayTiming)
+{
+  halTrace = {};
+  Envelope envelope;
+  envelopeOutput(envelope, 0, true, 0, 3, 3);
+  EXPECT_EQ(1021 - envelopeCurve[0], halTrace.last(HAL_PWM, OUT_PIN_1)->value);
+
+  // 400 us per attack step
+  envelopeOutput(envelope, 0, false, 300, 3, 3);
+  EXPECT_EQ(0, envelope.position);
+  envelopeOutput(envelope, 0, false, 400, 3, 3);
+  EXPECT_EQ(1, envelope.position);
+  EXPECT_EQ(1021 - envelopeCurve[1], halTrace.last(HAL_PWM, OUT_PIN_1)->value);
+
+  // 200 attack steps and 199 decay steps of 1200 us
+  EXPECT_EQ(199u * 400 + 199u * 1200, runOut(envelope, 0, 400, 3, 3));
+  EXPECT_EQ(2 * ENVELOPE_STEPS - 1, envelope.position);
+  EXPECT_EQ(1023, halTrace.last(HAL_PWM, OUT_PIN_1)->value);
+
+  // done, it stays at full duty
+  envelopeOutput(envelope, 0, false, 10000000, 3, 3);
+  EXPECT_EQ(2 * ENVELOPE_STEPS - 1, envelope.position);
+  EXPECT_EQ(1023, halTrace.last(HAL_PWM, OUT_PIN_1)->value);
+}
+
+TEST(EnvelopeTest, StepsAcrossTheTimerWrap)
+{
+  Envelope envelope;
+  envelope.trigger(0xFFFFFF00, 2);
+  envelope.update(0xFFFFFF00 + 100, 2, 2);
+  EXPECT_EQ(0, envelope.position);
+  envelope.update(0xFFFFFF00 + 200, 2, 2); // past zero
+  EXPECT_EQ(1, envelope.position);
+}
+
+TEST(EnvelopeTest, TriggerStartsOver)
+{
+  halTrace = {};
+  Envelope envelope;
+  envelopeOutput(envelope, 0, true, 0, 1, 2);
+  runOut(envelope, 0, 0, 1, 2);
+  envelopeOutput(envelope, 0, true, 200000, 2, 2);
+  EXPECT_TRUE(envelope.running);
+  EXPECT_EQ(0, envelope.position);
+  EXPECT_EQ(1021, halTrace.last(HAL_PWM, OUT_PIN_1)->value);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "hal.h"
+#include "voice.cpp"
+
+// Clock edges on the outputs
+// Voice 1 plays on CV1/GATE1 (internal DAC) and voice 2 on CV2/GATE2 (MCP4725). The edges
+// run in the clock interrupt and only put out the steps the loop prepared: CV1 and both
+// gates at once. The CV2 code is handed back for the loop to send, so an edge never
+// waits on the I2C bus shared with the display.
+
+#define GATE_OUT_PIN_1 OUT_PIN_1
+#define GATE_OUT_PIN_2 OUT_PIN_2
+
+// Falling edge: both gates close
+inline void edgeFall()
+{
+  Pin<GATE_OUT_PIN_1>::write(0);
+  Pin<GATE_OUT_PIN_2>::write(0);
+}
+
+// Rising edge: returns the CV2 code to queue
+inline int edgeRise(Voice (&voices)[2])
+{
+  voices[0].clock();
+  voices[1].clock();
+  intDAC(voices[0].outLevel);
+  Pin<GATE_OUT_PIN_1>::write(voices[0].outGate);
+  Pin<GATE_OUT_PIN_2>::write(voices[1].outGate);
+  return voices[1].outLevel;
+}
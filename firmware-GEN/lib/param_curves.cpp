@@ -0,0 +1,115 @@
+#pragma once
+#include <stdint.h>
+
+// Knob value to parameter curves of the generative voices
+// A knob value (1..1024) maps to a parameter through a breakpoint table , each entry
+// applies from its `from` value up to the next one. The tables are constexpr so they stay
+// in flash , and a lookup is a short integer scan done only when a knob changes.
+
+#define KNOB_MIN 1
+#define KNOB_MAX 1024
+
+struct StepBand
+{
+  int16_t from;
+  uint8_t value;
+};
+
+// Steps per stage
+constexpr StepBand LENGTH_CURVE[] = {{KNOB_MIN, 4}, {26, 6}, {314, 8}, {625, 12}, {874, 16}};
+// Times a stage plays before moving on
+constexpr StepBand REFRAIN_CURVE[] = {{KNOB_MIN, 1}, {26, 2}, {314, 3}, {625, 4}, {874, 8}};
+
+// Lottery changes per voice , two of them depend on the length
+#define CHANCE_SHORT 0xFE  // 3 on stages of 4 or 6 steps , 4 otherwise
+#define CHANCE_LENGTH 0xFF // one per step
+
+struct LoopBand
+{
+  int16_t from;
+  bool repeat; // stage B follows stage A
+  uint8_t chance;
+};
+
+// Frozen A , more changes towards the middle , then A and B with fewer changes , frozen A and B
+constexpr LoopBand LOOPING_CURVE[] = {
+    {KNOB_MIN, 0, 0},
+    {6, 0, 1},
+    {112, 0, 2},
+    {215, 0, CHANCE_SHORT},
+    {377, 0, CHANCE_LENGTH},
+    {556, 1, CHANCE_SHORT},
+    {701, 1, 2},
+    {862, 1, 1},
+    {971, 1, 0},
+};
+
+template <typename Band, int N>
+constexpr bool ascending(const Band (&curve)[N])
+{
+  if (curve[0].from != KNOB_MIN)
+  {
+    return false;
+  }
+  for (int n = 1; n < N; n++)
+  {
+    if (curve[n].from <= curve[n - 1].from || curve[n].from > KNOB_MAX)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(ascending(LENGTH_CURVE), "LENGTH_CURVE breakpoints out of order");
+static_assert(ascending(REFRAIN_CURVE), "REFRAIN_CURVE breakpoints out of order");
+static_assert(ascending(LOOPING_CURVE), "LOOPING_CURVE breakpoints out of order");
+
+// Band of the curve holding a knob value
+template <typename Band, int N>
+constexpr const Band &bandOf(const Band (&curve)[N], int knob)
+{
+  int n = N - 1;
+  while (n > 0 && knob < curve[n].from)
+  {
+    n--;
+  }
+  return curve[n];
+}
+
+constexpr uint8_t chanceOf(const LoopBand &band, uint8_t length)
+{
+  return band.chance == CHANCE_LENGTH  ? length
+         : band.chance == CHANCE_SHORT ? (length <= 6 ? 3 : 4)
+                                       : band.chance;
+}
+
+// Output range around the middle of the 10 bit DAC range
+constexpr int widthMaxOf(int knob) { return 612 + knob * 4 / 10; }
+constexpr int widthMinOf(int knob) { return 412 - knob * 4 / 10; }
+
+constexpr int knobClamp(int knob)
+{
+  return knob < KNOB_MIN ? KNOB_MIN : knob > KNOB_MAX ? KNOB_MAX : knob;
+}
+
+// Knob value after one encoder detent , about 1.5x up and 0.5x down like the
+// pow(2, log2(v) - 1) step it replaces , and at least one so the bottom end can be left
+constexpr int knobStep(int knob, int direction)
+{
+  return knobClamp(direction > 0 ? knob + (knob > 1 ? knob >> 1 : 1) : knob >> 1);
+}
+
+// CV modulation , a full scale 12 bit reading adds the whole knob range to the knob.
+// The gain is knob steps per ADC count in Q16 with the input calibration folded in , so a
+// reading maps with one multiply and a shift.
+#define CV_GAIN(calibration) uint32_t(65536 / (4 * (calibration)))
+
+constexpr int cvOffset(uint16_t adc, uint32_t gain)
+{
+  return (adc * gain) >> 16;
+}
+
+static_assert(knobStep(1, 1) == 2 && knobStep(4, 1) == 6 && knobStep(1000, 1) == KNOB_MAX, "knobStep up");
+static_assert(knobStep(9, -1) == 4 && knobStep(1, -1) == KNOB_MIN, "knobStep down");
+static_assert(cvOffset(4095, CV_GAIN(1.0)) == KNOB_MAX - 1 && cvOffset(0, CV_GAIN(0.98)) == 0, "cvOffset");
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+
+// Small deterministic PRNG (xorshift32) for the generative voices
+// A 16 bit seed and a stream number give the starting state, so each voice has its own
+// sequence and the same seed always plays the same way. Only shifts, xors and a 32 bit
+// multiply are used , no division.
+
+#define RNG_FALLBACK_STATE 0x6D2B79F5 // xorshift must never hold 0
+
+struct Rng
+{
+  uint32_t state = RNG_FALLBACK_STATE;
+
+  // murmur3 finalizer , spreads neighbouring seeds over the whole state
+  static uint32_t mix(uint32_t z)
+  {
+    z = (z ^ (z >> 16)) * 0x85EBCA6B;
+    z = (z ^ (z >> 13)) * 0xC2B2AE35;
+    return z ^ (z >> 16);
+  }
+
+  void seed(uint16_t value, uint8_t stream)
+  {
+    state = mix(value | uint32_t(stream) << 16);
+    if (state == 0)
+    {
+      state = RNG_FALLBACK_STATE;
+    }
+  }
+
+  uint32_t next()
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // 0 .. n - 1 for n up to 65536 , multiply-shift instead of a modulo
+  uint16_t below(uint32_t n)
+  {
+    return ((next() >> 16) * n) >> 16;
+  }
+
+  bool coin()
+  {
+    return next() >> 31;
+  }
+};
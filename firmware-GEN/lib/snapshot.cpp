@@ -0,0 +1,195 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "crc16.cpp"
+#include "voice.cpp"
+
+// Flash snapshot of the whole module
+// One record holds the settings, both voices' stages, positions and PRNG states, so a
+// patch plays on from where it was saved after a power cycle. Two flash rows take turns:
+// a save goes to the row not holding the newest record, so a save cut short by a power
+// loss leaves the previous one. At boot the valid record with the highest sequence wins.
+//
+// Saving is done by SnapshotWriter one flash operation at a time (a row erase or a page
+// write) from the loop, so the outputs keep being served between the steps.
+
+#define FLASH_ROW_SIZE 256
+#define FLASH_PAGE_SIZE 64
+#define SNAPSHOT_ROWS 2
+#define SNAPSHOT_AREA_SIZE (SNAPSHOT_ROWS * FLASH_ROW_SIZE)
+#define SNAPSHOT_MAGIC 0x6E5A
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PARAMS 4
+
+struct VoiceSnapshot
+{
+  uint16_t param[SNAPSHOT_PARAMS]; // knob values
+  uint8_t cvTarget;
+  uint8_t scale;
+  uint8_t mode;
+  uint8_t stage;
+  uint8_t step;
+  uint8_t refrainCount;
+  uint16_t shift;
+  uint16_t gateBits[2]; // bit n = gate of step n + 1
+  uint16_t cv[2][STAGE_STEPS];
+  uint32_t rngState;
+};
+
+struct Snapshot
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t sequence; // newer record , compared with wrap around
+  uint16_t seed;
+  uint16_t reserved;
+  VoiceSnapshot voice[2];
+  uint16_t crc;
+  uint16_t pad;
+};
+
+static_assert(sizeof(Snapshot) <= FLASH_ROW_SIZE, "a snapshot must fit one flash row");
+
+inline uint16_t snapshotCRC(const Snapshot &record)
+{
+  return crc16(&record, offsetof(Snapshot, crc));
+}
+
+inline bool snapshotValid(const Snapshot &record)
+{
+  return record.magic == SNAPSHOT_MAGIC && record.version == SNAPSHOT_VERSION && record.crc == snapshotCRC(record);
+}
+
+// Row of the area holding the newest valid record , -1 when there is none
+inline int newestSnapshot(const uint8_t *area)
+{
+  int newest = -1;
+  uint8_t sequence = 0;
+  for (int row = 0; row < SNAPSHOT_ROWS; row++)
+  {
+    const Snapshot *record = (const Snapshot *)(area + row * FLASH_ROW_SIZE);
+    if (snapshotValid(*record) && (newest < 0 || int8_t(record->sequence - sequence) > 0))
+    {
+      newest = row;
+      sequence = record->sequence;
+    }
+  }
+  return newest;
+}
+
+// Stage data , position and PRNG of a voice , the settings are filled by the caller
+inline void captureVoice(VoiceSnapshot &saved, const Voice &voice)
+{
+  for (int s = 0; s < 2; s++)
+  {
+    saved.gateBits[s] = 0;
+    for (int n = 0; n < STAGE_STEPS; n++)
+    {
+      saved.gateBits[s] |= uint16_t(voice.gate[s][n] ? 1 : 0) << n;
+      saved.cv[s][n] = voice.cv[s][n];
+    }
+  }
+  saved.stage = voice.stage;
+  saved.step = voice.step;
+  saved.refrainCount = voice.refrainCount;
+  saved.shift = voice.shift;
+  // A prepared step is not saved and gets prepared again after the restore , so the PRNG
+  // goes back to where it was before the step drew from it
+  saved.rngState = voice.prepared ? voice.preparedFrom : voice.rng.state;
+}
+
+// The voice plays on from the saved step , setScale() or requantize() must follow
+inline void restoreVoice(Voice &voice, const VoiceSnapshot &saved)
+{
+  for (int s = 0; s < 2; s++)
+  {
+    for (int n = 0; n < STAGE_STEPS; n++)
+    {
+      voice.gate[s][n] = saved.gateBits[s] >> n & 1;
+      voice.cv[s][n] = saved.cv[s][n] > CV_MAX ? CV_MAX : saved.cv[s][n];
+    }
+  }
+  voice.restart();
+  voice.stage = saved.stage == STAGE_B ? STAGE_B : STAGE_A;
+  voice.step = saved.step > STAGE_STEPS ? STAGE_STEPS : saved.step;
+  voice.refrainCount = saved.refrainCount;
+  voice.shift = saved.shift;
+  voice.rng.state = saved.rngState ? saved.rngState : RNG_FALLBACK_STATE;
+}
+
+struct SnapshotWriter
+{
+  const uint8_t *area = nullptr;                                               // FLASH_ROW_SIZE aligned , memory mapped
+  void (*eraseRow)(const uint8_t *row) = nullptr;                              // erase one row (all bits to 1)
+  void (*write)(const uint8_t *dst, const void *src, uint32_t size) = nullptr; // program erased flash
+  Snapshot pending;
+  uint8_t sequence = 0; // of the newest record in flash
+  int8_t row = -1;      // row being saved , -1 = idle
+  bool erased = 0;
+  uint16_t written = 0; // bytes of pending already programmed
+
+  // Attach to the flash area , returns the newest valid record or nullptr
+  const Snapshot *begin(const uint8_t *flashArea, void (*eraseFn)(const uint8_t *), void (*writeFn)(const uint8_t *, const void *, uint32_t))
+  {
+    area = flashArea;
+    eraseRow = eraseFn;
+    write = writeFn;
+    row = -1;
+    int newest = newestSnapshot(area);
+    if (newest < 0)
+    {
+      sequence = 0;
+      return nullptr;
+    }
+    const Snapshot *record = (const Snapshot *)(area + newest * FLASH_ROW_SIZE);
+    sequence = record->sequence;
+    return record;
+  }
+
+  bool busy() const
+  {
+    return row >= 0;
+  }
+
+  // Queue a record , a save already running starts over with it
+  void save(const Snapshot &record)
+  {
+    pending = record;
+    pending.magic = SNAPSHOT_MAGIC;
+    pending.version = SNAPSHOT_VERSION;
+    pending.sequence = sequence + 1;
+    pending.crc = snapshotCRC(pending);
+    int newest = newestSnapshot(area);
+    row = newest == 0 ? 1 : 0;
+    erased = 0;
+    written = 0;
+  }
+
+  // One flash operation , returns true when the record is complete
+  bool service()
+  {
+    if (row < 0)
+    {
+      return false;
+    }
+    const uint8_t *dst = area + row * FLASH_ROW_SIZE;
+    if (!erased)
+    {
+      eraseRow(dst);
+      erased = 1;
+      return false;
+    }
+    uint16_t size = sizeof(Snapshot) - written < FLASH_PAGE_SIZE ? sizeof(Snapshot) - written : FLASH_PAGE_SIZE;
+    write(dst + written, (const uint8_t *)&pending + written, size);
+    written += size;
+    if (written < sizeof(Snapshot))
+    {
+      return false;
+    }
+    sequence = pending.sequence;
+    row = -1;
+    return true;
+  }
+};
@@ -0,0 +1,55 @@
+#pragma once
+
+// Scales and quantizer shared with the Dual Quantizer (../shared)
+#include "scales.cpp"
+#include "quantizer.cpp"
+
+// Scale the stage CVs of a voice are quantized to
+// The thresholds are built by the Dual Quantizer code and a level goes through its
+// quantizeCV(). That is only done when a step or the scale changes , playback reads the
+// stored codes.
+
+#define SCALE_RAW numScales    // last setting , the stage CVs go out unquantized
+#define QUANT_BUFFER_SIZE 64   // 63 notes of the chromatic scale and the entry read after the last
+#define QUANT_NEUTRAL_SENS 4   // quantizeCV sensitivity of 1x
+#define QUANT_NEUTRAL_OCTAVE 2 // quantizeCV octave without offset
+
+struct StageScale
+{
+  int index = SCALE_RAW; // scaleNames index or SCALE_RAW
+  int thresholds[QUANT_BUFFER_SIZE];
+  int low = 0;  // 12 bit range quantizeCV finds a pair of notes in
+  int high = 0;
+
+  void select(int scaleIndex)
+  {
+    index = scaleIndex;
+    if (index == SCALE_RAW)
+    {
+      return;
+    }
+    bool note[12];
+    buildScale(index, 0, note);
+    buildQuantBuffer(note, thresholds);
+    int count = 0;
+    for (int j = 0; j <= 62; j++)
+    {
+      count += note[j % 12];
+    }
+    // below the first or above the last threshold quantizeCV finds no pair
+    low = thresholds[0] * 4;
+    high = thresholds[count - 1] * 4 - 1;
+  }
+
+  // 12 bit level to the 12 bit DAC code of the nearest note of the scale
+  int apply(int level) const
+  {
+    if (index == SCALE_RAW)
+    {
+      return level;
+    }
+    float out;
+    quantizeCV(level < low ? low : level > high ? high : level, thresholds, QUANT_NEUTRAL_SENS, QUANT_NEUTRAL_OCTAVE, &out);
+    return out;
+  }
+};
@@ -0,0 +1,149 @@
+#pragma once
+#include <stdint.h>
+
+#include "voice.cpp"
+#include "oled_pages.cpp"
+
+// Incremental drawing of the step view
+// A voice shows stage A and stage B in two lanes of 16 cells. A cell has a mark on top for
+// a gate and a bar for the step's DAC code , the step playing is drawn inverted and the
+// steps past the length are a dot. In Turing machine mode lane A shows the register bits
+// of the loop instead and lane B stays empty.
+// The view remembers what each cell shows , so a clock only checks the cells the playhead
+// left and reached (or the register bits that changed) , a lottery or a new length , width,
+// scale or mode the lanes of its voice , and only the cells that really changed are drawn
+// and marked in the dirty pages.
+
+#define VIEW_X 16
+#define VIEW_CELL_PITCH 7
+#define VIEW_CELL_WIDTH 6
+#define VIEW_LANE_HEIGHT 14
+#define VIEW_GATE_TOP 1 // gate mark , two pixel rows below the lane top
+#define VIEW_BAR_HEIGHT 10
+
+// Cell state , 0 = nothing shown
+#define CELL_BAR 0x0F // bar height in pixels
+#define CELL_GATE 0x10
+#define CELL_PLAYHEAD 0x20
+#define CELL_OUTSIDE 0x40 // past the length
+
+struct StepView
+{
+  uint8_t top;                      // y of lane A
+  uint8_t shown[2][STAGE_STEPS];    // what each cell shows in the display buffer
+  uint32_t stale;                   // cells to check on the next update , bit lane * 16 + n
+  uint8_t playStage = STAGE_A;
+  uint8_t playStep = 0;             // counted from 1 , 0 = none
+  uint8_t revision = 0;
+  uint16_t shift = 0;
+
+  StepView(uint8_t top) : top(top)
+  {
+    clear();
+  }
+
+  // The display buffer was cleared , no cell is shown and every cell needs a check
+  void clear()
+  {
+    for (int lane = 0; lane < 2; lane++)
+    {
+      for (int n = 0; n < STAGE_STEPS; n++)
+      {
+        shown[lane][n] = 0;
+      }
+    }
+    stale = 0xFFFFFFFF;
+  }
+
+  void invalidate(uint8_t lane, uint8_t n)
+  {
+    if (n < STAGE_STEPS)
+    {
+      stale |= 1UL << (lane * STAGE_STEPS + n);
+    }
+  }
+
+  // Take over the playhead , the register and the revision of the voice , the cells that
+  // depend on them turn stale
+  void follow(const Voice &voice)
+  {
+    uint8_t stage = voice.mode == MODE_TURING ? STAGE_A : voice.stage;
+    uint8_t step = voice.mode == MODE_TURING ? 0 : voice.step;
+    if (stage != playStage || step != playStep)
+    {
+      invalidate(playStage, playStep - 1);
+      invalidate(stage, step - 1);
+      playStage = stage;
+      playStep = step;
+    }
+    if (voice.mode == MODE_TURING && voice.shift != shift)
+    {
+      stale |= uint16_t(voice.shift ^ shift);
+    }
+    shift = voice.shift;
+    if (voice.revision != revision)
+    {
+      revision = voice.revision;
+      stale = 0xFFFFFFFF;
+    }
+  }
+
+  // Pop the lowest stale cell
+  bool nextStale(uint8_t &lane, uint8_t &n)
+  {
+    if (!stale)
+    {
+      return false;
+    }
+    int bit = __builtin_ctzl(stale);
+    stale &= stale - 1;
+    lane = bit / STAGE_STEPS;
+    n = bit % STAGE_STEPS;
+    return true;
+  }
+
+  // State of cell n of a lane
+  uint8_t state(const Voice &voice, uint8_t lane, uint8_t n) const
+  {
+    if (n >= voice.length)
+    {
+      return CELL_OUTSIDE;
+    }
+    if (voice.mode == MODE_TURING)
+    {
+      return lane == STAGE_A && (voice.shift >> n & 1) ? CELL_GATE : 0;
+    }
+    uint8_t cell = 1 + (voice.code[lane][n] * (VIEW_BAR_HEIGHT - 1) >> 12);
+    if (voice.gate[lane][n])
+    {
+      cell |= CELL_GATE;
+    }
+    if (lane == playStage && n + 1 == playStep)
+    {
+      cell |= CELL_PLAYHEAD;
+    }
+    return cell;
+  }
+
+  uint8_t cellX(uint8_t n) const
+  {
+    return VIEW_X + n * VIEW_CELL_PITCH;
+  }
+
+  uint8_t laneY(uint8_t lane) const
+  {
+    return top + lane * VIEW_LANE_HEIGHT;
+  }
+
+  // Returns true when the cell has to be drawn in the new state , its box is marked dirty
+  bool show(uint8_t lane, uint8_t n, uint8_t cell, DirtyPages &dirty)
+  {
+    if (shown[lane][n] == cell)
+    {
+      return false;
+    }
+    shown[lane][n] = cell;
+    dirty.mark(cellX(n), laneY(lane), VIEW_CELL_WIDTH, VIEW_LANE_HEIGHT);
+    return true;
+  }
+};
@@ -0,0 +1,392 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#include "param_curves.cpp"
+#include "rng.cpp"
+#include "stage_scale.cpp"
+
+// One generative voice
+// Two stages (A and B) of up to 16 steps with a gate and a CV per step. A stage plays
+// `length` steps `refrain` times. Then, when looping repeats, the voice plays stage B the
+// same way before it goes back to A, otherwise A starts over. Each time A starts over the
+// lottery changes some steps (done by the caller when lotteryDue is set). All randomness
+// comes from the voice's own Rng , so a seed replays the same voice.
+// The DAC code of every step is kept quantized to the voice's scale , worked out again
+// only for the steps that change , so the outputs never quantize on a clock edge.
+//
+// In Turing machine mode the voice is a 16 bit shift register instead. On each clock the
+// bit leaving the loop of `length` bits comes back in at bit 0 , flipped with the chance
+// set by the looping knob (never at the left end , always at the right end , which plays
+// the loop twice as long and inverted). The gate is bit 0 and the CV comes from the low
+// 8 bits through a lookup of quantized DAC codes filled as the values show up.
+//
+// The clock interrupt only calls clock(), which moves to the step prepare() computed in
+// loop() and puts its ready gate and level on outGate and outLevel. The lottery and the scaling of the next
+// step never run on the edge unless the clock comes faster than loop() can prepare.
+
+#define STAGE_STEPS 16
+#define STAGE_A 0
+#define STAGE_B 1
+#define CV_MAX 4095 // stage CVs are 12 bit
+#define MAX_LOTTERY_CHANGES (STAGE_STEPS + 1)
+
+#define MODE_STAGES 0
+#define MODE_TURING 1
+#define NUM_MODES 2
+#define TURING_VALUES 256 // CV from the low 8 bits of the register
+
+struct StagePosition
+{
+  uint8_t stage;
+  uint8_t step; // counted from 1 , 0 = not started
+  uint8_t refrainCount;
+  bool newCycle; // stage A was entered again , the lottery is due
+};
+
+// Parameters and step codes worked out by Voice::plan() with the clock running. apply()
+// puts them in place with a short copy , the only part that runs with the clock masked.
+struct VoiceUpdate
+{
+  uint8_t length;
+  uint8_t refrain;
+  bool repeat;
+  uint8_t chance;
+  uint32_t flipChance;
+  int widthMax;
+  int widthMin;
+  const StageScale *scale; // new scale , nullptr keeps the voice's
+  bool requantized;        // code holds the steps for the new width or scale
+  uint16_t code[2][STAGE_STEPS];
+};
+
+struct Voice
+{
+  uint8_t gate[2][STAGE_STEPS];
+  uint16_t cv[2][STAGE_STEPS];
+  uint16_t code[2][STAGE_STEPS]; // cv scaled into the width and quantized , 12 bit
+  StageScale scale;
+
+  // Parameters derived from the knob values by configure()
+  uint8_t length = 4;  // steps per stage
+  uint8_t refrain = 1; // times a stage plays before moving on
+  bool repeat = 0;     // 1 = stage B follows stage A
+  uint8_t chance = 1;  // lottery changes per voice , 0 = frozen
+  int widthMax = 1023; // output range , 10 bit
+  int widthMin = 0;
+  uint32_t flipChance = 0; // Turing machine bit flips in 1/65536 per clock
+
+  uint8_t mode = MODE_STAGES;
+  uint8_t revision = 0; // bumped when the steps , their codes , the length or the mode change
+
+  // Turing machine register and its quantized CVs , turingKnown has a bit per cached value
+  uint16_t shift = 0;
+  uint16_t nextShift = 0;
+  uint16_t turingCode[TURING_VALUES];
+  uint32_t turingKnown[TURING_VALUES / 32];
+
+  // Position of the step on the outputs
+  uint8_t stage = STAGE_A;
+  uint8_t step = 0; // step playing counted from 1 , 0 = not started
+  uint8_t refrainCount = 0;
+  volatile bool lotteryDue = 0;
+
+  // Outputs of the step on the outputs
+  bool outGate = 0;
+  int outLevel = 0;
+
+  // The following step , ready before its clock
+  StagePosition next;
+  bool nextGate = 0;
+  int nextLevel = 0;
+  volatile bool prepared = 0;
+  uint32_t preparedFrom = 0; // PRNG state before the prepared step drew from it
+
+  Rng rng;
+
+  // New stages from the seed , restart() goes back to the first step
+  void reseed(uint16_t seed, uint8_t stream)
+  {
+    rng.seed(seed, stream);
+    for (int n = 0; n < STAGE_STEPS; n++)
+    {
+      gate[STAGE_A][n] = rng.coin();
+      gate[STAGE_B][n] = rng.coin();
+      cv[STAGE_A][n] = rng.below(CV_MAX + 1);
+      cv[STAGE_B][n] = rng.below(CV_MAX + 1);
+    }
+    shift = rng.state >> 16; // without a draw , the stage lottery keeps its sequence
+    requantize();
+  }
+
+  void restart()
+  {
+    stage = STAGE_A;
+    step = 0;
+    refrainCount = 0;
+    lotteryDue = 0;
+    outGate = 0;
+    outLevel = 0;
+    prepared = 0;
+  }
+
+  // Flip the gate and draw a new CV of chance + 1 random steps in each stage , at most
+  // MAX_LOTTERY_CHANGES rounds of a few shifts and multiplies
+  void lottery()
+  {
+    lotteryDue = 0;
+    if (chance == 0)
+    {
+      return;
+    }
+    for (int k = 0; k <= chance; k++)
+    {
+      uint8_t stepA = rng.below(length);
+      gate[STAGE_A][stepA] = 1 - gate[STAGE_A][stepA];
+      cv[STAGE_A][stepA] = rng.below(CV_MAX + 1);
+      quantizeStep(STAGE_A, stepA);
+
+      uint8_t stepB = rng.below(length);
+      gate[STAGE_B][stepB] = 1 - gate[STAGE_B][stepB];
+      cv[STAGE_B][stepB] = rng.below(CV_MAX + 1);
+      quantizeStep(STAGE_B, stepB);
+    }
+    revision++;
+    prepared = 0; // the next step may have changed
+  }
+
+  // Stage state machine , one transition per clock:
+  //   not started        -> A step 1
+  //   step < length      -> next step of the same pass
+  //   end of a pass      -> same stage again until it played `refrain` passes
+  //   end of stage A     -> B when repeating , otherwise A (new cycle)
+  //   end of stage B     -> A (new cycle)
+  StagePosition following(uint8_t fromStage, uint8_t fromStep, uint8_t fromRefrain) const
+  {
+    StagePosition to = {fromStage, uint8_t(fromStep + 1), fromRefrain, false};
+    if (fromStep == 0)
+    {
+      to.stage = STAGE_A;
+      to.step = 1;
+      to.refrainCount = 0;
+    }
+    else if (fromStep >= length)
+    {
+      to.step = 1;
+      to.refrainCount = fromRefrain + 1;
+      if (to.refrainCount >= refrain)
+      {
+        to.refrainCount = 0;
+        to.stage = (fromStage == STAGE_A && repeat) ? STAGE_B : STAGE_A;
+        to.newCycle = to.stage == STAGE_A;
+      }
+    }
+    return to;
+  }
+
+  // Stage CV of a step (from 0) scaled into a width range and quantized , 12 bit for the DACs
+  uint16_t codeOf(uint8_t atStage, uint8_t n, int min, int max, const StageScale &with) const
+  {
+    long value = min + long(cv[atStage][n]) * (max - min) / CV_MAX;
+    return with.apply(value * 4);
+  }
+
+  void quantizeStep(uint8_t atStage, uint8_t n)
+  {
+    code[atStage][n] = codeOf(atStage, n, widthMin, widthMax, scale);
+  }
+
+  // All steps again , after new stages , a new width or a new scale
+  void requantize()
+  {
+    for (uint8_t n = 0; n < STAGE_STEPS; n++)
+    {
+      quantizeStep(STAGE_A, n);
+      quantizeStep(STAGE_B, n);
+    }
+    for (int n = 0; n < TURING_VALUES / 32; n++)
+    {
+      turingKnown[n] = 0;
+    }
+    revision++;
+    prepared = 0;
+  }
+
+  // Quantized DAC code of an 8 bit register value
+  int turingLevel(uint8_t bits)
+  {
+    uint32_t known = 1UL << (bits & 31);
+    if (!(turingKnown[bits >> 5] & known))
+    {
+      long value = widthMin + long(bits) * (widthMax - widthMin) / (TURING_VALUES - 1);
+      turingCode[bits] = scale.apply(value * 4);
+      turingKnown[bits >> 5] |= known;
+    }
+    return turingCode[bits];
+  }
+
+  // Register after one clock
+  uint16_t shiftedIn(uint16_t reg, bool flip) const
+  {
+    bool out = (reg >> (length - 1)) & 1;
+    return (reg << 1) | (out ^ flip);
+  }
+
+  // Make sure both values the next clock can give are in the lookup , so prepare() never
+  // quantizes while the clock interrupt is masked
+  void warm()
+  {
+    if (mode == MODE_TURING)
+    {
+      turingLevel(shiftedIn(shift, 0));
+      turingLevel(shiftedIn(shift, 1));
+    }
+  }
+
+  void setMode(uint8_t newMode)
+  {
+    mode = newMode;
+    revision++;
+    lotteryDue = 0;
+    prepared = 0;
+  }
+
+  // Steps of the update quantized again , 32 quantizeCV() calls
+  void planCodes(VoiceUpdate &update) const
+  {
+    const StageScale &with = update.scale ? *update.scale : scale;
+    for (uint8_t n = 0; n < STAGE_STEPS; n++)
+    {
+      update.code[STAGE_A][n] = codeOf(STAGE_A, n, update.widthMin, update.widthMax, with);
+      update.code[STAGE_B][n] = codeOf(STAGE_B, n, update.widthMin, update.widthMax, with);
+    }
+    update.requantized = 1;
+  }
+
+  // Same parameters on a new scale , the scale has to outlive apply()
+  void planScale(VoiceUpdate &update, const StageScale &newScale) const
+  {
+    update = {length, refrain, repeat, chance, flipChance, widthMax, widthMin, &newScale, 0, {}};
+    planCodes(update);
+  }
+
+  // Put a planned update in place. Copies only , so it runs with the clock masked.
+  void apply(const VoiceUpdate &update)
+  {
+    if (update.length != length)
+    {
+      length = update.length;
+      revision++;
+    }
+    refrain = update.refrain;
+    repeat = update.repeat;
+    chance = update.chance;
+    flipChance = update.flipChance;
+    widthMax = update.widthMax;
+    widthMin = update.widthMin;
+    if (update.scale)
+    {
+      scale = *update.scale;
+    }
+    if (update.requantized)
+    {
+      memcpy(code, update.code, sizeof(code));
+      for (int n = 0; n < TURING_VALUES / 32; n++)
+      {
+        turingKnown[n] = 0;
+      }
+      revision++;
+    }
+    // a shorter length must not leave the voice past the end of the stage
+    if (step > length)
+    {
+      step = length;
+    }
+    prepared = 0;
+  }
+
+  void setScale(int scaleIndex)
+  {
+    StageScale newScale;
+    newScale.select(scaleIndex);
+    VoiceUpdate update;
+    planScale(update, newScale);
+    apply(update);
+  }
+
+  // Output of a step counted from 1
+  int levelOf(uint8_t atStage, uint8_t atStep) const
+  {
+    return code[atStage][atStep - 1];
+  }
+
+  // Work out the next step and its outputs , called from loop() with the clock interrupt
+  // masked (and by clock() when loop() was too late)
+  void prepare()
+  {
+    preparedFrom = rng.state;
+    if (mode == MODE_TURING)
+    {
+      // the step only counts the loop for the display
+      next = {STAGE_A, uint8_t(step >= length ? 1 : step + 1), 0, false};
+      nextShift = shiftedIn(shift, (rng.next() >> 16) < flipChance);
+      nextGate = nextShift & 1;
+      nextLevel = turingLevel(nextShift);
+    }
+    else
+    {
+      next = following(stage, step, refrainCount);
+      nextShift = shift;
+      nextGate = gate[next.stage][next.step - 1];
+      nextLevel = levelOf(next.stage, next.step);
+    }
+    prepared = 1;
+  }
+
+  // Clock rising edge , the prepared step goes to the outputs
+  void clock()
+  {
+    if (!prepared)
+    {
+      prepare();
+    }
+    stage = next.stage;
+    step = next.step;
+    refrainCount = next.refrainCount;
+    shift = nextShift;
+    outGate = nextGate;
+    outLevel = nextLevel;
+    if (next.newCycle)
+    {
+      lotteryDue = 1;
+    }
+    prepared = 0;
+  }
+
+  // Derive the parameters from the knob values (1..1024) through the curve tables. A new
+  // width quantizes the steps again into the update , the voice itself is only read.
+  void plan(VoiceUpdate &update, int looping, int lengthValue, int widthValue, int refrainValue) const
+  {
+    const LoopBand &band = bandOf(LOOPING_CURVE, looping);
+    update.length = bandOf(LENGTH_CURVE, lengthValue).value;
+    update.refrain = bandOf(REFRAIN_CURVE, refrainValue).value;
+    update.repeat = band.repeat;
+    update.chance = chanceOf(band, update.length);
+    update.flipChance = (uint32_t(looping - KNOB_MIN) << 16) / (KNOB_MAX - KNOB_MIN);
+    update.widthMax = widthMaxOf(widthValue);
+    update.widthMin = widthMinOf(widthValue);
+    update.scale = nullptr;
+    update.requantized = 0;
+    if (update.widthMax != widthMax || update.widthMin != widthMin)
+    {
+      planCodes(update);
+    }
+  }
+
+  void configure(int looping, int lengthValue, int widthValue, int refrainValue)
+  {
+    VoiceUpdate update;
+    plan(update, looping, lengthValue, widthValue, refrainValue);
+    apply(update);
+  }
+};
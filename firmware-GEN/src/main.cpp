@@ -1,38 +1,38 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include <Encoder.h>
-// Use flash memory as eeprom
-#include <FlashAsEEPROM.h>
+#include <FlashStorage.h>
 #include <Adafruit_SSD1306.h>
 #include <Adafruit_GFX.h>
 
-#define OLED_ADDRESS 0x3C
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
+// Load local libraries, pins and outputs from ../shared/hal.h
+#include "hal.h"
+#include "voice.cpp"
+#include "clock_edge.cpp"
+#include "snapshot.cpp"
+#include "step_view.cpp"
 
 // rotary encoder setting
 #define ENCODER_OPTIMIZE_INTERRUPTS // counter measure of noise
 
-#define CLK_IN_PIN 7     // Clock input pin
-#define CV_1_IN_PIN 8    // channel 1 analog in
-#define CV_2_IN_PIN 9    // channel 2 analog in
-#define ENC_PIN_1 3      // rotary encoder left pin
-#define ENC_PIN_2 6      // rotary encoder right pin
-#define ENC_CLICK_PIN 10 // pin for encoder switch
-#define GATE_OUT_PIN_1 1
-#define GATE_OUT_PIN_2 2
-#define DAC_INTERNAL_PIN A0 // DAC output pin (internal)
-// Second DAC output goes to MCP4725 via I2C
-
 // Declare function prototypes
 void OLED_display();
-void intDAC(int);
-void MCP(int);
-void PWM1(int);
-void PWM2(int);
-void lottery();
-void load();
+void OLED_steps();
+void updateSteps();
+void applySeed();
+void captureSeed();
+void onClock();
+void prepareVoices();
+void serviceMCP();
+void flushDirtyPages();
+void serviceBetweenChunks();
+void configureVoice(int);
+void scaleVoice(int);
+void sampleCV();
+const Snapshot *load();
 void save();
+void flashErase(const uint8_t *);
+void flashWrite(const uint8_t *, const void *, uint32_t);
 
 ////////////////////////////////////////////
 // ADC calibration. Change these according to your resistor values to make readings more accurate
@@ -48,80 +48,86 @@ Encoder myEnc(ENC_PIN_1, ENC_PIN_2); // rotary encoder library setting
 float oldPosition = -999;            // rotary encoder library setting
 float newPosition = -999;            // rotary encoder library setting
 
-// Amount of menu items
-int menuItems = 5;
+// Knob values of each voice , 1..1024
+#define PARAM_LOOPING 0
+#define PARAM_LENGTH 1
+#define PARAM_WIDTH 2
+#define PARAM_REFRAIN 3
+#define NUM_PARAMS 4
+int paramValue[2][NUM_PARAMS] = {{1, 1, 1, 1}, {1, 1, 1, 1}};
+const char *paramNames[NUM_PARAMS] = {"LOOP", "LEN", "WIDTH", "RFRN"};
+
+// CV IN1 modulates one parameter of voice 1 and CV IN2 one of voice 2 , or nothing
+#define CV_OFF NUM_PARAMS
+int cvTarget[2] = {CV_OFF, CV_OFF};
+const char *cvTargetNames[NUM_PARAMS + 1] = {"LOOP", "LEN", "WIDTH", "RFRN", "OFF"};
+const int cvPins[2] = {CV_1_IN_PIN, CV_2_IN_PIN};
+uint32_t cvGain[2];        // Q16 knob steps per ADC count , from the calibration
+int cvKnob[2] = {0, 0};    // knob steps the CV adds at the last clock edge
+volatile bool edge_seen = 0; // the CVs are sampled once per rising edge
+
+// Scale each voice is quantized to , a scaleNames index or SCALE_RAW for the raw stage CVs
+int voiceScale[2] = {0, 0};
+
+// Mode of each voice , stage lottery or Turing machine
+int voiceMode[2] = {MODE_STAGES, MODE_STAGES};
+const char *modeNames[NUM_MODES] = {"STAGE", "TURING"};
+
+// Menu , two items (CH1 , CH2) per row : the modes on the top row , the parameters , the CV
+// targets and the scales , then SAVE , SEED and NEW on the bottom row and STEPS top left
+#define MENU_MODE 0
+#define MENU_PARAM 2
+#define MENU_CV (MENU_PARAM + 2 * NUM_PARAMS)
+#define MENU_SCALE (MENU_CV + 2)
+#define MENU_SAVE (MENU_SCALE + 2)
+#define MENU_SEED (MENU_SAVE + 1)
+#define MENU_NEW_SEED (MENU_SAVE + 2)
+#define MENU_VIEW (MENU_SAVE + 3)
+int menuItems = MENU_VIEW;
 // i is the current position of the encoder
-int menu_index = 1;
+int menu_index = 0;
+bool edit_param = 0; // 1 = encoder changes the selected parameter
 
 bool SW = 0;
 bool old_SW = 0;
-bool CLK_in = 0;
-bool old_CLK_in = 0;
-byte mode = 0; // 0=looping, 1=length, 2=width, 3=refrain
-
-float AD_CH1, old_AD_CH1, AD_CH2, old_AD_CH2;
-
-int CV_in1, CV_in2;
-float CV_out1, CV_out2, old_CV_out1, old_CV_out2;
-long gate_timer1, gate_timer2;
 
 // display
+#define MAX_BAR_LENGTH 38
+#define ROW_PITCH 8
+#define BOTTOM_ROW 56
 bool disp_refresh = 1; // 0=not refresh display , 1= refresh display , countermeasure of display refresh busy
+DirtyPages dirtyPages;  // display areas changed since the last flush
 
-byte stgAgate[2][16] = {
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
-
-byte stgBgate[2][16] = {
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
-
-int stgAcv[2][16] = {
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
-
-int stgBcv[2][16] = {
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
+// Step view , the lanes of voice 1 under the header and those of voice 2 below , only the
+// cells that change are drawn
+#define VIEW_TOP ROW_PITCH
+bool step_view = 0;
+StepView views[2] = {StepView(VIEW_TOP), StepView(VIEW_TOP + 2 * VIEW_LANE_HEIGHT)};
+uint32_t view_edge_us = 0; // edge time shown in the step view header
 
-byte i = 0;
-byte j = 0;
-byte k = 0;
+// Voice 1 plays on CV1/GATE1 (internal DAC) , voice 2 on CV2/GATE2 (MCP4725)
+Voice voices[2];
 
-byte gate_set = 1;
-byte gate_count = 0;
-byte old_gate_count = 0;
+// Both voices start from this seed at power up and when it is changed , each with its own stream
+uint16_t seed = 0x5EED;
 
-byte chance_set = 3;    // The reading value of the main knob. Pass a number to chance.
-byte chance = 1;        // Determined based on chance_set and length. Determines the number of variations in the lottery.
-byte lottery_stepA = 2; // Lottery for stgA.
-byte lottery_stepB = 2; // Lottery for stgB.
-byte lottery_done = 2;  // Limits the lottery to only once.
+// Cost of the clock interrupt , both voices are advanced on every edge
+volatile uint32_t edge_us = 0;
+volatile uint32_t edge_us_max = 0;
 
-const int LDAC = 9; // Latch operation output pin.
+// Settings , stages , positions and PRNG states are saved as one record in these rows,
+// one flash operation per loop so the outputs keep running while it is written
+__attribute__((__aligned__(FLASH_ROW_SIZE))) static const uint8_t snapshot_flash[SNAPSHOT_AREA_SIZE] = {};
+FlashClass flash;
+SnapshotWriter snapshots;
 
-int sub_knob = 0;       // サブツマミの読み取りAD値
-int old_sub_knob = 0;   // SW切り替え直後、切り替え前のAD値を反映させないため、古いADを記憶
-byte refrain_set = 1;   // リフレインの設定回数。AD値から導出。
-byte refrain_count = 0; // リフレインした回数をカウント。指定値に達すると0に戻る。
-byte length_set = 4;    // レングスの数値
-int width_max = 1023;
-int width_min = 0;
-
-int loopingValue = 0; // メインツマミの読み取りAD値
-int lengthValue = 0;
-int widthValue = 0;
-int refrainValue = 0;
-
-byte repeat_set = 0;   // リピートの設定回数。AD値から導出。
-byte repeat_count = 0; // リピートした回数をカウント。指定値に達すると0に戻る
-
-byte mode_set = 0; // 0=length,1=width,2=refrain
+// The MCP4725 value of voice 2 is queued by the clock interrupt and sent by the loop, so
+// the interrupt never touches the I2C bus shared with the display
+volatile int mcpPending = -1;
 
 void setup()
 {
-  analogWriteResolution(10);
-  analogReadResolution(12);
+  halBegin();
   pinMode(CLK_IN_PIN, INPUT);           // CLK in
   pinMode(CV_1_IN_PIN, INPUT);          // CV IN1
   pinMode(CV_2_IN_PIN, INPUT);          // CV IN2
@@ -129,29 +135,42 @@ void setup()
   pinMode(GATE_OUT_PIN_2, OUTPUT);      // CH2 Gate out
   pinMode(ENC_CLICK_PIN, INPUT_PULLUP); // push sw
   // OLED initialize
-  display.begin(SSD1306_SWITCHCAPVCC, 0x3C);
-  display.clearDisplay();
+  displayBegin(display);
 
-  // I2C connect
+  // I2C connect , fast mode keeps the MCP4725 write on the clock edge short
   Wire.begin();
+  Wire.setClock(400000);
 
-  // Load the EEPROM data
-  load();
+  // Settings of the last save , the voices are restored below
+  const Snapshot *saved = load();
 
-  // ADC settings. These increase ADC reading stability but at the cost of cycle time. Takes around 0.7ms for one reading with these
-  REG_ADC_AVGCTRL |= ADC_AVGCTRL_SAMPLENUM_1;
-  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_128 | ADC_AVGCTRL_ADJRES(4);
+  adcAveraging();
 
-  for (i = 0; i < 2; i = i + 1)
+  cvGain[0] = CV_GAIN(AD_CH1_calb);
+  cvGain[1] = CV_GAIN(AD_CH2_calb);
+  for (int ch = 0; ch < 2; ch++)
   {
-    for (j = 0; j < 16; j = j + 1)
+    configureVoice(ch);
+    voices[ch].setMode(voiceMode[ch]);
+  }
+  if (saved)
+  { // play on from the saved step
+    for (int ch = 0; ch < 2; ch++)
     {
-      stgAgate[i][j] = random(2);
-      stgBgate[i][j] = random(2);
-      stgAcv[i][j] = random(4096);
-      stgBcv[i][j] = random(4096);
+      restoreVoice(voices[ch], saved->voice[ch]);
     }
   }
+  else
+  {
+    applySeed();
+  }
+  for (int ch = 0; ch < 2; ch++)
+  {
+    scaleVoice(ch);
+  }
+
+  // Clock edges are taken by interrupt , the next steps are prepared by the loop
+  attachInterrupt(digitalPinToInterrupt(CLK_IN_PIN), onClock, CHANGE);
 }
 
 void loop()
@@ -159,498 +178,492 @@ void loop()
 
   //-------------Reading the state of external input-----------------
   old_SW = SW;
-  old_CLK_in = CLK_in;
-  old_CV_out1 = CV_out1;
-  old_CV_out2 = CV_out2;
-  old_AD_CH1 = AD_CH1;
-  old_AD_CH2 = AD_CH2;
 
-  gate_set = digitalRead(CLK_IN_PIN); // Read the state of gate_input
+  //-----------------voices , ready before the next clock edge-----------------
+  serviceMCP();
+  if (edge_seen)
+  {
+    edge_seen = 0;
+    sampleCV();
+  }
+  prepareVoices();
+  if (snapshots.busy() && voices[0].prepared && voices[1].prepared && snapshots.service())
+  {
+    disp_refresh = 1; // saved
+  }
 
   newPosition = myEnc.read();
+  int step = 0;
   // If the encoder is decremented
   if ((newPosition - 3) / 4 > oldPosition / 4)
   { // 4 is resolution of encoder
     oldPosition = newPosition;
-    disp_refresh = 1;
-    switch (mode)
-    {
-    case 0: // Option select
-      menu_index = menu_index - 1;
-      if (menu_index < 0)
-      {
-        menu_index = menuItems;
-      }
-      break;
-    case 1: // Looping
-      loopingValue = loopingValue - pow(2, log2(loopingValue) - 1);
-      break;
-    case 2: // Length
-      lengthValue = lengthValue - pow(2, log2(lengthValue) - 1);
-      break;
-    case 3: // Width
-      widthValue = widthValue - pow(2, log2(widthValue) - 1);
-      break;
-    case 4: // Refrain
-      refrainValue = refrainValue - pow(2, log2(refrainValue) - 1);
-      break;
-    }
+    step = -1;
   }
   // If the encoder is incremented
   else if ((newPosition + 3) / 4 < oldPosition / 4)
   { // 4 is resolution of encoder
     oldPosition = newPosition;
+    step = 1;
+  }
+  if (step != 0 && !step_view)
+  {
     disp_refresh = 1;
-    switch (mode)
-    {
-    case 0:
-      menu_index = menu_index + 1;
+    if (edit_param == 1 && menu_index == MENU_SEED)
+    { // new seed is applied when leaving the edit
+      seed = seed + step;
+    }
+    else if (edit_param == 1 && menu_index < MENU_PARAM)
+    { // mode , the voice carries on from its current step
+      int ch = menu_index - MENU_MODE;
+      voiceMode[ch] = (voiceMode[ch] + step + NUM_MODES) % NUM_MODES;
+      noInterrupts();
+      voices[ch].setMode(voiceMode[ch]);
+      interrupts();
+    }
+    else if (edit_param == 1 && menu_index >= MENU_SCALE && menu_index < MENU_SAVE)
+    { // scale , the stage codes are quantized again
+      int ch = menu_index - MENU_SCALE;
+      voiceScale[ch] = (voiceScale[ch] + step + SCALE_RAW + 1) % (SCALE_RAW + 1);
+      scaleVoice(ch);
+    }
+    else if (edit_param == 1 && menu_index >= MENU_CV && menu_index < MENU_SCALE)
+    { // CV target , OFF then the parameters
+      int ch = menu_index - MENU_CV;
+      cvTarget[ch] = (cvTarget[ch] + step + CV_OFF + 1) % (CV_OFF + 1);
+      cvKnob[ch] = 0; // until the next clock edge
+      configureVoice(ch);
+    }
+    else if (edit_param == 0)
+    { // Option select
+      menu_index = menu_index + step;
+      if (menu_index < 0)
+      {
+        menu_index = menuItems;
+      }
       if (menuItems < menu_index)
       {
         menu_index = 0;
       }
-      break;
-    case 1: // Looping
-      loopingValue = loopingValue + pow(2, log2(loopingValue) - 1);
-      break;
-    case 2: // Length
-      lengthValue = lengthValue + pow(2, log2(lengthValue) - 1);
-      break;
-    case 3: // Width
-      widthValue = widthValue + pow(2, log2(widthValue) - 1);
-      break;
-    case 4: // Refrain
-      refrainValue = refrainValue + pow(2, log2(refrainValue) - 1);
-      break;
+    }
+    else
+    { // change the selected parameter of the selected voice
+      int ch = menu_index % 2;
+      int &value = paramValue[ch][(menu_index - MENU_PARAM) / 2];
+      value = knobStep(value, step);
+      configureVoice(ch);
     }
   }
-  menu_index = constrain(menu_index, 0, menuItems);
-  loopingValue = constrain(loopingValue, 1, 1024);
-  lengthValue = constrain(lengthValue, 1, 1024);
-  widthValue = constrain(widthValue, 1, 1024);
-  refrainValue = constrain(refrainValue, 1, 1024);
 
   //-----------------PUSH SW------------------------------------
   SW = digitalRead(ENC_CLICK_PIN);
   if (SW == 1 && old_SW != 1)
   {
     disp_refresh = 1;
-    if (menu_index == 1 && mode == 0)
-    {
-      mode = 1; // Switch to looping selection mode
-    }
-    else if (menu_index == 2 && mode == 0)
-    {
-      mode = 2; // Switch to length selection mode
-    }
-    else if (menu_index == 3 && mode == 0)
-    {
-      mode = 3; // Switch to width selection mode
-    }
-    else if (menu_index == 4 && mode == 0)
-    {
-      mode = 4; // Switch to refrain selection mode
-    }
-    // Revert from modes to menu selection
-    else if (menu_index == 1 && mode != 1)
-    {
-      mode = 0; // Switch to option select mode
+    if (step_view)
+    { // back to the settings
+      step_view = 0;
     }
-    else if (menu_index == 2 && mode == 2)
+    else if (menu_index == MENU_VIEW)
     {
-      mode = 0; // Switch to option select mode
+      step_view = 1;
+      OLED_steps();
     }
-    else if (menu_index == 3 && mode == 3)
+    else if (menu_index == MENU_SAVE)
     {
-      mode = 0; // Switch to option select mode
+      save(); // written by the loop from here on
     }
-    else if (menu_index == 4 && mode == 4)
+    else if (menu_index == MENU_NEW_SEED)
     {
-      mode = 0; // Switch to option select mode
+      captureSeed();
+      applySeed();
     }
-    else if (menu_index == 5 && mode == 0)
+    else
     {
-      save(); // Save the current settings to EEPROM
+      edit_param = !edit_param; // select <-> edit
+      if (edit_param == 0 && menu_index == MENU_SEED)
+      {
+        applySeed();
+      }
     }
   }
-  //-------------------------------Analog read and qnt setting--------------------------
-  // Still not used but could control internal parameters
-  AD_CH1 = analogRead(CV_1_IN_PIN) / AD_CH1_calb;
-  AD_CH2 = analogRead(CV_2_IN_PIN) / AD_CH2_calb;
-
-  //-------------refrainの設定----------------------
-
-  if (mode_set == 2)
+  // display out
+  if (step_view)
   {
-    if (refrainValue < 25)
-    {
-      refrain_set = 1; // do not repeat
-    }
-    else if (refrainValue < 313 && refrainValue >= 26)
-    {
-      refrain_set = 2; // Repeat 1 time
-    }
-
-    else if (refrainValue < 624 && refrainValue >= 314)
-    {
-      refrain_set = 3; // Repeat 2 times
-    }
-
-    else if (refrainValue < 873 && refrainValue >= 625)
-    {
-      refrain_set = 4; // Repeat 3 times
-    }
-
-    else if (refrainValue >= 874)
-    {
-      refrain_set = 8; // Repeat 7 times
-    }
+    updateSteps(); // only what changed since the last pass
+    disp_refresh = 0;
   }
-
-  //----------------length設定---------------------
-
-  if (mode_set == 0)
+  else if (disp_refresh == 1)
   {
-    if (lengthValue < 25)
-    {
-      length_set = 4;
-    }
-    else if (lengthValue < 313 && lengthValue >= 26)
-    {
-      length_set = 6;
-    }
-
-    else if (lengthValue < 624 && lengthValue >= 314)
-    {
-      length_set = 8;
-    }
-
-    else if (lengthValue < 873 && lengthValue >= 625)
-    {
-      length_set = 12;
-    }
-
-    else if (lengthValue >= 874)
-    {
-      length_set = 16;
-    }
+    OLED_display(); // refresh display
+    disp_refresh = 0;
   }
+}
 
-  //-------------width setting----------------------
+void OLED_display()
+{
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setTextColor(WHITE);
+
+  // Step view
+  display.setCursor(8, 0);
+  display.print("STEPS");
 
-  if (mode_set == 1)
+  // Mode of CH1 and CH2
+  for (int ch = 0; ch < 2; ch++)
   {
-    width_max = 612 + widthValue * 4 / 10;
-    width_min = 412 - widthValue * 4 / 10;
+    display.setCursor(46 + ch * 42, 0);
+    display.print(modeNames[voiceMode[ch]]);
   }
 
-  //-------------repeat setting----------------------
-  if (loopingValue < 5)
+  // One row per parameter , a bar for each voice with a mark where the CV takes it
+  for (int row = 0; row < NUM_PARAMS; row++)
   {
-    repeat_set = 0; // do not repeat
-    chance = 0;
+    int y = ROW_PITCH + row * ROW_PITCH;
+    display.setCursor(8, y);
+    display.print(paramNames[row]);
+    for (int ch = 0; ch < 2; ch++)
+    {
+      int x = 46 + ch * 42;
+      int mappedValue = paramValue[ch][row] * MAX_BAR_LENGTH / KNOB_MAX;
+      display.fillRect(x, y, mappedValue, 6, WHITE);
+      display.drawRect(x, y, MAX_BAR_LENGTH, 6, WHITE);
+      if (cvTarget[ch] == row)
+      {
+        int mark = knobClamp(paramValue[ch][row] + cvKnob[ch]) * MAX_BAR_LENGTH / KNOB_MAX;
+        display.drawFastVLine(x + constrain(mark, 1, MAX_BAR_LENGTH - 2), y - 1, 8, INVERSE);
+      }
+    }
   }
-  else if (loopingValue < 111 && loopingValue >= 6)
+  // CV input targets
+  int y = ROW_PITCH + NUM_PARAMS * ROW_PITCH;
+  display.setCursor(8, y);
+  display.print("CV");
+  for (int ch = 0; ch < 2; ch++)
   {
-    repeat_set = 0; // do not repeat
-    chance = 1;
+    display.setCursor(46 + ch * 42, y);
+    display.print(cvTargetNames[cvTarget[ch]]);
   }
-  else if (loopingValue < 214 && loopingValue >= 112)
+  // Scales
+  y += ROW_PITCH;
+  display.setCursor(8, y);
+  display.print("SCALE");
+  for (int ch = 0; ch < 2; ch++)
   {
-    repeat_set = 0; // do not repeat
-    chance = 2;
+    display.setCursor(46 + ch * 42, y);
+    display.print(voiceScale[ch] == SCALE_RAW ? "RAW" : scaleNames[voiceScale[ch]]);
   }
-  else if (loopingValue < 376 && loopingValue >= 215)
+  // Save settings , seed in hex and a new seed from noise
+  display.setCursor(8, BOTTOM_ROW);
+  display.print(snapshots.busy() ? "SAVING" : "SAVE");
+  display.setCursor(46, BOTTOM_ROW);
+  for (int shift = 12; shift >= 0; shift -= 4)
   {
-    repeat_set = 0; // do not repeat
-    if (length_set == 4 || length_set == 6)
-    {
-      chance = 3;
-    }
-    else
-    {
-      chance = 4;
-    }
+    display.print((seed >> shift) & 0xF, HEX);
   }
+  display.setCursor(88, BOTTOM_ROW);
+  display.print("NEW");
 
-  else if (loopingValue < 555 && loopingValue >= 377)
+  // Draw the current selection triangle , filled while editing
+  int x;
+  if (menu_index == MENU_VIEW)
   {
-    repeat_set = 0; // do not repeat
-    chance = length_set;
+    x = 0;
+    y = 0;
   }
-  else if (loopingValue < 700 && loopingValue >= 556)
+  else if (menu_index >= MENU_SAVE)
   {
-    repeat_set = 1; // repeat
-    if (length_set == 4 || length_set == 6)
-    {
-      chance = 3;
-    }
-    else
-    {
-      chance = 4;
-    }
+    x = menu_index == MENU_SAVE ? 0 : 39 + (menu_index - MENU_SEED) * 42;
+    y = BOTTOM_ROW;
   }
-  else if (loopingValue < 861 && loopingValue >= 701)
+  else
   {
-    repeat_set = 1; // repeat
-    chance = 2;
+    x = 39 + (menu_index % 2) * 42;
+    y = (menu_index / 2) * ROW_PITCH;
   }
-  else if (loopingValue < 970 && loopingValue >= 862)
+  if (edit_param)
   {
-    repeat_set = 1; // repeat
-    chance = 1;
+    display.fillTriangle(x, y, x + 5, y + 3, x, y + 6, WHITE);
   }
-  else if (loopingValue < 1024 && loopingValue >= 971)
+  else
   {
-    repeat_set = 1; // repeat
-    chance = 0;
+    display.drawTriangle(x, y, x + 5, y + 3, x, y + 6, WHITE);
   }
-  //-----------------Start of lottery process-----------------
 
-  if (refrain_count == 0 && gate_count == 1 && lottery_done == 0 && repeat_count == 0)
+  dirtyPages.markAll();
+  flushDirtyPages();
+}
+
+// The step view from a cleared display , the lanes are drawn by updateSteps()
+void OLED_steps()
+{
+  display.clearDisplay();
+  display.setTextSize(1);
+  display.setTextColor(WHITE);
+  for (int ch = 0; ch < 2; ch++)
   {
-    lottery(); // Start lottery process
-    lottery_done = 1;
+    for (int lane = 0; lane < 2; lane++)
+    {
+      display.setCursor(0, views[ch].laneY(lane) + 4);
+      display.print(ch + 1);
+      display.print(lane == STAGE_A ? "A" : "B");
+    }
+    views[ch].clear();
   }
+  view_edge_us = 0xFFFFFFFF; // header drawn with the lanes
+  dirtyPages.markAll();
+  updateSteps();
+}
 
-  //-----------------stg sequence output-----------------
-
-  switch (repeat_count)
+// Redraw the step view cells that changed , then send the pages they touch
+void updateSteps()
+{
+  if (view_edge_us != edge_us_max)
+  { // slowest clock edge so far
+    view_edge_us = edge_us_max;
+    display.fillRect(0, 0, SCREEN_WIDTH, ROW_PITCH, BLACK);
+    display.setCursor(0, 0);
+    display.print("STEPS");
+    display.setCursor(88, 0);
+    display.print(view_edge_us);
+    display.print("us");
+    dirtyPages.mark(0, 0, SCREEN_WIDTH, ROW_PITCH);
+  }
+  for (int ch = 0; ch < 2; ch++)
   {
-
-  case 0:
-    switch (gate_set)
+    StepView &view = views[ch];
+    view.follow(voices[ch]);
+    uint8_t lane, n;
+    while (view.nextStale(lane, n))
     {
-
-    case 0:                              // When gate_input is LOW
-      digitalWrite(GATE_OUT_PIN_1, LOW); // Set gate_output to LOW
-      old_gate_count = gate_count;
-      break;
-
-    case 1: // When gate_input is HIGH
-      if (old_gate_count == gate_count)
+      uint8_t cell = view.state(voices[ch], lane, n);
+      if (!view.show(lane, n, cell, dirtyPages))
       {
-        gate_count++;
-
-        if (gate_count > length_set)
-        {
-          gate_count = 1;
-          refrain_count++;
-
-          if (refrain_count >= refrain_set)
-          { // Transition from stgA to stgB
-            repeat_count++;
-            refrain_count = 0;
-            lottery_done = 0;
-          }
-        }
-        // WriteRegister(map(stgAcv[0][gate_count - 1], 0, 1023, width_min, width_max));
-        intDAC(map(stgAcv[0][gate_count - 1], 0, 4095, width_min, width_max));
-
-        digitalWrite(GATE_OUT_PIN_1, stgAgate[0][gate_count - 1]); // Output CV before gate
-        // analogWrite(6, stgAcv[0][gate_count] / 4); // Replace this LED output with something on screen
-        break;
+        continue;
       }
-      break;
-    }
-
-  case 1:
-    if (repeat_set == 0)
-    {
-      repeat_count = 0;
-    }
-    else
-    {
-      switch (gate_set)
+      int x = view.cellX(n);
+      int y = view.laneY(lane);
+      display.fillRect(x, y, VIEW_CELL_WIDTH, VIEW_LANE_HEIGHT, BLACK);
+      if (cell & CELL_OUTSIDE)
       {
-
-      case 0:                              // When gate_input is LOW
-        digitalWrite(GATE_OUT_PIN_1, LOW); // Set gate_output to LOW
-        old_gate_count = gate_count;
-        break;
-
-      case 1: // When gate_input is HIGH
-        if (old_gate_count == gate_count)
-        {
-          gate_count++;
-
-          if (gate_count > length_set)
-          {
-            gate_count = 1;
-            refrain_count++;
-
-            if (refrain_count >= refrain_set)
-            { // Transition from stgB to stgA
-              repeat_count++;
-              refrain_count = 0;
-              if (repeat_count >= 2)
-              {
-                repeat_count = 0;
-                lottery_done = 0;
-              }
-            }
-          }
-          // WriteRegister(map(stgBcv[0][gate_count - 1], 0, 1023, width_min, width_max));
-
-          intDAC(map(stgBcv[0][gate_count - 1], 0, 1023, width_min, width_max));
-
-          digitalWrite(GATE_OUT_PIN_1, stgBgate[0][gate_count - 1]); // Output CV before gate
-          // analogWrite(6, stgBcv[0][gate_count] / 4); // Replace this LED output with something on screen
-          break;
-        }
-        break;
+        display.drawPixel(x + VIEW_CELL_WIDTH / 2, y + VIEW_LANE_HEIGHT - 1, WHITE);
+        continue;
+      }
+      if (cell & CELL_GATE)
+      {
+        display.fillRect(x, y + VIEW_GATE_TOP, VIEW_CELL_WIDTH, 2, WHITE);
+      }
+      int height = cell & CELL_BAR;
+      display.fillRect(x + 1, y + VIEW_LANE_HEIGHT - height, VIEW_CELL_WIDTH - 2, height, WHITE);
+      if (cell & CELL_PLAYHEAD)
+      {
+        display.fillRect(x, y, VIEW_CELL_WIDTH, VIEW_LANE_HEIGHT, INVERSE);
       }
     }
   }
-
-  // display out
-  if (disp_refresh == 1)
+  if (dirtyPages.mask)
   {
-    OLED_display(); // refresh display
-    disp_refresh = 0;
+    flushDirtyPages();
   }
 }
 
-void OLED_display()
+// Send the changed column spans of each page in short I2C chunks , so a queued MCP4725
+// value never waits for a whole frame (about 25 ms at 400 kHz)
+void flushDirtyPages()
 {
-  int maxBarLength = 70;
-  display.clearDisplay();
-  display.setTextSize(1);
-  display.setTextColor(WHITE);
+  flushDirtyPages(display, Wire, OLED_ADDRESS, dirtyPages, OLED_BUS_CLOCK, serviceBetweenChunks);
+}
 
-  // Draw menu options
-  // Looping selection (mode 1)
-  display.setCursor(10, 0);
-  display.print("LOOP:");
-  // Draw a rectangle to show the current value of the main knob (loopingValue)
-  int mappedValue = map(loopingValue, 0, 1024, 0, maxBarLength);
-  display.fillRect(50, 0, mappedValue, 6, WHITE);
-  // Draw the difference to the maximum value as an empty rectangle
-  display.drawRect(50 + mappedValue, 0, mappedValue, 6, WHITE);
-  // Length selection (mode 2)
-  display.setCursor(10, 10);
-  display.print("LENGTH:");
-  mappedValue = map(lengthValue, 0, 1024, 0, maxBarLength);
-  display.fillRect(50, 10, mappedValue, 6, WHITE);
-  display.drawRect(50 + mappedValue, 10, mappedValue, 6, WHITE);
-  // Width selection (mode 3)
-  display.setCursor(10, 20);
-  display.print("WIDTH:");
-  mappedValue = map(widthValue, 0, 1024, 0, maxBarLength);
-  display.fillRect(50, 20, mappedValue, 6, WHITE);
-  display.drawRect(50 + mappedValue, 20, mappedValue, 6, WHITE);
-  // Refrain selection (mode 4)
-  display.setCursor(10, 30);
-  display.print("REFRAIN:");
-  mappedValue = map(refrainValue, 0, 1024, 0, maxBarLength);
-  display.fillRect(50, 30, mappedValue, 6, WHITE);
-  display.drawRect(50 + mappedValue, 30, mappedValue, 6, WHITE);
-  // Save settings
-  display.setCursor(10, 40);
-  display.print("SAVE");
-
-  // Draw the current selection triangles
-  if (mode == 0)
-  { // On menu selection
-    if (menu_index == 0)
-    {
-      display.drawTriangle(0, 0, 5, 3, 0, 6, WHITE);
-    }
-    else if (menu_index == 1)
-    {
-      display.drawTriangle(0, 10, 5, 13, 0, 16, WHITE);
-    }
-    else if (menu_index == 2)
-    {
-      display.drawTriangle(0, 20, 5, 23, 0, 26, WHITE);
-    }
-    else if (menu_index == 3)
-    {
-      display.drawTriangle(0, 30, 5, 33, 0, 36, WHITE);
-    }
-    else if (menu_index == 4)
-    {
-      display.drawTriangle(0, 40, 5, 43, 0, 46, WHITE);
-    }
+// Runs between the display chunks , CV2 goes out and the next steps get ready
+void serviceBetweenChunks()
+{
+  serviceMCP();
+  prepareVoices();
+}
 
-    display.drawTriangle(0, 0, 5, 3, 0, 6, WHITE);
-  }
-  else if (mode == 1)
+// Clock interrupt , both edges. On a rise the steps prepared by the loop go out at once:
+// CV1 and both gates here , CV2 queued for the loop. Nothing is computed on the edge.
+void onClock()
+{
+  if (!Pin<CLK_IN_PIN>::read())
   {
-    display.fillTriangle(0, 10, 5, 13, 0, 16, WHITE);
+    edgeFall();
+    return;
   }
-  else if (mode == 2)
+  uint32_t start = micros();
+  edge_seen = 1;
+  mcpPending = edgeRise(voices);
+  edge_us = micros() - start;
+  if (edge_us > edge_us_max)
   {
-    display.fillTriangle(0, 20, 5, 23, 0, 26, WHITE);
+    edge_us_max = edge_us;
   }
-  else if (mode == 3)
+}
+
+// Knob values of a voice with its CV added , through the curve tables
+void configureVoice(int ch)
+{
+  int value[NUM_PARAMS];
+  for (int n = 0; n < NUM_PARAMS; n++)
   {
-    display.fillTriangle(0, 30, 5, 33, 0, 36, WHITE);
+    value[n] = paramValue[ch][n];
   }
-  else if (mode == 4)
+  if (cvTarget[ch] != CV_OFF)
   {
-    display.fillTriangle(0, 40, 5, 43, 0, 46, WHITE);
+    value[cvTarget[ch]] = knobClamp(value[cvTarget[ch]] + cvKnob[ch]);
   }
-
-  display.display();
+  // a new width quantizes the steps again , done before the clock is masked
+  VoiceUpdate update;
+  voices[ch].plan(update, value[PARAM_LOOPING], value[PARAM_LENGTH], value[PARAM_WIDTH], value[PARAM_REFRAIN]);
+  noInterrupts();
+  voices[ch].apply(update);
+  interrupts();
 }
 
-void lottery()
+// Quantize a voice to its scale setting , the same way: worked out first , then a short
+// masked copy
+void scaleVoice(int ch)
 {
+  static StageScale scale; // thresholds of the new scale , kept until apply() copied them
+  scale.select(voiceScale[ch]);
+  VoiceUpdate update;
+  voices[ch].planScale(update, scale);
+  noInterrupts();
+  voices[ch].apply(update);
+  interrupts();
+}
 
-  if (chance != 0)
+// Read the assigned CV inputs once per clock edge , the steps after it use the new values
+void sampleCV()
+{
+  for (int ch = 0; ch < 2; ch++)
   {
-    for (k = 0; k <= chance; k = k + 1)
+    if (cvTarget[ch] == CV_OFF)
     {
-      lottery_stepA = random(length_set);
-      stgAgate[0][lottery_stepA] = 1 - stgAgate[0][lottery_stepA];
-      stgAcv[0][lottery_stepA] = random(4096);
-
-      lottery_stepB = random(length_set);
-      stgBgate[0][lottery_stepB] = 1 - stgBgate[0][lottery_stepB];
-      stgBcv[0][lottery_stepB] = random(4096);
+      continue;
+    }
+    int knob = cvOffset(analogRead(cvPins[ch]), cvGain[ch]);
+    if (knob != cvKnob[ch])
+    {
+      if (knob * MAX_BAR_LENGTH / KNOB_MAX != cvKnob[ch] * MAX_BAR_LENGTH / KNOB_MAX)
+      {
+        disp_refresh = 1; // the CV mark moved
+      }
+      cvKnob[ch] = knob;
+      configureVoice(ch);
     }
   }
 }
 
-void intDAC(int intDAC_OUT)
+// Run a due lottery , then work out the step each voice plays on the next rise
+void prepareVoices()
 {
-  analogWrite(DAC_INTERNAL_PIN, intDAC_OUT / 4); // "/4" -> 12bit to 10bit
+  for (int ch = 0; ch < 2; ch++)
+  {
+    if (voices[ch].lotteryDue)
+    {
+      voices[ch].lottery(); // at most chance + 1 changes , off the edge
+    }
+    if (!voices[ch].prepared)
+    {
+      voices[ch].warm();
+      noInterrupts();
+      voices[ch].prepare();
+      interrupts();
+    }
+  }
 }
 
-void MCP(int MCP_OUT)
+// Send the queued MCP4725 value of voice 2
+void serviceMCP()
 {
-  Wire.beginTransmission(0x60);
-  Wire.write((MCP_OUT >> 8) & 0x0F);
-  Wire.write(MCP_OUT);
-  Wire.endTransmission();
+  if (mcpPending < 0)
+  {
+    return;
+  }
+  noInterrupts();
+  int value = mcpPending;
+  mcpPending = -1;
+  interrupts();
+  MCP(value);
 }
 
-void PWM1(int duty1)
+// Both voices start over from the seed
+void applySeed()
 {
-  pwm(GATE_OUT_PIN_1, 46000, duty1);
+  for (int ch = 0; ch < 2; ch++)
+  {
+    voices[ch].reseed(seed, ch); // the clock keeps playing while the stages are drawn
+    noInterrupts();
+    voices[ch].restart();
+    interrupts();
+  }
 }
-void PWM2(int duty2)
+
+// New seed from the noise of the CV inputs and the time of the push
+void captureSeed()
 {
-  pwm(GATE_OUT_PIN_2, 46000, duty2);
+  uint32_t noise = micros();
+  for (int n = 0; n < 16; n++)
+  {
+    noise = (noise << 3 | noise >> 29) ^ analogRead(CV_1_IN_PIN) ^ analogRead(CV_2_IN_PIN) << 12;
+  }
+  seed = Rng::mix(noise);
 }
 
+static_assert(NUM_PARAMS == SNAPSHOT_PARAMS, "the snapshot holds every knob value");
+
+// The whole module in one record , written row by row by the loop
 void save()
 {
-  EEPROM.write(0, length_set);  // Save data for next session
-  EEPROM.write(1, refrain_set); // Save data for next session
-  EEPROM.write(2, width_max);   // Save data for next session
-  EEPROM.write(3, width_min);   // Save data for next session
+  Snapshot record = {};
+  record.seed = seed;
+  for (int ch = 0; ch < 2; ch++)
+  {
+    VoiceSnapshot &saved = record.voice[ch];
+    for (int n = 0; n < NUM_PARAMS; n++)
+    {
+      saved.param[n] = paramValue[ch][n];
+    }
+    saved.cvTarget = cvTarget[ch];
+    saved.scale = voiceScale[ch];
+    saved.mode = voiceMode[ch];
+    noInterrupts();
+    captureVoice(saved, voices[ch]);
+    interrupts();
+  }
+  snapshots.save(record);
 }
 
-void load()
+// Settings of the newest saved record , the record is returned to restore the voices
+const Snapshot *load()
 {
-  if (EEPROM.isValid())
+  const Snapshot *record = snapshots.begin(snapshot_flash, flashErase, flashWrite);
+  if (record)
   {
-    // Load the EEPROM data
-    length_set = EEPROM.read(0);  // Read data from previous session
-    refrain_set = EEPROM.read(1); // Read data from previous session
-    width_max = EEPROM.read(2);   // Read data from previous session
-    width_min = EEPROM.read(3);   // Read data from previous session
+    seed = record->seed;
+    for (int ch = 0; ch < 2; ch++)
+    {
+      const VoiceSnapshot &saved = record->voice[ch];
+      for (int n = 0; n < NUM_PARAMS; n++)
+      {
+        paramValue[ch][n] = constrain(saved.param[n], KNOB_MIN, KNOB_MAX);
+      }
+      cvTarget[ch] = constrain(saved.cvTarget, 0, CV_OFF);
+      voiceScale[ch] = constrain(saved.scale, 0, SCALE_RAW);
+      voiceMode[ch] = constrain(saved.mode, 0, NUM_MODES - 1);
+    }
   }
+  return record;
+}
+
+void flashErase(const uint8_t *row)
+{
+  flash.erase(row, FLASH_ROW_SIZE);
+}
+
+void flashWrite(const uint8_t *dst, const void *src, uint32_t size)
+{
+  flash.write(dst, src, size);
 }
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include "clock_edge.cpp"
+
+static void makeVoices(Voice (&voices)[2])
+{
+  for (int ch = 0; ch < 2; ch++)
+  {
+    voices[ch] = {};
+    voices[ch].configure(600, 314, KNOB_MAX, 1);
+    voices[ch].reseed(0x5EED, ch);
+    voices[ch].restart();
+    voices[ch].prepare();
+  }
+}
+
+TEST(ClockEdgeTest, RisePutsOutThePreparedSteps)
+{
+  static Voice voices[2];
+  makeVoices(voices);
+  halTrace = {};
+  halTrace.advance(1000);
+
+  int cv2 = edgeRise(voices);
+  EXPECT_EQ(voices[1].outLevel, cv2);
+  ASSERT_EQ(3, halTrace.count);
+  EXPECT_EQ(voices[0].outLevel, halTrace.last(HAL_DAC)->value);
+  EXPECT_EQ(voices[0].outGate, halTrace.last(HAL_PIN, GATE_OUT_PIN_1)->value);
+  EXPECT_EQ(voices[1].outGate, halTrace.last(HAL_PIN, GATE_OUT_PIN_2)->value);
+  // CV1 goes out before the gates, all on the edge
+  EXPECT_EQ(HAL_DAC, halTrace.events[0].device);
+  EXPECT_EQ(1000u, halTrace.events[0].us);
+  EXPECT_EQ(1000u, halTrace.events[2].us);
+}
+
+TEST(ClockEdgeTest, EdgesNeverWaitOnTheBus)
+{
+  static Voice voices[2];
+  makeVoices(voices);
+  halTrace = {};
+  for (int n = 0; n < 32; n++)
+  {
+    uint32_t start = halTrace.now;
+    MCP(edgeRise(voices)); // the loop sends CV2 after the edge
+    EXPECT_EQ(start, halTrace.last(HAL_PIN, GATE_OUT_PIN_2)->us) << n;
+    edgeFall();
+    voices[0].prepare();
+    voices[1].prepare();
+    halTrace.advance(500);
+  }
+  EXPECT_EQ(32, halTrace.countOf(HAL_MCP));
+  EXPECT_FALSE(halTrace.overflow);
+  // only the MCP4725 write takes bus time
+  EXPECT_EQ(32u * (500 + 3 * HAL_I2C_BYTE_US), halTrace.now);
+}
+
+TEST(ClockEdgeTest, FallClosesBothGates)
+{
+  halTrace = {};
+  Pin<GATE_OUT_PIN_1>::write(1);
+  Pin<GATE_OUT_PIN_2>::write(1);
+  edgeFall();
+  EXPECT_FALSE(Pin<GATE_OUT_PIN_1>::read());
+  EXPECT_FALSE(Pin<GATE_OUT_PIN_2>::read());
+  EXPECT_EQ(2, halTrace.countOf(HAL_PIN, GATE_OUT_PIN_1));
+}
+
+TEST(ClockEdgeTest, TraceDropsWritesWhenFull)
+{
+  halTrace = {};
+  for (int n = 0; n <= HAL_TRACE_SIZE; n++)
+  {
+    intDAC(n);
+  }
+  EXPECT_EQ(HAL_TRACE_SIZE, halTrace.count);
+  EXPECT_TRUE(halTrace.overflow);
+  EXPECT_EQ(HAL_TRACE_SIZE - 1, halTrace.last(HAL_DAC)->value);
+  halTrace.clear();
+  EXPECT_EQ(nullptr, halTrace.last(HAL_DAC));
+}
@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include "voice.cpp"
+
+// Expected values come from an independent model of the generator , they pin the sequence
+// so a seed saved with one firmware plays the same on the next.
+
+TEST(RngTest, SequenceIsBitExact)
+{
+  Rng rng;
+  rng.seed(1, 0);
+  EXPECT_EQ(0x514E28B7u, rng.state);
+  EXPECT_EQ(0x1F48D1FBu, rng.next());
+  EXPECT_EQ(0xAB81DB40u, rng.next());
+  EXPECT_EQ(0x8DDBF5B4u, rng.next());
+  EXPECT_EQ(0x9ECC8C42u, rng.next());
+}
+
+TEST(RngTest, ZeroSeedStillRuns)
+{
+  Rng rng;
+  rng.seed(0, 0);
+  EXPECT_EQ(uint32_t(RNG_FALLBACK_STATE), rng.state);
+  EXPECT_NE(0u, rng.next());
+}
+
+TEST(RngTest, BelowStaysInRange)
+{
+  Rng rng;
+  rng.seed(42, 3);
+  int counts[6] = {};
+  for (int n = 0; n < 6000; n++)
+  {
+    uint16_t value = rng.below(6);
+    ASSERT_LT(value, 6);
+    counts[value]++;
+  }
+  for (int count : counts)
+  {
+    EXPECT_GT(count, 850);
+  }
+  for (int n = 0; n < 1000; n++)
+  {
+    ASSERT_LT(rng.below(4096), 4096);
+  }
+}
+
+TEST(RngTest, StreamsDiffer)
+{
+  Rng a, b;
+  a.seed(0x5EED, 0);
+  b.seed(0x5EED, 1);
+  EXPECT_NE(a.next(), b.next());
+}
+
+TEST(RngTest, SeedReplaysTheVoice)
+{
+  Voice voice;
+  voice.reseed(0x5EED, 1);
+  const uint8_t gateA[8] = {1, 1, 1, 0, 0, 1, 1, 0};
+  const uint16_t cvA[4] = {3536, 1581, 3141, 1458};
+  const uint8_t gateB[8] = {0, 0, 1, 1, 0, 0, 0, 1};
+  const uint16_t cvB[4] = {1637, 2435, 2546, 2824};
+  for (int n = 0; n < 8; n++)
+  {
+    EXPECT_EQ(gateA[n], voice.gate[STAGE_A][n]) << n;
+    EXPECT_EQ(gateB[n], voice.gate[STAGE_B][n]) << n;
+  }
+  for (int n = 0; n < 4; n++)
+  {
+    EXPECT_EQ(cvA[n], voice.cv[STAGE_A][n]) << n;
+    EXPECT_EQ(cvB[n], voice.cv[STAGE_B][n]) << n;
+  }
+
+  voice.length = 8;
+  voice.chance = 2;
+  voice.lottery();
+  const uint8_t lotteryGateA[8] = {1, 1, 1, 0, 1, 0, 1, 1};
+  const uint16_t lotteryCvA[8] = {3536, 1581, 3141, 1458, 389, 2804, 911, 87};
+  const uint8_t lotteryGateB[8] = {0, 0, 1, 1, 0, 0, 1, 1};
+  const uint16_t lotteryCvB[8] = {1637, 2435, 2546, 2824, 2575, 1446, 1657, 4011};
+  for (int n = 0; n < 8; n++)
+  {
+    EXPECT_EQ(lotteryGateA[n], voice.gate[STAGE_A][n]) << n;
+    EXPECT_EQ(lotteryCvA[n], voice.cv[STAGE_A][n]) << n;
+    EXPECT_EQ(lotteryGateB[n], voice.gate[STAGE_B][n]) << n;
+    EXPECT_EQ(lotteryCvB[n], voice.cv[STAGE_B][n]) << n;
+  }
+}
+
+TEST(RngTest, LotteryIsBoundedAndOnlyTouchesTheLength)
+{
+  Voice voice;
+  voice.reseed(7, 0);
+  uint16_t before[2][STAGE_STEPS];
+  memcpy(before, voice.cv, sizeof(before));
+  voice.length = 4;
+  voice.chance = 3;
+  uint32_t state = voice.rng.state;
+  voice.lottery();
+  for (int n = 4; n < STAGE_STEPS; n++)
+  {
+    EXPECT_EQ(before[STAGE_A][n], voice.cv[STAGE_A][n]);
+    EXPECT_EQ(before[STAGE_B][n], voice.cv[STAGE_B][n]);
+  }
+  // (chance + 1) rounds of 4 draws
+  Rng replay;
+  replay.state = state;
+  for (int n = 0; n < 16; n++)
+  {
+    replay.next();
+  }
+  EXPECT_EQ(replay.state, voice.rng.state);
+  EXPECT_LE(voice.chance + 1, MAX_LOTTERY_CHANGES);
+}
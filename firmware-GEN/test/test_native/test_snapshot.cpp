@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+
+#include "snapshot.cpp"
+
+// RAM stand-in for the flash rows , programming can only clear bits like the real flash
+alignas(FLASH_ROW_SIZE) static uint8_t flash[SNAPSHOT_AREA_SIZE];
+static int operations = 0;
+
+static void erase(const uint8_t *row)
+{
+  memset((uint8_t *)row, 0xFF, FLASH_ROW_SIZE);
+  operations++;
+}
+
+static void program(const uint8_t *dst, const void *src, uint32_t size)
+{
+  for (uint32_t n = 0; n < size; n++)
+  {
+    ((uint8_t *)dst)[n] &= ((const uint8_t *)src)[n];
+  }
+  operations++;
+}
+
+class SnapshotTest : public ::testing::Test
+{
+protected:
+  SnapshotWriter writer;
+
+  void SetUp() override
+  {
+    memset(flash, 0, sizeof(flash));
+    operations = 0;
+  }
+
+  static Snapshot record(uint16_t seed)
+  {
+    Snapshot s = {};
+    s.seed = seed;
+    s.voice[1].param[2] = 1000; // 10 bit values are kept
+    return s;
+  }
+
+  void saveAll(const Snapshot &s)
+  {
+    writer.save(s);
+    while (!writer.service())
+    {
+    }
+  }
+
+  // Play a while and save with the next step prepared, like the loop does. The restored
+  // voice then has to play on exactly like the one that kept going.
+  void playOnFromTheSavedStep(uint8_t mode)
+  {
+    Voice voice = {};
+    voice.configure(400, 1024, 1024, 300);
+    voice.setMode(mode);
+    voice.reseed(0x5EED, 1);
+    for (int n = 0; n < 21; n++)
+    {
+      voice.prepare();
+      voice.clock();
+      if (voice.lotteryDue)
+      {
+        voice.lottery();
+      }
+    }
+    voice.prepare(); // the loop has the next step ready when it saves
+    Snapshot s = {};
+    captureVoice(s.voice[0], voice);
+    writer.begin(flash, erase, program);
+    saveAll(s);
+
+    Voice restored = {};
+    restored.configure(400, 1024, 1024, 300);
+    restored.setMode(mode);
+    restoreVoice(restored, SnapshotWriter().begin(flash, erase, program)->voice[0]);
+    restored.requantize();
+    EXPECT_EQ(0, memcmp(voice.gate, restored.gate, sizeof(voice.gate)));
+    EXPECT_EQ(0, memcmp(voice.cv, restored.cv, sizeof(voice.cv)));
+    for (int n = 0; n < 40; n++)
+    {
+      voice.clock();
+      restored.clock();
+      ASSERT_EQ(voice.stage, restored.stage) << n;
+      ASSERT_EQ(voice.step, restored.step) << n;
+      ASSERT_EQ(voice.shift, restored.shift) << n;
+      ASSERT_EQ(voice.outLevel, restored.outLevel) << n;
+      ASSERT_EQ(voice.outGate, restored.outGate) << n;
+      if (voice.lotteryDue)
+      {
+        voice.lottery();
+        restored.lottery();
+      }
+    }
+  }
+};
+
+TEST_F(SnapshotTest, BlankFlashHasNoRecord)
+{
+  EXPECT_EQ(nullptr, writer.begin(flash, erase, program));
+}
+
+TEST_F(SnapshotTest, SavesOneOperationAtATime)
+{
+  writer.begin(flash, erase, program);
+  writer.save(record(0x1234));
+  EXPECT_TRUE(writer.busy());
+  int steps = 1;
+  while (!writer.service())
+  {
+    steps++;
+  }
+  // one erase and a page write per 64 bytes
+  EXPECT_EQ(1 + (int(sizeof(Snapshot)) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE, steps);
+  EXPECT_EQ(steps, operations);
+  EXPECT_FALSE(writer.busy());
+
+  SnapshotWriter boot;
+  const Snapshot *loaded = boot.begin(flash, erase, program);
+  ASSERT_NE(nullptr, loaded);
+  EXPECT_EQ(0x1234, loaded->seed);
+  EXPECT_EQ(1000, loaded->voice[1].param[2]);
+}
+
+TEST_F(SnapshotTest, RowsTakeTurnsAndTheNewestWins)
+{
+  writer.begin(flash, erase, program);
+  for (uint16_t seed = 1; seed <= 300; seed++) // the sequence wraps around
+  {
+    saveAll(record(seed));
+    SnapshotWriter boot;
+    const Snapshot *loaded = boot.begin(flash, erase, program);
+    ASSERT_NE(nullptr, loaded);
+    EXPECT_EQ(seed, loaded->seed);
+    EXPECT_EQ(seed % 2 ? flash : flash + FLASH_ROW_SIZE, (const uint8_t *)loaded);
+  }
+}
+
+TEST_F(SnapshotTest, CutShortSaveKeepsThePreviousRecord)
+{
+  writer.begin(flash, erase, program);
+  saveAll(record(1));
+  writer.save(record(2));
+  writer.service(); // erase
+  writer.service(); // first page , then the power goes
+
+  SnapshotWriter boot;
+  const Snapshot *loaded = boot.begin(flash, erase, program);
+  ASSERT_NE(nullptr, loaded);
+  EXPECT_EQ(1, loaded->seed);
+
+  // and the next save does not overwrite it
+  boot.save(record(3));
+  while (!boot.service())
+  {
+  }
+  EXPECT_EQ(1, ((const Snapshot *)flash)->seed);
+  EXPECT_EQ(3, SnapshotWriter().begin(flash, erase, program)->seed);
+}
+
+TEST_F(SnapshotTest, CorruptRecordIsIgnored)
+{
+  writer.begin(flash, erase, program);
+  saveAll(record(1));
+  saveAll(record(2));
+  flash[FLASH_ROW_SIZE + 20] ^= 0x01; // the newest one
+  const Snapshot *loaded = SnapshotWriter().begin(flash, erase, program);
+  ASSERT_NE(nullptr, loaded);
+  EXPECT_EQ(1, loaded->seed);
+}
+
+TEST_F(SnapshotTest, VoicePlaysOnFromTheSavedStep)
+{
+  playOnFromTheSavedStep(MODE_STAGES);
+}
+
+TEST_F(SnapshotTest, TuringVoicePlaysOnFromTheSavedStep)
+{
+  playOnFromTheSavedStep(MODE_TURING);
+}
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "voice.cpp"
+
+#define SEMITONE 68.25 // 12 bit DAC codes per semitone at 1 V/oct
+
+static bool inScale(int scaleIndex, int code)
+{
+  int note = int(code / SEMITONE + 0.5) % 12;
+  for (int i = 0; i < 7; i++)
+  {
+    if (scaleNotes[scaleIndex][i] == note && (i == 0 || scaleNotes[scaleIndex][i] != 0))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+TEST(StageScaleTest, RawPassesTheLevel)
+{
+  StageScale scale;
+  EXPECT_EQ(SCALE_RAW, scale.index);
+  EXPECT_EQ(1234, scale.apply(1234));
+}
+
+TEST(StageScaleTest, ChromaticSnapsToSemitones)
+{
+  StageScale scale;
+  scale.select(0);
+  for (int level = 0; level <= 4095; level += 7)
+  {
+    int code = scale.apply(level);
+    EXPECT_NEAR(level, code, 1.5 * SEMITONE) << level; // the DQ thresholds sit half a semitone under the notes
+    EXPECT_EQ(int(int(code / SEMITONE + 0.5) * SEMITONE), code) << level;
+  }
+}
+
+TEST(StageScaleTest, WholeRangeStaysInTheScale)
+{
+  // Pentatonic minor ends below the top of the range , Major starts on the first code
+  for (int scaleIndex : {1, 8})
+  {
+    StageScale scale;
+    scale.select(scaleIndex);
+    for (int level = 0; level <= 4095; level += 5)
+    {
+      int code = scale.apply(level);
+      EXPECT_TRUE(code >= 0 && code <= 4095) << level;
+      EXPECT_TRUE(inScale(scaleIndex, code)) << scaleIndex << " " << level;
+    }
+  }
+}
+
+TEST(StageScaleTest, VoiceKeepsQuantizedCodes)
+{
+  Voice voice = {};
+  voice.configure(500, 1024, 1024, 1);
+  voice.reseed(0x5EED, 0);
+  voice.setScale(1);
+  for (int n = 0; n < STAGE_STEPS; n++)
+  {
+    EXPECT_TRUE(inScale(1, voice.code[STAGE_A][n])) << n;
+    EXPECT_TRUE(inScale(1, voice.code[STAGE_B][n])) << n;
+  }
+
+  // the lottery quantizes the steps it draws
+  voice.chance = 4;
+  voice.lottery();
+  for (int n = 0; n < STAGE_STEPS; n++)
+  {
+    EXPECT_TRUE(inScale(1, voice.code[STAGE_A][n])) << n;
+  }
+
+  // a narrower width brings every code closer to the middle
+  voice.configure(500, 1024, 1, 1);
+  for (int n = 0; n < STAGE_STEPS; n++)
+  {
+    EXPECT_NEAR(2048, voice.code[STAGE_A][n], 412) << n;
+  }
+}
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+
+#include "step_view.cpp"
+
+// Check every stale cell the way the display does , returns the cells drawn
+static int update(StepView &view, const Voice &voice, DirtyPages &dirty)
+{
+  int drawn = 0;
+  uint8_t lane, n;
+  view.follow(voice);
+  while (view.nextStale(lane, n))
+  {
+    if (view.show(lane, n, view.state(voice, lane, n), dirty))
+    {
+      drawn++;
+    }
+  }
+  return drawn;
+}
+
+static Voice makeVoice()
+{
+  Voice voice = {};
+  voice.configure(600, 314, KNOB_MAX, 1); // A and B with 4 lottery changes , 8 steps , full width
+  voice.reseed(0x5EED, 0);
+  voice.restart();
+  return voice;
+}
+
+TEST(StepViewTest, FirstUpdateDrawsBothStages)
+{
+  Voice voice = makeVoice();
+  StepView view(8);
+  DirtyPages dirty;
+  EXPECT_EQ(2 * STAGE_STEPS, update(view, voice, dirty));
+  for (int n = 0; n < 8; n++)
+  {
+    EXPECT_EQ(voice.gate[STAGE_A][n] ? CELL_GATE : 0, view.shown[STAGE_A][n] & CELL_GATE) << n;
+    EXPECT_GE(view.shown[STAGE_B][n] & CELL_BAR, 1) << n;
+    EXPECT_LE(view.shown[STAGE_B][n] & CELL_BAR, VIEW_BAR_HEIGHT - 1) << n;
+  }
+  EXPECT_EQ(CELL_OUTSIDE, view.shown[STAGE_A][8]);
+  EXPECT_EQ(0x0F << 1, dirty.mask); // pages 1 to 4
+}
+
+TEST(StepViewTest, ClockRedrawsOnlyThePlayheadCells)
+{
+  Voice voice = makeVoice();
+  StepView view(8);
+  DirtyPages dirty;
+  voice.clock();
+  update(view, voice, dirty);
+  EXPECT_TRUE(view.shown[STAGE_A][0] & CELL_PLAYHEAD);
+  dirty.clear();
+
+  voice.clock();
+  EXPECT_EQ(2, update(view, voice, dirty));
+  EXPECT_FALSE(view.shown[STAGE_A][0] & CELL_PLAYHEAD);
+  EXPECT_TRUE(view.shown[STAGE_A][1] & CELL_PLAYHEAD);
+  EXPECT_EQ(VIEW_X, dirty.colStart[1]);
+  EXPECT_EQ(VIEW_X + VIEW_CELL_PITCH + VIEW_CELL_WIDTH - 1, dirty.colEnd[1]);
+
+  dirty.clear();
+  EXPECT_EQ(0, update(view, voice, dirty));
+  EXPECT_EQ(0, dirty.mask);
+}
+
+TEST(StepViewTest, PlayheadMovesToStageB)
+{
+  Voice voice = makeVoice();
+  StepView view(8);
+  DirtyPages dirty;
+  for (int n = 0; n < 8; n++)
+  {
+    voice.clock();
+  }
+  update(view, voice, dirty);
+  voice.clock();
+  EXPECT_EQ(2, update(view, voice, dirty));
+  EXPECT_FALSE(view.shown[STAGE_A][7] & CELL_PLAYHEAD);
+  EXPECT_TRUE(view.shown[STAGE_B][0] & CELL_PLAYHEAD);
+}
+
+TEST(StepViewTest, LotteryRedrawsTheChangedSteps)
+{
+  Voice voice = makeVoice();
+  StepView view(8);
+  DirtyPages dirty;
+  update(view, voice, dirty);
+
+  uint8_t before[2][STAGE_STEPS];
+  memcpy(before, view.shown, sizeof(before));
+  voice.lottery();
+  int changed = 0;
+  int drawn = update(view, voice, dirty);
+  for (int lane = 0; lane < 2; lane++)
+  {
+    for (int n = 0; n < STAGE_STEPS; n++)
+    {
+      changed += before[lane][n] != view.shown[lane][n];
+    }
+  }
+  EXPECT_EQ(changed, drawn);
+  EXPECT_GT(drawn, 0);
+  EXPECT_LE(drawn, 2 * (voice.chance + 1));
+}
+
+TEST(StepViewTest, ShorterLengthDotsTheCellsPastIt)
+{
+  Voice voice = makeVoice();
+  StepView view(8);
+  DirtyPages dirty;
+  update(view, voice, dirty);
+  voice.configure(600, KNOB_MIN, KNOB_MAX, 1); // 4 steps
+  EXPECT_EQ(8, update(view, voice, dirty));
+  EXPECT_EQ(CELL_OUTSIDE, view.shown[STAGE_A][4]);
+  EXPECT_EQ(CELL_OUTSIDE, view.shown[STAGE_B][7]);
+}
+
+TEST(StepViewTest, TuringShowsTheRegisterBits)
+{
+  Voice voice = makeVoice();
+  voice.setMode(MODE_TURING);
+  StepView view(8);
+  DirtyPages dirty;
+  update(view, voice, dirty);
+  for (int n = 0; n < 8; n++)
+  {
+    EXPECT_EQ(voice.shift >> n & 1 ? CELL_GATE : 0, view.shown[STAGE_A][n]) << n;
+    EXPECT_EQ(0, view.shown[STAGE_B][n]) << n;
+  }
+
+  uint16_t shift = voice.shift;
+  voice.clock();
+  int flipped = 0;
+  for (int n = 0; n < 8; n++)
+  {
+    flipped += (shift ^ voice.shift) >> n & 1;
+  }
+  EXPECT_EQ(flipped, update(view, voice, dirty));
+}
+
+TEST(StepViewTest, CellGeometry)
+{
+  StepView view(36);
+  EXPECT_EQ(VIEW_X, view.cellX(0));
+  EXPECT_EQ(VIEW_X + 15 * VIEW_CELL_PITCH + VIEW_CELL_WIDTH, 127);
+  EXPECT_EQ(36, view.laneY(STAGE_A));
+  EXPECT_EQ(50 + VIEW_LANE_HEIGHT, 64);
+  EXPECT_EQ(50, view.laneY(STAGE_B));
+}
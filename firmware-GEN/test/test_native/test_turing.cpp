@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+
+#include "voice.cpp"
+
+static Voice makeTuring(int looping, int lengthValue)
+{
+  Voice voice = {};
+  voice.configure(looping, lengthValue, KNOB_MAX, 1);
+  voice.reseed(0x5EED, 0);
+  voice.restart();
+  voice.setMode(MODE_TURING);
+  return voice;
+}
+
+TEST(TuringTest, LockedLoopRepeatsAfterLength)
+{
+  Voice voice = makeTuring(KNOB_MIN, 26); // never flips , 6 steps
+  ASSERT_EQ(0u, voice.flipChance);
+  ASSERT_EQ(6, voice.length);
+  uint16_t start = voice.shift;
+  int levels[12];
+  bool gates[12];
+  for (int n = 0; n < 12; n++)
+  {
+    voice.clock();
+    levels[n] = voice.outLevel;
+    gates[n] = voice.outGate;
+  }
+  // the low 6 bits rotate , so the register comes back every 6 clocks
+  EXPECT_EQ(start & 0x3F, voice.shift & 0x3F);
+  for (int n = 0; n < 6; n++)
+  {
+    EXPECT_EQ(gates[n], gates[n + 6]) << n;
+    EXPECT_EQ(voice.shift >> (5 - n) & 1, gates[n]) << n;
+  }
+  // bits 6 and 7 of the CV are the loop's top bit one and two clocks late , so the
+  // levels repeat too once two clocks have filled them
+  for (int n = 2; n < 6; n++)
+  {
+    EXPECT_EQ(levels[n], levels[n + 6]) << n;
+  }
+  EXPECT_EQ(voice.turingLevel(voice.shift & 0xFF), levels[11]);
+  EXPECT_FALSE(voice.lotteryDue);
+}
+
+TEST(TuringTest, FullFlipInvertsAndDoublesTheLoop)
+{
+  Voice voice = makeTuring(KNOB_MAX, 1); // always flips , 4 steps
+  ASSERT_EQ(65536u, voice.flipChance);
+  uint16_t start = voice.shift & 0xF;
+  for (int n = 0; n < 4; n++)
+  {
+    voice.clock();
+  }
+  EXPECT_EQ(start ^ 0xF, voice.shift & 0xF);
+  for (int n = 0; n < 4; n++)
+  {
+    voice.clock();
+  }
+  EXPECT_EQ(start, voice.shift & 0xF);
+}
+
+TEST(TuringTest, HalfwayFlipsAboutHalfTheBits)
+{
+  Voice voice = makeTuring(512, 1024);
+  int flips = 0;
+  for (int n = 0; n < 4000; n++)
+  {
+    uint16_t expected = voice.shiftedIn(voice.shift, 0);
+    voice.clock();
+    flips += voice.shift != expected;
+  }
+  EXPECT_NEAR(2000, flips, 150);
+}
+
+TEST(TuringTest, LevelsComeFromTheLowByte)
+{
+  Voice voice = makeTuring(KNOB_MIN, 1024);
+  voice.configure(KNOB_MIN, 1024, 1, 1); // narrow width , 412..612
+  EXPECT_EQ(412 * 4, voice.turingLevel(0x00));
+  EXPECT_EQ(612 * 4, voice.turingLevel(0xFF));
+
+  voice.shift = 0x1234;
+  voice.warm();
+  voice.prepare();
+  EXPECT_EQ(voice.turingLevel(uint8_t(voice.nextShift)), voice.nextLevel);
+  EXPECT_EQ(bool(voice.nextShift & 1), voice.nextGate);
+
+  // a new scale empties the lookup
+  voice.setScale(1);
+  EXPECT_EQ(0u, voice.turingKnown[0] | voice.turingKnown[7]);
+  int code = voice.turingLevel(1);
+  EXPECT_EQ(int(int(code / 68.25 + 0.5) * 68.25), code); // on a semitone
+}
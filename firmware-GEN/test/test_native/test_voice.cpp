@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+
+#include "voice.cpp"
+
+static Voice makeVoice(uint8_t length, uint8_t refrain, bool repeat)
+{
+  Voice voice = {};
+  voice.length = length;
+  voice.refrain = refrain;
+  voice.repeat = repeat;
+  voice.widthMin = 0;
+  voice.widthMax = 1023;
+  return voice;
+}
+
+TEST(VoiceTest, StageARefrainsThenStartsOver)
+{
+  Voice voice = makeVoice(4, 2, false);
+  for (int n = 0; n < 8; n++)
+  {
+    voice.clock();
+    EXPECT_EQ(STAGE_A, voice.stage);
+    EXPECT_FALSE(voice.lotteryDue);
+  }
+  voice.clock(); // A played twice , starts over with a lottery
+  EXPECT_EQ(STAGE_A, voice.stage);
+  EXPECT_EQ(1, voice.step);
+  EXPECT_TRUE(voice.lotteryDue);
+}
+
+TEST(VoiceTest, RepeatPlaysStageBBetweenA)
+{
+  Voice voice = makeVoice(3, 1, true);
+  int stages[9];
+  for (int n = 0; n < 9; n++)
+  {
+    voice.clock();
+    stages[n] = voice.stage;
+  }
+  const int expected[9] = {STAGE_A, STAGE_A, STAGE_A, STAGE_B, STAGE_B, STAGE_B, STAGE_A, STAGE_A, STAGE_A};
+  for (int n = 0; n < 9; n++)
+  {
+    EXPECT_EQ(expected[n], stages[n]) << n;
+  }
+  EXPECT_TRUE(voice.lotteryDue); // only when A comes back
+}
+
+TEST(VoiceTest, OutputsFollowTheStage)
+{
+  Voice voice = makeVoice(2, 1, true);
+  voice.gate[STAGE_A][0] = 1;
+  voice.cv[STAGE_A][0] = CV_MAX;
+  voice.gate[STAGE_B][0] = 0;
+  voice.cv[STAGE_B][0] = 0;
+  voice.requantize();
+  EXPECT_FALSE(voice.outGate);
+  EXPECT_EQ(0, voice.outLevel);
+
+  voice.clock();
+  EXPECT_TRUE(voice.outGate);
+  EXPECT_EQ(1023 * 4, voice.outLevel);
+  voice.clock();
+  voice.clock(); // first step of B
+  EXPECT_EQ(STAGE_B, voice.stage);
+  EXPECT_FALSE(voice.outGate);
+  EXPECT_EQ(0, voice.outLevel);
+}
+
+TEST(VoiceTest, WidthNarrowsAroundTheMiddle)
+{
+  Voice voice = makeVoice(1, 1, false);
+  voice.configure(500, 1, 1, 1);
+  voice.cv[STAGE_A][0] = 0;
+  voice.requantize();
+  voice.clock();
+  EXPECT_EQ(412 * 4, voice.outLevel);
+  voice.cv[STAGE_A][0] = CV_MAX;
+  voice.requantize();
+  EXPECT_EQ(612 * 4, voice.levelOf(STAGE_A, 1));
+}
+
+TEST(VoiceTest, ConfigureLadders)
+{
+  Voice voice = {};
+  voice.configure(1, 1, 1, 1);
+  EXPECT_EQ(4, voice.length);
+  EXPECT_EQ(1, voice.refrain);
+  EXPECT_FALSE(voice.repeat);
+  EXPECT_EQ(0, voice.chance);
+
+  voice.configure(400, 1024, 1024, 1024);
+  EXPECT_EQ(16, voice.length);
+  EXPECT_EQ(8, voice.refrain);
+  EXPECT_EQ(16, voice.chance); // chance follows the length in the middle of the range
+  EXPECT_EQ(1021, voice.widthMax);
+  EXPECT_EQ(3, voice.widthMin);
+
+  voice.configure(1024, 1, 1, 1);
+  EXPECT_TRUE(voice.repeat);
+  EXPECT_EQ(0, voice.chance);
+}
+
+TEST(VoiceTest, PlanOnlyReadsTheVoice)
+{
+  Voice voice = makeVoice(8, 1, false);
+  voice.reseed(0x5EED, 0);
+  voice.turingLevel(7);
+  uint16_t code[2][STAGE_STEPS];
+  memcpy(code, voice.code, sizeof(code));
+  uint8_t revision = voice.revision;
+  VoiceUpdate update;
+  voice.plan(update, 700, 1024, 300, 600); // new width , the steps are quantized again
+  EXPECT_TRUE(update.requantized);
+  EXPECT_EQ(0, memcmp(code, voice.code, sizeof(code)));
+  EXPECT_EQ(8, voice.length);
+  EXPECT_EQ(revision, voice.revision);
+  EXPECT_NE(0u, voice.turingKnown[0]);
+
+  Voice reference = voice;
+  reference.configure(700, 1024, 300, 600);
+  voice.apply(update);
+  EXPECT_EQ(16, voice.length);
+  EXPECT_EQ(widthMaxOf(300), voice.widthMax);
+  EXPECT_EQ(0u, voice.turingKnown[0]);
+  EXPECT_EQ(revision + 2, voice.revision); // the length and the codes
+  EXPECT_EQ(0, memcmp(reference.code, voice.code, sizeof(code)));
+
+  // the same width again leaves the codes alone
+  voice.plan(update, 100, 1024, 300, 600);
+  EXPECT_FALSE(update.requantized);
+}
+
+TEST(VoiceTest, ShorterLengthKeepsTheStepInside)
+{
+  Voice voice = makeVoice(16, 1, false);
+  for (int n = 0; n < 10; n++)
+  {
+    voice.clock();
+  }
+  voice.configure(1, 1, 1, 1);
+  EXPECT_EQ(4, voice.step);
+  voice.clock();
+  EXPECT_EQ(1, voice.step);
+}
+
+TEST(VoiceTest, PreparedStepWaitsForTheClock)
+{
+  Voice voice = makeVoice(2, 1, false);
+  voice.gate[STAGE_A][0] = 1;
+  voice.cv[STAGE_A][0] = CV_MAX;
+  voice.requantize();
+  voice.prepare();
+  EXPECT_TRUE(voice.nextGate);
+  EXPECT_EQ(1023 * 4, voice.nextLevel);
+  EXPECT_FALSE(voice.outGate); // nothing changes before the edge
+  EXPECT_EQ(0, voice.step);
+
+  voice.clock();
+  EXPECT_TRUE(voice.outGate);
+  EXPECT_EQ(1023 * 4, voice.outLevel);
+  EXPECT_EQ(1, voice.step);
+  EXPECT_FALSE(voice.prepared);
+}
+
+TEST(VoiceTest, LotteryDropsThePreparedStep)
+{
+  Voice voice = makeVoice(1, 1, false);
+  voice.reseed(1, 0);
+  voice.chance = 1;
+  voice.clock();
+  voice.clock(); // A starts over
+  voice.prepare(); // before loop() got to the lottery
+  EXPECT_TRUE(voice.lotteryDue);
+  voice.lottery();
+  EXPECT_FALSE(voice.prepared);
+  voice.prepare();
+  EXPECT_EQ(voice.gate[STAGE_A][0], voice.nextGate);
+  EXPECT_EQ(voice.levelOf(STAGE_A, 1), voice.nextLevel);
+}
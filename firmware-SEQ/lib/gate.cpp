@@ -0,0 +1,165 @@
+#pragma once
+#include <stdint.h>
+
+// Gate scheduling against a free running 32 bit microsecond timer. Gates are opened by the
+// sequencer and closed by the timer compare interrupt at the deadline from nextDeadline().
+// All comparisons use signed differences so the timer wrap after ~71 minutes is harmless.
+
+#define GATE_CHANNELS 2
+#define REC_MONITOR_GATE_US 5000 // gate sent while recording to hear the new step
+#define MIN_GATE_US 1000
+#define MIN_RATCHET_US (2 * MIN_GATE_US) // ratchet interval whose gate is never stretched to MIN_GATE_US
+
+#define GATE_LENGTH_MS 0
+#define GATE_LENGTH_PERCENT 1 // of the measured step period
+
+struct GateLength
+{
+  uint8_t mode;
+  uint8_t value;
+};
+
+// Gate length choices of the GATE setting
+const GateLength gateLengths[] = {
+    {GATE_LENGTH_MS, 5}, {GATE_LENGTH_MS, 10}, {GATE_LENGTH_MS, 20}, {GATE_LENGTH_MS, 50}, {GATE_LENGTH_MS, 100},
+    {GATE_LENGTH_PERCENT, 10}, {GATE_LENGTH_PERCENT, 25}, {GATE_LENGTH_PERCENT, 50}, {GATE_LENGTH_PERCENT, 75}, {GATE_LENGTH_PERCENT, 90}};
+#define NUM_GATE_LENGTHS (sizeof(gateLengths) / sizeof(gateLengths[0]))
+#define DEFAULT_GATE_LENGTH 1 // 10ms , the original fixed gate
+
+// Gate length for a step lasting periodUs (0 = no clock measured yet). Gates end at least 5%
+// of the period before the next step so it retriggers.
+inline uint32_t gateLengthUs(const GateLength &length, uint32_t periodUs)
+{
+  uint32_t us;
+  if (length.mode == GATE_LENGTH_PERCENT)
+  {
+    us = periodUs ? periodUs / 100 * length.value : 10000;
+  }
+  else
+  {
+    us = length.value * 1000UL;
+  }
+  if (periodUs && us > periodUs - periodUs / 20)
+  {
+    us = periodUs - periodUs / 20;
+  }
+  return us < MIN_GATE_US ? MIN_GATE_US : us;
+}
+
+// Ratchet gates that fit a step lasting periodUs. With a fast clock a gate stretched to
+// MIN_GATE_US would end on the next rise , so fewer are played and each keeps its gap.
+inline uint8_t ratchetsFitting(uint8_t count, uint32_t periodUs)
+{
+  while (count > 1 && periodUs / count < MIN_RATCHET_US)
+  {
+    count--;
+  }
+  return count;
+}
+
+struct GateScheduler
+{
+  bool high[GATE_CHANNELS] = {};
+  bool timed[GATE_CHANNELS] = {}; // an end is scheduled at offAt
+  uint32_t offAt[GATE_CHANNELS] = {};
+  uint8_t repeats[GATE_CHANNELS] = {}; // ratchet gates still to come , rising at riseAt
+  uint32_t riseAt[GATE_CHANNELS] = {};
+  uint32_t repeatLength[GATE_CHANNELS] = {};
+  uint32_t repeatInterval[GATE_CHANNELS] = {};
+
+  // Open a gate at now. hold keeps it open into the next step (tie / legato) , otherwise it
+  // ends after lengthUs. Returns true when the output has to rise , false when it was
+  // already high and carries on without a retrigger.
+  bool open(uint8_t ch, uint32_t now, uint32_t lengthUs, bool hold)
+  {
+    bool rise = !high[ch];
+    high[ch] = true;
+    timed[ch] = !hold;
+    offAt[ch] = now + lengthUs;
+    repeats[ch] = 0;
+    riseAt[ch] = now;
+    repeatLength[ch] = lengthUs;
+    return rise;
+  }
+
+  // Repeat the gate just opened count more times , intervalUs apart
+  void ratchet(uint8_t ch, uint8_t count, uint32_t intervalUs)
+  {
+    repeats[ch] = count;
+    repeatInterval[ch] = intervalUs;
+    riseAt[ch] += intervalUs;
+  }
+
+  // End a gate at once , returns true when the output has to fall
+  bool close(uint8_t ch)
+  {
+    bool fall = high[ch];
+    high[ch] = false;
+    timed[ch] = false;
+    repeats[ch] = 0;
+    return fall;
+  }
+
+  // Earliest scheduled gate end or ratchet , false when none is pending
+  bool nextDeadline(uint32_t now, uint32_t &deadline) const
+  {
+    bool pending = false;
+    for (uint8_t ch = 0; ch < GATE_CHANNELS; ch++)
+    {
+      uint32_t due;
+      if (timed[ch])
+      {
+        due = offAt[ch];
+      }
+      else if (!high[ch] && repeats[ch])
+      {
+        due = riseAt[ch];
+      }
+      else
+      {
+        continue;
+      }
+      if (!pending || int32_t(due - now) < int32_t(deadline - now))
+      {
+        deadline = due;
+        pending = true;
+      }
+    }
+    return pending;
+  }
+
+  // End the gates that are due , returns a bit mask of the outputs that have to fall
+  uint8_t expire(uint32_t now)
+  {
+    uint8_t fall = 0;
+    for (uint8_t ch = 0; ch < GATE_CHANNELS; ch++)
+    {
+      if (timed[ch] && int32_t(now - offAt[ch]) >= 0)
+      {
+        high[ch] = false;
+        timed[ch] = false;
+        fall |= 1 << ch;
+      }
+    }
+    return fall;
+  }
+
+  // Start the ratchet gates that are due , returns a bit mask of the outputs that have to rise
+  uint8_t retrigger(uint32_t now)
+  {
+    uint8_t rise = 0;
+    for (uint8_t ch = 0; ch < GATE_CHANNELS; ch++)
+    {
+      if (!high[ch] && repeats[ch] && int32_t(now - riseAt[ch]) >= 0)
+      {
+        high[ch] = true;
+        timed[ch] = true;
+        offAt[ch] = riseAt[ch] + repeatLength[ch];
+        riseAt[ch] += repeatInterval[ch];
+        repeats[ch]--;
+        rise |= 1 << ch;
+      }
+    }
+    return rise;
+  }
+};
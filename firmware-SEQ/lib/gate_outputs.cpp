@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+
+#include "hal.h"
+#include "gate.cpp"
+
+// Gate outputs of the sequencer
+// The GateScheduler decides which edges are due, these put them on the jacks: from the loop
+// when a step opens or closes a gate, and from the TC4 compare interrupt when a gate ends or
+// a ratchet repeat starts. The jacks are LOW active, a gate is on while its pin is low.
+
+#define ENV_OUT_PIN_1 OUT_PIN_1
+#define ENV_OUT_PIN_2 OUT_PIN_2
+
+// Gate of channel 0 or 1 on its jack
+inline void gatePin(uint8_t ch, bool on)
+{
+  if (ch == 0)
+  {
+    Pin<ENV_OUT_PIN_1>::write(!on);
+  }
+  else
+  {
+    Pin<ENV_OUT_PIN_2>::write(!on);
+  }
+}
+
+// Both gates off. The pins come out of reset low, which is a gate on, and a rest step only
+// writes a pin when its gate was open, so setup() drives them high first.
+inline void gatesBegin()
+{
+  for (uint8_t ch = 0; ch < GATE_CHANNELS; ch++)
+  {
+    gatePin(ch, 0);
+  }
+}
+
+// Open a gate at now, ratchets more gates follow interval apart
+inline void openGate(GateScheduler &gates, uint8_t ch, uint32_t now, uint32_t length, bool hold, uint8_t ratchets, uint32_t interval)
+{
+  if (gates.open(ch, now, length, hold))
+  {
+    gatePin(ch, 1);
+  }
+  if (ratchets > 0)
+  {
+    gates.ratchet(ch, ratchets, interval);
+  }
+}
+
+inline void closeGate(GateScheduler &gates, uint8_t ch)
+{
+  if (gates.close(ch))
+  {
+    gatePin(ch, 0);
+  }
+}
+
+// Compare interrupt: the due gates end, then the due ratchet repeats start
+inline void gateTimerEdges(GateScheduler &gates, uint32_t now)
+{
+  uint8_t fall = gates.expire(now);
+  uint8_t rise = gates.retrigger(now);
+  for (uint8_t ch = 0; ch < GATE_CHANNELS; ch++)
+  {
+    if (fall & (1 << ch))
+    {
+      gatePin(ch, 0);
+    }
+  }
+  for (uint8_t ch = 0; ch < GATE_CHANNELS; ch++)
+  {
+    if (rise & (1 << ch))
+    {
+      gatePin(ch, 1);
+    }
+  }
+}
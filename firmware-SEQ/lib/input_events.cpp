@@ -0,0 +1,96 @@
+#pragma once
+#include <stdint.h>
+
+// Input events captured in interrupts and drained by loop()
+#define EVENT_CLOCK 0 // rising edge on the clock input
+#define EVENT_TRIG 1  // falling edge on the record trigger (CV2) , value = CV1 sampled at the edge
+
+#define EVENT_QUEUE_SIZE 128 // holds 64 ms of 1 kHz clock plus trigger edges
+
+// Record trigger thresholds on the 12 bit ADC scale , hysteresis around the old analogRead / 2048 test
+#define TRIG_HIGH_THRESHOLD 2304
+#define TRIG_LOW_THRESHOLD 1792
+
+struct InputEvent
+{
+  uint32_t us; // TC4 timer (1 MHz) at the edge , timerNow() in main
+  uint16_t value;
+  uint8_t type;
+};
+
+// Ring buffer filled by interrupts and drained by loop(). head is only written by push() and
+// tail only by pop(), both are free running and wrap with the index type.
+// push() is not reentrant. Several interrupts may push only when they run at the same NVIC
+// priority: on the Cortex-M0+ a handler never preempts one of equal priority, so the pushes
+// never interleave. In SEQ the clock input (EIC, priority 0 from attachInterrupt) and the
+// ADC handler (priority 0 set in ADC_begin) both push. Give a producer at another priority
+// its own queue.
+template <uint8_t SIZE>
+struct EventQueue
+{
+  static_assert(SIZE && (SIZE & (SIZE - 1)) == 0 && SIZE <= 128, "SIZE must be a power of two up to 128");
+
+  InputEvent events[SIZE];
+  volatile uint8_t head = 0;
+  volatile uint8_t tail = 0;
+  volatile uint16_t dropped = 0; // events lost because the queue was full
+
+  uint8_t count() const
+  {
+    return uint8_t(head - tail);
+  }
+
+  bool push(uint8_t type, uint16_t value, uint32_t us)
+  {
+    uint8_t h = head;
+    if (uint8_t(h - tail) >= SIZE)
+    {
+      dropped++;
+      return false;
+    }
+    InputEvent &event = events[h & (SIZE - 1)];
+    event.us = us;
+    event.value = value;
+    event.type = type;
+    head = h + 1; // publish after the event is complete
+    return true;
+  }
+
+  bool pop(InputEvent &event)
+  {
+    uint8_t t = tail;
+    if (t == head)
+    {
+      return false;
+    }
+    event = events[t & (SIZE - 1)];
+    tail = t + 1;
+    return true;
+  }
+};
+
+// Edge detector with hysteresis for a sampled gate/trigger signal
+struct ThresholdDetector
+{
+  uint16_t low;
+  uint16_t high;
+  bool level = false;
+
+  ThresholdDetector(uint16_t lowThreshold, uint16_t highThreshold) : low(lowThreshold), high(highThreshold) {}
+
+  // Returns 1 on a rising edge , -1 on a falling edge , 0 otherwise
+  int8_t update(uint16_t sample)
+  {
+    if (!level && sample >= high)
+    {
+      level = true;
+      return 1;
+    }
+    if (level && sample < low)
+    {
+      level = false;
+      return -1;
+    }
+    return 0;
+  }
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+#include "pattern_store.cpp"
+#include "slip.cpp"
+
+// Pattern transfer over the USB serial link
+// Requests and replies are SLIP frames holding a payload followed by its CRC-16 (low byte
+// first). The first payload byte is the command and replies start with the same byte:
+//   'V'                                  -> 'V' link version , store version , patterns , steps , settings
+//   'p' ch index                         -> 'p' ch index lastStep steps[MAX_STEPS]
+//   'P' ch index lastStep steps[MAX_STEPS] -> 'P'
+//   's'                                  -> 's' settings[PATTERN_SETTINGS]
+//   'S' settings[PATTERN_SETTINGS]       -> 'S'
+// Steps are sent as stored , 16 bit little endian. A request that can't be handled gets
+// 'E' command error , frames with a bad CRC are dropped and the host retries.
+
+#define LINK_VERSION 1
+#define LINK_INFO 'V'
+#define LINK_READ_PATTERN 'p'
+#define LINK_WRITE_PATTERN 'P'
+#define LINK_READ_SETTINGS 's'
+#define LINK_WRITE_SETTINGS 'S'
+#define LINK_ERROR 'E'
+
+#define LINK_ERR_COMMAND 1
+#define LINK_ERR_LENGTH 2
+#define LINK_ERR_RANGE 3
+
+#define LINK_INFO_SIZE 6
+#define LINK_CRC_SIZE 2
+#define LINK_PATTERN_SIZE (4 + sizeof(Pattern))
+#define LINK_MAX_FRAME (LINK_PATTERN_SIZE + LINK_CRC_SIZE)
+
+// Check the CRC of a received frame , returns the payload length or -1
+inline int linkPayload(const uint8_t *frame, uint16_t size)
+{
+  if (size <= LINK_CRC_SIZE)
+  {
+    return -1;
+  }
+  uint16_t length = size - LINK_CRC_SIZE;
+  uint16_t crc = frame[length] | frame[length + 1] << 8;
+  return crc16(frame, length) == crc ? length : -1;
+}
+
+// Append the CRC to a payload in a LINK_MAX_FRAME buffer and queue the frame
+template <uint16_t SIZE>
+bool linkSend(ByteRing<SIZE> &out, uint8_t *payload, uint16_t length)
+{
+  uint16_t crc = crc16(payload, length);
+  payload[length] = crc;
+  payload[length + 1] = crc >> 8;
+  return slipEncode(out, payload, length + LINK_CRC_SIZE);
+}
+
+inline uint16_t linkError(uint8_t *reply, uint8_t command, uint8_t error)
+{
+  reply[0] = LINK_ERROR;
+  reply[1] = command;
+  reply[2] = error;
+  return 3;
+}
+
+// Handle one request payload , writes the reply payload (at most LINK_PATTERN_SIZE bytes)
+// and returns its length. Pattern and settings writes are programmed to flash right away.
+inline uint16_t linkHandle(PatternStore &store, const uint8_t *request, uint16_t length, uint8_t *reply)
+{
+  uint8_t command = request[0];
+  reply[0] = command;
+  switch (command)
+  {
+  case LINK_INFO:
+    if (length != 1)
+    {
+      return linkError(reply, command, LINK_ERR_LENGTH);
+    }
+    reply[1] = LINK_VERSION;
+    reply[2] = PATTERN_STORE_VERSION;
+    reply[3] = PATTERNS_PER_CHANNEL;
+    reply[4] = MAX_STEPS;
+    reply[5] = PATTERN_SETTINGS;
+    return LINK_INFO_SIZE;
+
+  case LINK_READ_PATTERN:
+    if (length != 3)
+    {
+      return linkError(reply, command, LINK_ERR_LENGTH);
+    }
+    if (request[1] > 1 || request[2] >= PATTERNS_PER_CHANNEL)
+    {
+      return linkError(reply, command, LINK_ERR_RANGE);
+    }
+    reply[1] = request[1];
+    reply[2] = request[2];
+    reply[3] = store.dir.lastStep[request[1]][request[2]];
+    memcpy(reply + 4, store.pattern(request[1], request[2]), sizeof(Pattern));
+    return LINK_PATTERN_SIZE;
+
+  case LINK_WRITE_PATTERN:
+  {
+    if (length != LINK_PATTERN_SIZE)
+    {
+      return linkError(reply, command, LINK_ERR_LENGTH);
+    }
+    if (request[1] > 1 || request[2] >= PATTERNS_PER_CHANNEL || request[3] >= MAX_STEPS)
+    {
+      return linkError(reply, command, LINK_ERR_RANGE);
+    }
+    Pattern data;
+    memcpy(&data, request + 4, sizeof(Pattern));
+    for (int n = 0; n < MAX_STEPS; n++)
+    {
+      if (stepNote(data.steps[n]) > MAX_NOTE)
+      {
+        return linkError(reply, command, LINK_ERR_RANGE); // past the end of cv_qnt_out
+      }
+    }
+    store.writePattern(request[1], request[2], data, request[3]);
+    store.writeDirectory();
+    return 1;
+  }
+
+  case LINK_READ_SETTINGS:
+    if (length != 1)
+    {
+      return linkError(reply, command, LINK_ERR_LENGTH);
+    }
+    memcpy(reply + 1, store.dir.settings, PATTERN_SETTINGS);
+    return 1 + PATTERN_SETTINGS;
+
+  case LINK_WRITE_SETTINGS:
+    if (length != 1 + PATTERN_SETTINGS)
+    {
+      return linkError(reply, command, LINK_ERR_LENGTH);
+    }
+    memcpy(store.dir.settings, request + 1, PATTERN_SETTINGS);
+    store.writeDirectory();
+    return 1;
+  }
+  return linkError(reply, command, LINK_ERR_COMMAND);
+}
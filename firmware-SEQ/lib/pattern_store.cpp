@@ -0,0 +1,182 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "crc16.cpp"
+#include "steps.cpp"
+
+// Flash pattern area
+// SAMD21 flash is memory mapped, so patterns are played straight from flash. The area is
+// one directory row followed by one 256 byte row per pattern (128 packed steps):
+//   row 0         PatternDirectory (lengths, which rows hold data, settings, CRC)
+//   row 1 + n     pattern n % PATTERNS_PER_CHANNEL of channel n / PATTERNS_PER_CHANNEL
+// The only step data in RAM is the EditOverlay of the pattern being recorded.
+
+#define FLASH_ROW_SIZE 256
+#define PATTERN_ROWS (2 * PATTERNS_PER_CHANNEL)
+#define PATTERN_AREA_SIZE ((1 + PATTERN_ROWS) * FLASH_ROW_SIZE)
+#define PATTERN_STORE_MAGIC 0x5E9A
+#define PATTERN_STORE_VERSION 3
+#define PATTERN_SETTINGS 24
+
+struct PatternDirectory
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t reserved;
+  uint32_t rowValid; // bit n set when pattern row n holds recorded data
+  uint8_t lastStep[2][PATTERNS_PER_CHANNEL];
+  uint8_t settings[PATTERN_SETTINGS]; // firmware settings stored with the patterns
+  uint16_t crc;
+};
+
+static_assert(sizeof(Pattern) == FLASH_ROW_SIZE, "a pattern must fill one flash row");
+static_assert(sizeof(PatternDirectory) <= FLASH_ROW_SIZE, "the directory must fit one flash row");
+static_assert(PATTERN_ROWS <= 32, "rowValid has one bit per pattern row");
+
+// Played for patterns that were never recorded
+inline const Pattern emptyPattern = {};
+
+struct PatternStore
+{
+  const uint8_t *area = nullptr;                                     // FLASH_ROW_SIZE aligned, memory mapped
+  void (*eraseRow)(const uint8_t *row) = nullptr;                    // erase one row (all bits to 1)
+  void (*write)(const uint8_t *dst, const void *src, uint32_t size) = nullptr; // program erased flash
+  PatternDirectory dir;                                              // working copy, written back by writeDirectory()
+
+  // Attach to the flash area, returns false (and starts empty) when no valid directory is found.
+  // Only the directory is read, the patterns stay in flash.
+  bool begin(const uint8_t *flashArea, void (*eraseFn)(const uint8_t *), void (*writeFn)(const uint8_t *, const void *, uint32_t))
+  {
+    area = flashArea;
+    eraseRow = eraseFn;
+    write = writeFn;
+    memcpy(&dir, area, sizeof(dir));
+    if (dir.magic == PATTERN_STORE_MAGIC && dir.version == PATTERN_STORE_VERSION && dir.crc == directoryCRC())
+    {
+      return true;
+    }
+    memset(&dir, 0, sizeof(dir));
+    dir.magic = PATTERN_STORE_MAGIC;
+    dir.version = PATTERN_STORE_VERSION;
+    return false;
+  }
+
+  static uint8_t row(uint8_t ch, uint8_t index)
+  {
+    return ch * PATTERNS_PER_CHANNEL + index;
+  }
+
+  const uint8_t *rowAddress(uint8_t rowIndex) const
+  {
+    return area + (1 + rowIndex) * FLASH_ROW_SIZE;
+  }
+
+  // Pattern as stored in flash, read in place
+  const Pattern *pattern(uint8_t ch, uint8_t index) const
+  {
+    if (dir.rowValid & (1UL << row(ch, index)))
+    {
+      return (const Pattern *)rowAddress(row(ch, index));
+    }
+    return &emptyPattern;
+  }
+
+  // Program a pattern row. The directory is only updated in RAM until writeDirectory().
+  void writePattern(uint8_t ch, uint8_t index, const Pattern &data, uint8_t lastStep)
+  {
+    const uint8_t *address = rowAddress(row(ch, index));
+    eraseRow(address);
+    write(address, &data, sizeof(Pattern));
+    dir.rowValid |= 1UL << row(ch, index);
+    dir.lastStep[ch][index] = lastStep;
+  }
+
+  void writeDirectory()
+  {
+    dir.crc = directoryCRC();
+    eraseRow(area);
+    write(area, &dir, sizeof(dir));
+  }
+
+  uint16_t directoryCRC() const
+  {
+    return crc16(&dir, offsetof(PatternDirectory, crc));
+  }
+};
+
+// RAM copy of the steps changed in the pattern being recorded. Reads merge the written steps
+// over the flash pattern, commit() merges them into a full row and programs it.
+struct EditOverlay
+{
+  Pattern pattern;
+  uint8_t written[MAX_STEPS / 8];
+  int8_t channel = -1; // -1 = no edit in progress
+  uint8_t index = 0;
+
+  bool active() const
+  {
+    return channel >= 0;
+  }
+
+  bool matches(uint8_t ch, uint8_t patternIndex) const
+  {
+    return channel == ch && index == patternIndex;
+  }
+
+  void begin(uint8_t ch, uint8_t patternIndex)
+  {
+    channel = ch;
+    index = patternIndex;
+    memset(written, 0, sizeof(written));
+  }
+
+  bool isWritten(uint8_t n) const
+  {
+    return written[n >> 3] & (1 << (n & 7));
+  }
+
+  void write(uint8_t n, Step step)
+  {
+    pattern.steps[n] = step;
+    written[n >> 3] |= 1 << (n & 7);
+  }
+
+  Step stepAt(const Pattern *base, uint8_t n) const
+  {
+    return isWritten(n) ? pattern.steps[n] : base->steps[n];
+  }
+
+  // Fill the steps that were not written from the base pattern
+  void merge(const Pattern *base)
+  {
+    for (int n = 0; n < MAX_STEPS; n++)
+    {
+      if (!isWritten(n))
+      {
+        pattern.steps[n] = base->steps[n];
+      }
+    }
+    memset(written, 0xFF, sizeof(written));
+  }
+
+  // Program the merged pattern and its directory entry, then end the edit
+  void commit(PatternStore &store, uint8_t lastStep)
+  {
+    if (!active())
+    {
+      return;
+    }
+    merge(store.pattern(channel, index));
+    store.writePattern(channel, index, pattern, lastStep);
+    store.writeDirectory();
+    channel = -1;
+  }
+
+  // End the edit without programming it, the stored pattern was replaced
+  void discard()
+  {
+    channel = -1;
+  }
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <stdint.h>
+
+#include "scales.cpp"
+#include "steps.cpp"
+
+// Recording quantizer. The input thresholds are a uniform grid , note n covers the 10 bit ADC
+// codes 17n-8 .. 17n+8 , so the note is (code + 8) / 17 done as a multiply and shift.
+
+inline uint8_t noteFromADC(int code)
+{
+  if (code < 0)
+  {
+    code = 0;
+  }
+  if (code > 1023)
+  {
+    code = 1023;
+  }
+  uint8_t note = ((uint32_t)(code + 8) * 3856) >> 16; // 3856 / 65536 = 1 / 17 , exact for this range
+  return note > MAX_NOTE ? MAX_NOTE : note;
+}
+
+// Scales of the shared quantizer table , scaleMask() gives the 12 bit mask ScaleSnap is built from
+#define NUM_SCALES numScales
+
+// Offset to the nearest scale note for each semitone , ties go down. Built when the scale
+// changes so snapping a note is a table read.
+struct ScaleSnap
+{
+  int8_t offset[12];
+
+  void build(uint16_t mask)
+  {
+    for (int n = 0; n < 12; n++)
+    {
+      offset[n] = 0;
+      for (int distance = 0; distance <= 6; distance++)
+      {
+        if (mask & (1 << ((n + 12 - distance) % 12)))
+        {
+          offset[n] = -distance;
+          break;
+        }
+        if (mask & (1 << ((n + distance) % 12)))
+        {
+          offset[n] = distance;
+          break;
+        }
+      }
+    }
+  }
+
+  uint8_t snap(uint8_t note) const
+  {
+    int snapped = note + offset[note - 12 * ((note * 171) >> 11)]; // note % 12
+    if (snapped > MAX_NOTE)
+    {
+      snapped -= 12; // the top C may only have scale notes above it
+    }
+    return snapped < 0 ? snapped + 12 : snapped;
+  }
+};
+
+// Live transposition of played notes by CV
+#define TRANSPOSE_OFF 0
+#define TRANSPOSE_SEMITONE 1 // CV adds semitones , the result snaps to the scale
+#define TRANSPOSE_DEGREE 2   // CV moves the note along the scale
+#define NUM_TRANSPOSE_MODES 3
+const char *const transposeNames[NUM_TRANSPOSE_MODES] = {"off", "semi", "deg"};
+
+// Notes of a scale over the whole output range , built with the snap table when the scale
+// changes so a transposition costs two table reads
+struct ScaleDegrees
+{
+  uint8_t count = 0;              // scale notes from 0 to MAX_NOTE
+  uint8_t perOctave = 0;          // scale notes per octave
+  uint8_t note[MAX_NOTE + 1];     // note of each degree
+  uint8_t degree[MAX_NOTE + 1];   // degree of each note , for notes already on the scale
+
+  void build(uint16_t mask)
+  {
+    count = 0;
+    perOctave = 0;
+    for (int n = 0; n < 12; n++)
+    {
+      perOctave += (mask >> n) & 1;
+    }
+    for (int n = 0; n <= MAX_NOTE; n++)
+    {
+      if (mask & (1 << (n % 12)))
+      {
+        note[count] = n;
+        degree[n] = count++;
+      }
+      else
+      {
+        degree[n] = count ? count - 1 : 0;
+      }
+    }
+  }
+};
+
+// Played note for a stored note , amount comes from the CV quantized like a recorded note.
+// Results above the top note drop by as many octaves as needed , in one step.
+inline uint8_t transposeNote(uint8_t stored, uint8_t amount, uint8_t mode, const ScaleSnap &snap, const ScaleDegrees &degrees)
+{
+  if (stored > MAX_NOTE)
+  {
+    stored = MAX_NOTE;
+  }
+  if (amount > MAX_NOTE)
+  {
+    amount = MAX_NOTE; // noteFromADC() never gives more
+  }
+  if (mode == TRANSPOSE_SEMITONE)
+  {
+    int note = stored + amount;
+    if (note > MAX_NOTE)
+    {
+      note -= (note - MAX_NOTE + 11) / 12 * 12;
+    }
+    return snap.snap(note);
+  }
+  if (mode == TRANSPOSE_DEGREE)
+  {
+    int degree = degrees.degree[snap.snap(stored)] + amount;
+    if (degree >= degrees.count) // count holds at least one octave of degrees
+    {
+      degree -= (degree - degrees.count + degrees.perOctave) / degrees.perOctave * degrees.perOctave;
+    }
+    return degrees.note[degree];
+  }
+  return stored;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <stdint.h>
+
+// SLIP framing (RFC 1055) for the USB serial link
+// A frame is its bytes with END and ESC escaped, closed by END. The decoder takes one byte
+// at a time, so loop() can feed it whatever arrived without waiting for a whole frame.
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+// Byte ring buffer , head and tail are free running and wrap with the index type
+template <uint16_t SIZE>
+struct ByteRing
+{
+  static_assert(SIZE && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+  uint8_t bytes[SIZE];
+  uint16_t head = 0;
+  uint16_t tail = 0;
+
+  uint16_t count() const
+  {
+    return uint16_t(head - tail);
+  }
+
+  uint16_t space() const
+  {
+    return SIZE - count();
+  }
+
+  bool push(uint8_t byte)
+  {
+    if (count() >= SIZE)
+    {
+      return false;
+    }
+    bytes[head++ & (SIZE - 1)] = byte;
+    return true;
+  }
+
+  bool pop(uint8_t &byte)
+  {
+    if (head == tail)
+    {
+      return false;
+    }
+    byte = bytes[tail++ & (SIZE - 1)];
+    return true;
+  }
+};
+
+// Worst case encoded size , every byte escaped plus the leading and closing END
+#define SLIP_ENCODED_SIZE(size) (2 * (size) + 2)
+
+// Queue one frame , false (and nothing queued) when the ring could not hold the worst case
+template <uint16_t SIZE>
+bool slipEncode(ByteRing<SIZE> &out, const uint8_t *data, uint16_t size)
+{
+  if (out.space() < SLIP_ENCODED_SIZE(size))
+  {
+    return false;
+  }
+  out.push(SLIP_END); // flushes line noise in front of the frame
+  for (uint16_t n = 0; n < size; n++)
+  {
+    if (data[n] == SLIP_END)
+    {
+      out.push(SLIP_ESC);
+      out.push(SLIP_ESC_END);
+    }
+    else if (data[n] == SLIP_ESC)
+    {
+      out.push(SLIP_ESC);
+      out.push(SLIP_ESC_ESC);
+    }
+    else
+    {
+      out.push(data[n]);
+    }
+  }
+  out.push(SLIP_END);
+  return true;
+}
+
+template <uint16_t MAX_FRAME>
+struct SlipDecoder
+{
+  uint8_t frame[MAX_FRAME];
+  uint16_t length = 0;
+  bool escaped = false;
+  bool overflow = false; // the frame was too long and is dropped at its END
+
+  // Feed one byte , returns the frame length when an END closes a frame , 0 otherwise.
+  // The frame stays in frame[] until the next byte is fed.
+  uint16_t feed(uint8_t byte)
+  {
+    if (byte == SLIP_END)
+    {
+      uint16_t size = overflow ? 0 : length;
+      length = 0;
+      escaped = false;
+      overflow = false;
+      return size;
+    }
+    if (byte == SLIP_ESC)
+    {
+      escaped = true;
+      return 0;
+    }
+    if (escaped)
+    {
+      byte = byte == SLIP_ESC_END ? SLIP_END : byte == SLIP_ESC_ESC ? SLIP_ESC : byte;
+      escaped = false;
+    }
+    if (length >= MAX_FRAME)
+    {
+      overflow = true;
+      return 0;
+    }
+    frame[length++] = byte;
+    return 0;
+  }
+};
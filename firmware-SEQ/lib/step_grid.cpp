@@ -0,0 +1,135 @@
+#pragma once
+#include <stdint.h>
+
+#include "steps.cpp"
+#include "oled_pages.cpp"
+
+// Incremental drawing of the step grid on the main screen
+// A channel shows its steps in rows of 16 cells, a tall bar for a gate, a short bar for a
+// rest and nothing under the playhead. The grid remembers what each cell shows, so a clock
+// only checks the cells the playhead left and reached plus the recorded steps, and only the
+// cells that really changed are drawn and marked in the dirty pages.
+
+#define GRID_X 47
+#define GRID_COLUMNS 16
+#define GRID_CELL_PITCH 5
+#define GRID_ROW_PITCH 4
+#define GRID_CELL_TOP 2 // first pixel row of a cell below the row origin
+#define GRID_CELL_WIDTH 4
+#define GRID_CELL_HEIGHT 3
+#define GRID_WORDS (MAX_STEPS / 32)
+
+enum
+{
+  CELL_EMPTY,
+  CELL_REST,
+  CELL_GATE
+};
+
+struct StepGrid
+{
+  uint8_t top;                 // y of the channel grid
+  uint8_t shown[MAX_STEPS];    // what each cell shows in the display buffer
+  uint32_t stale[GRID_WORDS];  // cells to check on the next update
+  uint8_t playhead = 0;
+  uint8_t last = 0;            // last step of the pattern
+
+  StepGrid(uint8_t top) : top(top)
+  {
+    clear();
+  }
+
+  // The display buffer was cleared , no cell is shown and every cell needs a check
+  void clear()
+  {
+    for (int n = 0; n < MAX_STEPS; n++)
+    {
+      shown[n] = CELL_EMPTY;
+    }
+    invalidateAll();
+  }
+
+  void invalidate(uint8_t n)
+  {
+    if (n < MAX_STEPS)
+    {
+      stale[n >> 5] |= 1UL << (n & 31);
+    }
+  }
+
+  void invalidateAll()
+  {
+    for (int w = 0; w < GRID_WORDS; w++)
+    {
+      stale[w] = 0xFFFFFFFF;
+    }
+  }
+
+  // Take over the playhead and the pattern length , the cells that depend on them turn stale
+  void follow(uint8_t current, uint8_t lastStep)
+  {
+    if (current != playhead)
+    {
+      invalidate(playhead);
+      invalidate(current);
+      playhead = current;
+    }
+    if (lastStep != last)
+    {
+      uint8_t from = lastStep < last ? lastStep : last;
+      uint8_t to = lastStep < last ? last : lastStep;
+      for (int n = from + 1; n <= to; n++)
+      {
+        invalidate(n);
+      }
+      last = lastStep;
+    }
+  }
+
+  // Pop the lowest stale cell
+  bool nextStale(uint8_t &n)
+  {
+    for (int w = 0; w < GRID_WORDS; w++)
+    {
+      if (stale[w])
+      {
+        n = w * 32 + __builtin_ctzl(stale[w]);
+        stale[w] &= stale[w] - 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // State of cell n showing step
+  uint8_t state(uint8_t n, Step step) const
+  {
+    if (n > last || n == playhead)
+    {
+      return CELL_EMPTY;
+    }
+    return stepGate(step) ? CELL_GATE : CELL_REST;
+  }
+
+  uint8_t cellX(uint8_t n) const
+  {
+    return GRID_X + (n % GRID_COLUMNS) * GRID_CELL_PITCH;
+  }
+
+  uint8_t cellY(uint8_t n) const
+  {
+    return top + n / GRID_COLUMNS * GRID_ROW_PITCH + GRID_CELL_TOP;
+  }
+
+  // Returns true when cell n has to be drawn in the new state , its box is marked dirty
+  bool show(uint8_t n, uint8_t cell, DirtyPages &dirty)
+  {
+    if (shown[n] == cell)
+    {
+      return false;
+    }
+    shown[n] = cell;
+    dirty.mark(cellX(n), cellY(n), GRID_CELL_WIDTH, GRID_CELL_HEIGHT);
+    return true;
+  }
+};
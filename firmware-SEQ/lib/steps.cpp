@@ -0,0 +1,103 @@
+#pragma once
+#include <stdint.h>
+
+// Packed sequencer step, one 16bit word per step:
+//   bits 0-5  note index into cv_qnt_out (0..60)
+//   bit 6     gate
+//   bit 7     tie (gate held into the next step)
+//   bits 8-10 skip chance in 1/8ths (0 = always plays)
+//   bits 11-12 ratchets - 1 (gates evenly spread over the step)
+typedef uint16_t Step;
+
+#define STEP_NOTE_MASK 0x003F
+#define STEP_GATE 0x0040
+#define STEP_TIE 0x0080
+#define STEP_SKIP_SHIFT 8
+#define STEP_SKIP_MASK 0x0700
+#define STEP_RATCHET_SHIFT 11
+#define STEP_RATCHET_MASK 0x1800
+#define MAX_STEP_RATCHETS 4
+
+#define MAX_NOTE 60
+// The step limit stays at 128, the length the old arrays had. The 16 patterns of 128 packed
+// steps are 4 KB, more than the 512 bytes of step data they replace, so they are kept in
+// flash and played in place (pattern_store.cpp). RAM holds only the EditOverlay of the
+// pattern being recorded.
+#define MAX_STEPS 128
+#define PATTERNS_PER_CHANNEL 8
+
+inline uint8_t stepNote(Step step)
+{
+  return step & STEP_NOTE_MASK;
+}
+
+inline bool stepGate(Step step)
+{
+  return step & STEP_GATE;
+}
+
+inline bool stepTie(Step step)
+{
+  return step & STEP_TIE;
+}
+
+inline uint8_t stepSkip(Step step)
+{
+  return (step & STEP_SKIP_MASK) >> STEP_SKIP_SHIFT;
+}
+
+// 1 .. MAX_STEP_RATCHETS
+inline uint8_t stepRatchets(Step step)
+{
+  return ((step & STEP_RATCHET_MASK) >> STEP_RATCHET_SHIFT) + 1;
+}
+
+inline Step makeStep(uint8_t note, bool gate, bool tie = false, uint8_t skip = 0, uint8_t ratchets = 1)
+{
+  if (note > MAX_NOTE)
+  {
+    note = MAX_NOTE;
+  }
+  return note | (gate ? STEP_GATE : 0) | (tie ? STEP_TIE : 0) | ((skip << STEP_SKIP_SHIFT) & STEP_SKIP_MASK) |
+         (((ratchets - 1) << STEP_RATCHET_SHIFT) & STEP_RATCHET_MASK);
+}
+
+inline Step setStepNote(Step step, uint8_t note)
+{
+  if (note > MAX_NOTE)
+  {
+    note = MAX_NOTE;
+  }
+  return (step & ~STEP_NOTE_MASK) | note;
+}
+
+inline Step setStepGate(Step step, bool gate)
+{
+  return gate ? (step | STEP_GATE) : (step & ~STEP_GATE);
+}
+
+// Fast integer PRNG (xorshift32) deciding step probability at clock time
+struct StepChance
+{
+  uint32_t state = 0x2545F491;
+
+  uint32_t next()
+  {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  }
+
+  // A step with skip chance k/8 plays when 3 random bits are at least k
+  bool plays(Step step)
+  {
+    uint8_t skip = stepSkip(step);
+    return skip == 0 || (next() >> 29) >= skip;
+  }
+};
+
+struct Pattern
+{
+  Step steps[MAX_STEPS];
+};
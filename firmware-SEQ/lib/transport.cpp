@@ -0,0 +1,154 @@
+#pragma once
+#include <stdint.h>
+
+#include "steps.cpp"
+
+// Per-channel playback transport. Clock edges are counted in integers for the division , the
+// steps of the loop come from an order table that is rebuilt only when the loop points or the
+// direction change , so a clock edge never costs more than a couple of compares.
+
+#define DIR_FORWARD 0
+#define DIR_REVERSE 1
+#define DIR_PINGPONG 2
+#define DIR_RANDOM 3 // every step of the loop once per pass , in a new order each pass
+#define NUM_DIRECTIONS 4
+const char *const directionNames[NUM_DIRECTIONS] = {"FWD", "REV", "PNG", "RND"};
+
+struct Rate
+{
+  uint8_t division;       // clocks per step
+  uint8_t multiplication; // steps per clock
+};
+
+// Clock rates of the DIV menu item
+const Rate rates[] = {{1, 1}, {2, 1}, {4, 1}, {8, 1}, {16, 1}, {32, 1}, {64, 1}, {1, 2}, {1, 3}, {1, 4}};
+#define NUM_RATES (sizeof(rates) / sizeof(rates[0]))
+
+#define ORDER_SIZE (2 * MAX_STEPS - 2) // longest ping-pong pass
+
+struct Transport
+{
+  uint8_t order[ORDER_SIZE];
+  uint8_t length = 1;   // entries of order in use
+  uint8_t position = 0; // next entry of order to play
+  uint8_t current = 0;  // step played last
+  uint8_t clocks = 0;   // clock edges since the last step started
+  uint8_t start = 0;
+  uint8_t end = 0;
+  uint8_t direction = DIR_FORWARD;
+  uint32_t rng = 0x9E3779B9;
+
+  Transport()
+  {
+    build();
+  }
+
+  // Loop points (inclusive) and direction
+  void configure(uint8_t loopStart, uint8_t loopEnd, uint8_t dir)
+  {
+    if (loopEnd >= MAX_STEPS)
+    {
+      loopEnd = MAX_STEPS - 1;
+    }
+    if (loopStart > loopEnd)
+    {
+      loopStart = loopEnd;
+    }
+    if (loopStart == start && loopEnd == end && dir == direction)
+    {
+      return;
+    }
+    start = loopStart;
+    end = loopEnd;
+    direction = dir;
+    build();
+    if (position >= length)
+    {
+      position = 0;
+    }
+  }
+
+  void reset()
+  {
+    position = 0;
+    clocks = 0;
+  }
+
+  // Clock edge , returns true when a new step starts
+  bool clock(uint8_t division)
+  {
+    bool due = clocks == 0;
+    if (++clocks >= division)
+    {
+      clocks = 0;
+    }
+    return due;
+  }
+
+  // Step to play , moves the playhead
+  uint8_t next()
+  {
+    if (position == 0 && direction == DIR_RANDOM)
+    {
+      shuffle();
+    }
+    current = order[position];
+    if (++position >= length)
+    {
+      position = 0;
+    }
+    return current;
+  }
+
+  void build()
+  {
+    length = 0;
+    switch (direction)
+    {
+    case DIR_REVERSE:
+      for (int n = end; n >= start; n--)
+      {
+        order[length++] = n;
+      }
+      break;
+
+    case DIR_PINGPONG:
+      for (int n = start; n <= end; n++)
+      {
+        order[length++] = n;
+      }
+      for (int n = end - 1; n > start; n--)
+      { // the ends are not repeated
+        order[length++] = n;
+      }
+      break;
+
+    default: // forward , random is shuffled at the start of each pass
+      for (int n = start; n <= end; n++)
+      {
+        order[length++] = n;
+      }
+      break;
+    }
+  }
+
+  uint32_t random()
+  {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+  }
+
+  // Fisher-Yates , multiply-shift instead of a modulo
+  void shuffle()
+  {
+    for (uint8_t n = length - 1; n > 0; n--)
+    {
+      uint8_t k = ((random() & 0xFFFF) * (n + 1)) >> 16;
+      uint8_t swap = order[n];
+      order[n] = order[k];
+      order[k] = swap;
+    }
+  }
+};
@@ -1,28 +1,56 @@
 #include <Arduino.h>
 #include <Wire.h>
 #include <Encoder.h>
+#include <wiring_private.h>
 
-#include <FlashAsEEPROM.h>
+#include <FlashStorage.h>
 #include <Adafruit_SSD1306.h>
 #include <Adafruit_GFX.h>
 
-// Display setting
-#define OLED_ADDRESS 0x3C
-#define SCREEN_WIDTH 128
-#define SCREEN_HEIGHT 64
+// Load local libraries, pins and outputs from ../shared/hal.h
+#include "hal.h"
+#include "steps.cpp"
+#include "pattern_store.cpp"
+#include "gate_outputs.cpp"
+#include "input_events.cpp"
+#include "transport.cpp"
+#include "quantize.cpp"
+#include "oled_pages.cpp"
+#include "step_grid.cpp"
+#include "pattern_link.cpp"
 
 // rotary encoder setting
 #define ENCODER_OPTIMIZE_INTERRUPTS // counter measure of noise
 
-#define ENC_PIN_1 3      // rotary encoder left pin
-#define ENC_PIN_2 6      // rotary encoder right pin
-#define CLK_PIN 7        // Clock input pin
-#define CV_1_IN_PIN 8    // channel 1 analog in
-#define CV_2_IN_PIN 9    // channel 2 analog in
-#define ENC_CLICK_PIN 10 // pin for encoder switch
-#define ENV_OUT_PIN_1 1
-#define ENV_OUT_PIN_2 2
-#define DAC_INTERNAL_PIN A0
+// Declare function prototypes
+void OLED_display();
+void OLED_settings();
+void OLED_grid();
+void updateGrid(byte);
+void flushDirtyPages();
+void printSetting(int, byte);
+void armGateTimer();
+void selectPattern(byte, byte);
+Step seqStep(byte, byte);
+void recStep(byte, byte, Step);
+void commitEdit();
+void clockEdge(uint32_t);
+void gateOpen(byte, uint32_t, bool, byte = 0, uint32_t = 0);
+void playStep(byte);
+void printRate(byte);
+void buildScales();
+void gateClose(byte);
+void timerBegin();
+uint32_t timerNow();
+void recordTrigger(uint16_t);
+void onClock();
+void ADC_begin();
+void load();
+void save();
+void storeSettings();
+void applySettings();
+void serviceLink();
+void linkRequest(uint16_t);
 
 ////////////////////////////////////////////
 // ADC calibration. Change these according to your resistor values to make readings more accurate
@@ -40,23 +68,18 @@ float newPosition = -999;            // rotary encoder library setting
 int i = 0;
 bool SW = 0;
 bool old_SW = 0;
-bool CLK_in = 0;
-bool old_CLK_in = 0;
-int gate_timer1 = 0;
-int gate_timer2 = 0;
+GateScheduler gates; // gate ends are emitted by the TC4 compare interrupt
 
 float AD_CH1 = 0;
 float AD_CH2 = 0;
 
 // menu setting
-byte menu = 1;  // 1=ch1 rec/play , 2=ch1 divide , 3 = reset , 4~6 =ch2 , 7 = MUTE ch1 , 8 = STOP ch1 , 9~10 ch2, 11 = save
-bool mode1 = 1; // 0 =rec , 1 =play
-bool mode2 = 1; // 0 =rec , 1 =play
+byte menu = 1;  // 1=ch1 rec/play , 2=ch1 divide , 3 = reset , 4~6 =ch2 , 7 = MUTE ch1 , 8 = STOP ch1 , 9~10 ch2, 11 = save , 12~ = channel settings
+byte mode1 = 1; // 0 =rec , 1 =play , 2 =overdub (play and replace notes at the playhead)
+byte mode2 = 1; // 0 =rec , 1 =play , 2 =overdub (play and replace notes at the playhead)
 
-const byte div_ch1[7] = {1, 2, 4, 8, 16, 32, 64}; // divide rate
-const byte div_ch2[7] = {1, 2, 4, 8, 16, 32, 64}; // divide rate
-byte select_div_ch1 = 0;
-byte select_div_ch2 = 0;
+byte select_div_ch1 = 0; // index in rates
+byte select_div_ch2 = 0; // index in rates
 
 // CV setting
 const int cv_qnt_out[61] = {
@@ -66,17 +89,72 @@ const int cv_qnt_out[61] = {
     2458, 2526, 2594, 2662, 2731, 2799, 2867, 2935, 3004, 3072, 3140, 3209,
     3277, 3345, 3413, 3482, 3550, 3618, 3686, 3755, 3823, 3891, 3959, 4028, 4095}; // output pre-quantize
 
-const int cv_qnt_thr[62] = {
-    0, 9, 26, 43, 60, 77, 94, 111, 128, 145, 162, 179, 196, 213, 230, 247, 264, 281, 298, 315, 332, 349, 366, 383, 400, 417, 434, 451, 468, 485, 502, 519, 536, 553, 570, 587, 604, 621, 638, 655, 672, 689, 706, 723, 740, 757, 774, 791, 808, 825, 842, 859, 876, 893, 910, 927, 944, 961, 978, 995, 1012, 1024}; // input quantize
-
-byte search_qnt = 0;
 byte rec_step = 0;
 
-// Initialize settings
-byte stepcv_ch1[128] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-byte stepcv_ch2[128] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-bool stepgate_ch1[128] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-bool stepgate_ch2[128] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+// Patterns are played in place from this flash area. The only step data in RAM is the
+// overlay of the pattern being recorded , it is programmed on SAVE or when another pattern
+// starts recording.
+__attribute__((__aligned__(FLASH_ROW_SIZE))) static const uint8_t pattern_flash[PATTERN_AREA_SIZE] = {};
+FlashClass flash;
+PatternStore patterns;
+EditOverlay edit;
+byte pattern_ch1 = 0;      // pattern playing
+byte pattern_ch2 = 0;      // pattern playing
+byte next_pattern_ch1 = 0; // pattern selected in the menu, takes over on the next clock
+byte next_pattern_ch2 = 0; // pattern selected in the menu, takes over on the next clock
+
+// Channel settings page, one row per setting with a column for each channel
+#define MENU_SETTINGS 12 // first menu item of the settings page
+#define SETTING_PATTERN 0
+#define SETTING_GATE 1
+#define SETTING_LEGATO 2
+#define SETTING_DIRECTION 3
+#define SETTING_LOOP_START 4
+#define SETTING_LOOP_END 5
+#define SETTING_SCALE 6
+#define SETTING_TRANSPOSE 7
+#define SETTING_PROBABILITY 8
+#define SETTING_RATCHETS 9
+#define NUM_SETTINGS 10
+#define SETTING_ROWS 6 // rows that fit below the header , the page scrolls
+byte gate_length_ch1 = DEFAULT_GATE_LENGTH; // index in gateLengths
+byte gate_length_ch2 = DEFAULT_GATE_LENGTH; // index in gateLengths
+byte legato_ch1 = 0;                        // 1 = consecutive gated steps share one gate
+byte legato_ch2 = 0;                        // 1 = consecutive gated steps share one gate
+byte direction_ch1 = DIR_FORWARD;
+byte direction_ch2 = DIR_FORWARD;
+byte loop_start_ch1 = 0; // first step of the loop
+byte loop_start_ch2 = 0; // first step of the loop
+byte loop_end_ch1 = 0;   // last step of the loop counted from 1 , 0 = last recorded step
+byte loop_end_ch2 = 0;   // last step of the loop counted from 1 , 0 = last recorded step
+byte scale_ch1 = 0; // index in scaleNames , recorded notes snap to it
+byte scale_ch2 = 0; // index in scaleNames , recorded notes snap to it
+byte transpose_ch1 = TRANSPOSE_OFF; // CV1 transposes the playing sequence
+byte transpose_ch2 = TRANSPOSE_OFF; // CV1 transposes the playing sequence
+byte probability_ch1 = 7; // play chance of recorded steps in 1/8ths - 1 , 7 = always
+byte probability_ch2 = 7; // play chance of recorded steps in 1/8ths - 1 , 7 = always
+byte ratchets_ch1 = 0;    // gates per recorded step - 1
+byte ratchets_ch2 = 0;    // gates per recorded step - 1
+StepChance chance;        // rolls step probability at clock time
+ScaleSnap snap_ch1;
+ScaleSnap snap_ch2;
+ScaleDegrees degrees_ch1;
+ScaleDegrees degrees_ch2;
+const char *settingNames[NUM_SETTINGS] = {"PAT", "GATE", "LEG", "DIR", "STRT", "END", "SCL", "TRN", "PROB", "RAT"};
+const byte settingMax[NUM_SETTINGS] = {PATTERNS_PER_CHANNEL - 1, NUM_GATE_LENGTHS - 1, 1, NUM_DIRECTIONS - 1, MAX_STEPS - 1, MAX_STEPS, NUM_SCALES - 1, NUM_TRANSPOSE_MODES - 1, 7, MAX_STEP_RATCHETS - 1};
+byte *settingValues[NUM_SETTINGS][2] = {
+    {&next_pattern_ch1, &next_pattern_ch2},
+    {&gate_length_ch1, &gate_length_ch2},
+    {&legato_ch1, &legato_ch2},
+    {&direction_ch1, &direction_ch2},
+    {&loop_start_ch1, &loop_start_ch2},
+    {&loop_end_ch1, &loop_end_ch2},
+    {&scale_ch1, &scale_ch2},
+    {&transpose_ch1, &transpose_ch2},
+    {&probability_ch1, &probability_ch2},
+    {&ratchets_ch1, &ratchets_ch2}};
+int const menuItems = MENU_SETTINGS + 2 * NUM_SETTINGS - 1;
+bool edit_setting = 0; // 1 = encoder changes the selected setting
 
 bool mute_ch1 = 0;     // 0=not mute , 1=mute
 bool mute_ch2 = 0;     // 0=not mute , 1=mute
@@ -85,55 +163,97 @@ bool stop_ch2 = 0;     // 0=not stop , 1=stop
 byte max_step_ch1 = 1; // count step input number
 byte max_step_ch2 = 1; // count step input number
 
-float step_ch1 = 1;
-byte step_ch1_play = 1;
-float step_ch2 = 1;
-byte step_ch2_play = 1;
-
-bool CV_in1 = 0;     // record CV input or CH1 output trigger
-bool CV_in2 = 0;     // record TRIG input or CH2 output trigger
-bool old_CV_in1 = 0; // for detect trig ON
-bool old_CV_in2 = 0; // for detect trig ON
+// Playback transport per channel , loop points and direction come from the settings page
+Transport transport_ch1;
+Transport transport_ch2;
+byte substeps[2] = {0, 0};   // steps left of a multiplied clock
+uint32_t substep_at[2];      // timer time of the next of them
+
+// Input capture , clock edges from the pin interrupt and trigger edges from the ADC interrupt
+EventQueue<EVENT_QUEUE_SIZE> events;
+ThresholdDetector trig_detector(TRIG_LOW_THRESHOLD, TRIG_HIGH_THRESHOLD);
+volatile uint16_t cv1_sample = 0;
+volatile bool adc_cv2 = 0; // 0 = converting CV1 , 1 = converting CV2
+uint32_t last_clock_us = 0;
+uint32_t clock_period_us = 0; // 0 = not measured yet
+bool clock_seen = 0;
 
 // display
-byte disp_step1 = 0;
-byte disp_step2 = 0;
 bool disp_refresh = 1; // 0=not refresh display , 1= refresh display , countermeasure of display refresh busy
+bool grid_refresh = 0; // 1 = only the step grids changed , redrawn cell by cell
+DirtyPages dirtyPages;
+StepGrid grid_ch1(0);
+StepGrid grid_ch2(32);
+
+// USB serial pattern link , requests are taken a few bytes per loop so playback keeps going
+#define LINK_TX_SIZE 1024      // holds the largest reply SLIP encoded
+#define LINK_BYTES_PER_LOOP 64 // received bytes fed to the decoder per loop
+SlipDecoder<LINK_MAX_FRAME> link_rx;
+ByteRing<LINK_TX_SIZE> link_tx;
+uint8_t link_reply[LINK_MAX_FRAME];
 
 //-------------------------------Initial setting--------------------------
 void setup()
 {
-  analogWriteResolution(10);
-  analogReadResolution(12);
-  pinMode(CLK_PIN, INPUT_PULLDOWN);     // CLK in
+  halBegin();
+  pinMode(CLK_IN_PIN, INPUT_PULLDOWN);     // CLK in
   pinMode(CV_1_IN_PIN, INPUT);          // IN1
   pinMode(CV_2_IN_PIN, INPUT);          // IN2
   pinMode(ENC_CLICK_PIN, INPUT_PULLUP); // push sw
+  gatesBegin();                         // gates off before the pins drive
   pinMode(ENV_OUT_PIN_1, OUTPUT);       // CH1 gate out
   pinMode(ENV_OUT_PIN_2, OUTPUT);       // CH2 gate out
 
-  // Load settings from EEPROM
+  // Load patterns and settings from flash
   load();
+  buildScales();
 
   // OLED initialize
-  display.begin(SSD1306_SWITCHCAPVCC, 0x3C);
-  display.clearDisplay();
+  displayBegin(display);
 
-  // I2C connect
+  // I2C connect , fast mode keeps display redraws short
   Wire.begin();
+  Wire.setClock(400000);
+
+  // USB serial for the pattern link
+  Serial.begin(115200);
+
+  // Input capture and gate timing
+  timerBegin();
+  ADC_begin();
+  attachInterrupt(digitalPinToInterrupt(CLK_IN_PIN), onClock, RISING);
 }
 
 void loop()
 {
   old_SW = SW;
-  old_CV_in1 = CV_in1;
-  old_CV_in2 = CV_in2;
-  old_CLK_in = CLK_in;
 
   //-------------------------------rotary endoder--------------------------
   newPosition = myEnc.read();
 
-  if (mode1 == 1 && mode2 == 1)
+  if (mode1 != 0 && mode2 != 0 && edit_setting == 1)
+  { // change the selected channel setting
+    byte *value = settingValues[(menu - MENU_SETTINGS) / 2][(menu - MENU_SETTINGS) % 2];
+    byte max_value = settingMax[(menu - MENU_SETTINGS) / 2];
+    if ((newPosition - 3) / 4 > oldPosition / 4)
+    { // 4 is resolution of encoder
+      oldPosition = newPosition;
+      *value = *value > 0 ? *value - 1 : 0;
+      disp_refresh = 1;
+    }
+    else if ((newPosition + 3) / 4 < oldPosition / 4)
+    { // 4 is resolution of encoder
+      oldPosition = newPosition;
+      *value = *value < max_value ? *value + 1 : max_value;
+      disp_refresh = 1;
+    }
+    if (value == &scale_ch1 || value == &scale_ch2)
+    {
+      buildScales();
+    }
+  }
+
+  else if (mode1 != 0 && mode2 != 0)
   { // menu select
     if ((newPosition - 3) / 4 > oldPosition / 4)
     { // 4 is resolution of encoder
@@ -148,7 +268,7 @@ void loop()
       i = i + 1;
       disp_refresh = 1;
     }
-    i = constrain(i, 1, 10);
+    i = constrain(i, 1, menuItems);
     menu = i;
   }
 
@@ -176,20 +296,19 @@ void loop()
       oldPosition = newPosition;
 
       if (mode1 == 0)
-      {                             // CH1 REC
-        stepgate_ch1[rec_step] = 0; // while REC , turn right set rest
-        stepcv_ch1[rec_step] = stepcv_ch1[rec_step - 1];
+      { // CH1 REC , turn right set rest keeping the previous note
+        recStep(1, rec_step, makeStep(rec_step > 0 ? stepNote(seqStep(1, rec_step - 1)) : 0, 0));
         max_step_ch1 = rec_step;
       }
 
       else if (mode2 == 0)
-      {                             // CH2 REC
-        stepgate_ch2[rec_step] = 0; // while REC , turn right set rest
-        stepcv_ch2[rec_step] = stepcv_ch2[rec_step - 1];
+      { // CH2 REC , turn right set rest keeping the previous note
+        recStep(2, rec_step, makeStep(rec_step > 0 ? stepNote(seqStep(2, rec_step - 1)) : 0, 0));
         max_step_ch2 = rec_step;
       }
 
       rec_step++; // while REC , turn right rest step
+      rec_step = constrain(rec_step, 0, MAX_STEPS - 1);
       disp_refresh = 1;
     }
   }
@@ -202,57 +321,60 @@ void loop()
     switch (menu)
     {
     case 1:
-      mode1 = !mode1; // rec <-> play change
+      mode1 = mode1 == 1 ? 0 : mode1 == 0 ? 2 : 1; // play -> rec -> overdub -> play
       if (mode1 == 0)
       {               // when play to rec
         rec_step = 0; // reset rec_step
         max_step_ch1 = rec_step;
       }
-      if (mode1 == 1)
-      {               // when rec to play
-        step_ch1 = 0; // reset play step
+      if (mode1 == 2)
+      { // when rec to overdub
+        transport_ch1.reset();
+        substeps[0] = 0;
       }
       break;
 
     case 2:
       select_div_ch1++;
-      step_ch1 = 0;
-      if (select_div_ch1 > 6)
+      transport_ch1.clocks = 0;
+      if (select_div_ch1 >= NUM_RATES)
       {
         select_div_ch1 = 0;
       }
       break;
 
     case 3:
-      step_ch1_play = 0; // reset count
-      step_ch1 = 0;      // reset count
+      transport_ch1.reset();
+      substeps[0] = 0;
       break;
 
     case 4:
-      mode2 = !mode2;
+      mode2 = mode2 == 1 ? 0 : mode2 == 0 ? 2 : 1;
       if (mode2 == 0)
       {               // when play to rec
         rec_step = 0; // reset rec_step
         max_step_ch2 = rec_step;
       }
-      if (mode2 == 1)
-      {               // when rec to play
-        step_ch2 = 0; // reset play step
+      if (mode2 == 2)
+      { // when rec to overdub
+        transport_ch2.reset();
+        substeps[1] = 0;
       }
 
       break;
 
     case 5:
       select_div_ch2++;
-      if (select_div_ch2 > 6)
+      transport_ch2.clocks = 0;
+      if (select_div_ch2 >= NUM_RATES)
       {
         select_div_ch2 = 0;
       }
       break;
 
     case 6:
-      step_ch2_play = 0; // reset count
-      step_ch2 = 0;      // reset count
+      transport_ch2.reset();
+      substeps[1] = 0;
       break;
 
     case 7:
@@ -273,183 +395,457 @@ void loop()
 
     case 11:
       save();
+      break;
+
+    default: // channel settings , push to start / stop editing
+      edit_setting = !edit_setting;
+      break;
+    }
+  }
+  //-------------------------------INPUT EVENTS--------------------------
+  // clock and record trigger edges are captured in interrupts , handled here in order
+  InputEvent event;
+  while (events.pop(event))
+  {
+    if (event.type == EVENT_CLOCK)
+    {
+      clockEdge(event.us);
+    }
+    else
+    {
+      recordTrigger(event.value);
     }
   }
-  //-------------------------------CH1 REC--------------------------
 
-  if (mode1 == 0)
+  // multiplied clock rates , the extra steps are spread over the measured clock period
+  for (byte ch = 1; ch <= 2; ch++)
   {
-    // when mode is REC and trig in
-    CV_in2 = analogRead(CV_2_IN_PIN) / 2048; // 0 or 1
+    const Rate &rate = rates[ch == 1 ? select_div_ch1 : select_div_ch2];
+    uint32_t interval = clock_period_us / rate.multiplication;
+    if (substeps[ch - 1] > 0 && int32_t(timerNow() - (substep_at[ch - 1] + interval)) >= 0)
+    {
+      substeps[ch - 1]--;
+      substep_at[ch - 1] += interval;
+      playStep(ch);
+      grid_refresh = 1;
+    }
+  }
 
-    if (old_CV_in2 == 1 && CV_in2 == 0)
-    { // when trigger fall , record CV input
+  serviceLink();
 
-      // analog read and quantize
-      AD_CH1 = analogRead(CV_1_IN_PIN) / 4 * AD_CH1_calb; // 12bit to 10bit
-      for (search_qnt = 0; search_qnt <= 61; search_qnt++)
-      { // quantize
-        if (AD_CH1 >= cv_qnt_thr[search_qnt] && AD_CH1 < cv_qnt_thr[search_qnt + 1])
-        {
-          stepcv_ch1[rec_step] = search_qnt;
-        }
-      }
-      stepgate_ch1[rec_step] = 1;
-      max_step_ch1 = rec_step;
-
-      // Check the input CV
-      intDAC(cv_qnt_out[stepcv_ch1[rec_step]]); // OUTPUT internal DAC
-      digitalWrite(ENV_OUT_PIN_1, LOW);         // because LOW active , LOW is output
-      delay(5);                                 // gate time 5msec
-      digitalWrite(ENV_OUT_PIN_1, HIGH);
-
-      // add step
-      rec_step++;
-      rec_step = constrain(rec_step, 0, 127);
-      disp_refresh = 1;
-    }
+  if (disp_refresh == 1)
+  {
+    OLED_display(); // refresh display
+    disp_refresh = 0;
+    grid_refresh = 0;
+  }
+  else if (grid_refresh == 1)
+  {
+    OLED_grid(); // only the changed step cells
+    grid_refresh = 0;
+  }
+}
+
+//-----------------------------INPUT EVENTS----------------------------------------
+// Record trigger fell , cv is CV1 sampled by the ADC interrupt at that moment
+void recordTrigger(uint16_t cv)
+{
+  //-------------------------------CH1 REC--------------------------
+  if (mode1 == 0)
+  {
+    // quantize the CV sampled at the trigger fall , then snap it to the channel scale
+    AD_CH1 = cv / 4 * AD_CH1_calb; // 12bit to 10bit
+    recStep(1, rec_step, makeStep(snap_ch1.snap(noteFromADC(AD_CH1)), 1, false, 7 - probability_ch1, ratchets_ch1 + 1));
+    max_step_ch1 = rec_step;
+
+    // Check the input CV
+    intDAC(cv_qnt_out[stepNote(seqStep(1, rec_step))]); // OUTPUT internal DAC
+    gateOpen(1, REC_MONITOR_GATE_US, false);
+
+    // add step
+    rec_step++;
+    rec_step = constrain(rec_step, 0, MAX_STEPS - 1);
+    grid_refresh = 1;
   }
   //-------------------------------CH2 REC--------------------------
   if (mode2 == 0)
   {
-    // when mode is REC and trig in
-    CV_in2 = analogRead(CV_2_IN_PIN) / 2048; // 0 or 1
+    // quantize the CV sampled at the trigger fall , then snap it to the channel scale
+    AD_CH2 = cv / 4 * AD_CH1_calb; // 12bit to 10bit
+    recStep(2, rec_step, makeStep(snap_ch2.snap(noteFromADC(AD_CH2)), 1, false, 7 - probability_ch2, ratchets_ch2 + 1));
+    max_step_ch2 = rec_step;
+
+    // Check the input CV
+    MCP(cv_qnt_out[stepNote(seqStep(2, rec_step))]); // OUTPUT MCP4725
+    gateOpen(2, REC_MONITOR_GATE_US, false);
+
+    // add step
+    rec_step++;
+    rec_step = constrain(rec_step, 0, MAX_STEPS - 1);
+    grid_refresh = 1;
+  }
+  //-------------------------------OVERDUB--------------------------
+  // replace the step under the playhead , the loop keeps running
+  if (mode1 == 2)
+  {
+    AD_CH1 = cv / 4 * AD_CH1_calb; // 12bit to 10bit
+    recStep(1, transport_ch1.current, makeStep(snap_ch1.snap(noteFromADC(AD_CH1)), 1, false, 7 - probability_ch1, ratchets_ch1 + 1));
+    intDAC(cv_qnt_out[stepNote(seqStep(1, transport_ch1.current))]); // OUTPUT internal DAC
+    grid_refresh = 1;
+  }
+  if (mode2 == 2)
+  {
+    AD_CH2 = cv / 4 * AD_CH1_calb; // 12bit to 10bit
+    recStep(2, transport_ch2.current, makeStep(snap_ch2.snap(noteFromADC(AD_CH2)), 1, false, 7 - probability_ch2, ratchets_ch2 + 1));
+    MCP(cv_qnt_out[stepNote(seqStep(2, transport_ch2.current))]); // OUTPUT MCP4725
+    grid_refresh = 1;
+  }
+}
 
-    if (old_CV_in2 == 1 && CV_in2 == 0)
-    { // when trigger fall , record CV input
+// Clock rising edge at timer time us
+void clockEdge(uint32_t us)
+{
+  grid_refresh = 1;
 
-      // analog read and quantize
-      AD_CH2 = analogRead(CV_1_IN_PIN) / 4 * AD_CH1_calb; // 12bit to 10bit
-      for (search_qnt = 0; search_qnt <= 61; search_qnt++)
-      { // quantize
-        if (AD_CH2 >= cv_qnt_thr[search_qnt] && AD_CH2 < cv_qnt_thr[search_qnt + 1])
-        {
-          stepcv_ch2[rec_step] = search_qnt;
-        }
-      }
-      stepgate_ch2[rec_step] = 1;
-      max_step_ch2 = rec_step;
-
-      // Check the input CV
-      MCP(cv_qnt_out[stepcv_ch2[rec_step]]); // OUTPUT internal DAC
-      digitalWrite(ENV_OUT_PIN_2, LOW);      // because LOW active , LOW is output
-      delay(5);
-      digitalWrite(ENV_OUT_PIN_2, HIGH);
-
-      // add step
-      rec_step++;
-      rec_step = constrain(rec_step, 0, 127);
-      disp_refresh = 1;
-    }
+  // measure the clock period for gate lengths in % , a pause over 4s restarts the measurement
+  if (clock_seen && us - last_clock_us < 4000000)
+  {
+    clock_period_us = us - last_clock_us;
   }
+  last_clock_us = us;
+  clock_seen = 1;
 
-  //-------------------------------OUTPUT SETTING--------------------------
-
-  CLK_in = digitalRead(CLK_PIN);
-  if (old_CLK_in == 0 && CLK_in == 1)
+  // pattern change takes over on the clock
+  if (next_pattern_ch1 != pattern_ch1 && mode1 != 0)
   {
-    disp_refresh = 1;
+    selectPattern(1, next_pattern_ch1);
+  }
+  if (next_pattern_ch2 != pattern_ch2 && mode2 != 0)
+  {
+    selectPattern(2, next_pattern_ch2);
+  }
 
-    if (mode1 == 1 && stop_ch1 != 1)
-    {                                                // CH1 output
-      intDAC(cv_qnt_out[stepcv_ch1[step_ch1_play]]); // OUTPUT internal DAC
-      if ((stepgate_ch1[step_ch1_play] == 1) && (step_ch1 == 0) && (mute_ch1 == 0))
-      {
-        gate_timer1 = millis();
-        digitalWrite(ENV_OUT_PIN_1, LOW); // because LOW active , LOW is output
-      }
-      else if (stepgate_ch1[step_ch1_play] == 0)
-      {
-        digitalWrite(ENV_OUT_PIN_1, HIGH); // because LOW active , HIGH is no output
-      }
-      step_ch1++;
-      //      step_ch2++;
-      if (step_ch1 >= div_ch1[select_div_ch1])
-      {
-        step_ch1_play++;
-        step_ch1 = 0;
-      }
-      if (step_ch1_play > max_step_ch1)
-      {
-        step_ch1_play = 0;
-      }
-    }
+  // loop points follow the recorded length unless an end is set , rebuilt only on a change
+  transport_ch1.configure(loop_start_ch1, loop_end_ch1 ? constrain(loop_end_ch1 - 1, 0, max_step_ch1) : max_step_ch1, direction_ch1);
+  transport_ch2.configure(loop_start_ch2, loop_end_ch2 ? constrain(loop_end_ch2 - 1, 0, max_step_ch2) : max_step_ch2, direction_ch2);
 
-    if (mode2 == 1 && stop_ch2 != 1)
-    {                                             // CH2 output
-      MCP(cv_qnt_out[stepcv_ch2[step_ch2_play]]); // OUTPUT MCP4725
-      if ((stepgate_ch2[step_ch2_play] == 1) && (step_ch2 == 0) && (mute_ch2 == 0))
-      {
-        gate_timer2 = millis();
-        digitalWrite(ENV_OUT_PIN_2, LOW); // because LOW active , LOW is output
-      }
-      else if (stepgate_ch1[step_ch1_play] == 0)
-      {
-        digitalWrite(ENV_OUT_PIN_2, HIGH); // because LOW active , HIGH is no output
-      }
-      //      step_ch1++;
-      step_ch2++;
-      if (step_ch2 >= div_ch2[select_div_ch2])
-      {
-        step_ch2_play++;
-        step_ch2 = 0;
-      }
-      if (step_ch2_play > max_step_ch2)
-      {
-        step_ch2_play = 0;
-      }
-    }
+  if (mode1 != 0 && stop_ch1 != 1 && transport_ch1.clock(rates[select_div_ch1].division))
+  { // CH1 output
+    playStep(1);
+    substeps[0] = clock_period_us ? rates[select_div_ch1].multiplication - 1 : 0;
+    substep_at[0] = us;
   }
 
-  if (gate_timer1 + 10 >= millis())
-  {                                   // gate ON time is 10msec
-    digitalWrite(ENV_OUT_PIN_1, LOW); // because LOW active , HIGH is no output
+  if (mode2 != 0 && stop_ch2 != 1 && transport_ch2.clock(rates[select_div_ch2].division))
+  { // CH2 output
+    playStep(2);
+    substeps[1] = clock_period_us ? rates[select_div_ch2].multiplication - 1 : 0;
+    substep_at[1] = us;
+  }
+}
+
+// Scale tables for recording and transposition , rebuilt when a scale changes
+void buildScales()
+{
+  uint16_t mask_ch1 = scaleMask(scale_ch1);
+  uint16_t mask_ch2 = scaleMask(scale_ch2);
+  snap_ch1.build(mask_ch1);
+  snap_ch2.build(mask_ch2);
+  degrees_ch1.build(mask_ch1);
+  degrees_ch2.build(mask_ch2);
+}
+
+// Play the next step of a channel's transport
+void playStep(byte ch)
+{
+  Transport &transport = ch == 1 ? transport_ch1 : transport_ch2;
+  const Rate &rate = rates[ch == 1 ? select_div_ch1 : select_div_ch2];
+  Step step = seqStep(ch, transport.next());
+
+  // CV1 transposes the stored note , then a single lookup gives the output
+  byte transpose = ch == 1 ? transpose_ch1 : transpose_ch2;
+  byte note = stepNote(step);
+  if (transpose != TRANSPOSE_OFF)
+  {
+    int amount = cv1_sample / 4 * AD_CH1_calb; // 12bit to 10bit
+    note = transposeNote(note, noteFromADC(amount), transpose, ch == 1 ? snap_ch1 : snap_ch2, ch == 1 ? degrees_ch1 : degrees_ch2);
+  }
+  if (ch == 1)
+  {
+    intDAC(cv_qnt_out[note]); // OUTPUT internal DAC
   }
   else
   {
-    digitalWrite(ENV_OUT_PIN_1, HIGH);
+    MCP(cv_qnt_out[note]); // OUTPUT MCP4725
   }
 
-  if (gate_timer2 + 10 >= millis())
-  {                                   // gate ON time is 10msec
-    digitalWrite(ENV_OUT_PIN_2, LOW); // because LOW active , HIGH is no output
+  if (stepGate(step) && !(ch == 1 ? mute_ch1 : mute_ch2) && chance.plays(step))
+  { // tie or legato hold the gate into the next step , ratchets split the step evenly
+    uint32_t period = clock_period_us * rate.division / rate.multiplication;
+    byte count = period ? ratchetsFitting(stepRatchets(step), period) : 1;
+    uint32_t length = gateLengthUs(gateLengths[ch == 1 ? gate_length_ch1 : gate_length_ch2], period / count);
+    gateOpen(ch, length, count == 1 && (stepTie(step) || (ch == 1 ? legato_ch1 : legato_ch2)), count - 1, period / count);
   }
   else
   {
-    digitalWrite(ENV_OUT_PIN_2, HIGH);
+    gateClose(ch);
   }
+}
 
-  if (disp_refresh == 1)
+//-----------------------------GATES----------------------------------------
+// Gates rise here together with the CV update and end in the compare interrupt ,
+// which also raises the ratchet repeats every interval
+void gateOpen(byte ch, uint32_t length, bool hold, byte ratchets, uint32_t interval)
+{
+  noInterrupts();
+  openGate(gates, ch - 1, timerNow(), length, hold, ratchets, interval);
+  armGateTimer();
+  interrupts();
+}
+
+void gateClose(byte ch)
+{
+  noInterrupts();
+  closeGate(gates, ch - 1);
+  armGateTimer();
+  interrupts();
+}
+
+// Load CC0 with the next gate end , called with interrupts disabled or from TC4_Handler
+void armGateTimer()
+{
+  uint32_t deadline;
+  if (!gates.nextDeadline(timerNow(), deadline))
   {
-    OLED_display(); // refresh display
-    disp_refresh = 0;
+    TC4->COUNT32.INTENCLR.reg = TC_INTENCLR_MC0;
+    return;
+  }
+  TC4->COUNT32.CC[0].reg = deadline;
+  while (TC4->COUNT32.STATUS.bit.SYNCBUSY)
+    ;
+  TC4->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+  TC4->COUNT32.INTENSET.reg = TC_INTENSET_MC0;
+  if (int32_t(deadline - timerNow()) <= 0)
+  { // already due , the compare match would only come after the counter wraps
+    NVIC_SetPendingIRQ(TC4_IRQn);
   }
 }
 
+void TC4_Handler()
+{
+  TC4->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+  gateTimerEdges(gates, timerNow());
+  armGateTimer();
+}
+
+// 1 MHz free running 32 bit timebase on TC4/TC5 , GCLK4 = 48 MHz / 48
+void timerBegin()
+{
+  GCLK->GENDIV.reg = GCLK_GENDIV_ID(4) | GCLK_GENDIV_DIV(48);
+  while (GCLK->STATUS.bit.SYNCBUSY)
+    ;
+  GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(4) | GCLK_GENCTRL_SRC_DFLL48M | GCLK_GENCTRL_IDC | GCLK_GENCTRL_GENEN;
+  while (GCLK->STATUS.bit.SYNCBUSY)
+    ;
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK4 | GCLK_CLKCTRL_ID_TC4_TC5;
+  while (GCLK->STATUS.bit.SYNCBUSY)
+    ;
+  PM->APBCMASK.reg |= PM_APBCMASK_TC4 | PM_APBCMASK_TC5;
+
+  TC4->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_WAVEGEN_NFRQ | TC_CTRLA_PRESCALER_DIV1;
+  while (TC4->COUNT32.STATUS.bit.SYNCBUSY)
+    ;
+  TC4->COUNT32.READREQ.reg = TC_READREQ_RREQ | TC_READREQ_RCONT | TC_READREQ_ADDR(0x10); // keep COUNT readable
+  NVIC_SetPriority(TC4_IRQn, 0);
+  NVIC_EnableIRQ(TC4_IRQn);
+  TC4->COUNT32.CTRLA.reg |= TC_CTRLA_ENABLE;
+  while (TC4->COUNT32.STATUS.bit.SYNCBUSY)
+    ;
+}
+
+uint32_t timerNow()
+{
+  return TC4->COUNT32.COUNT.reg;
+}
+
+// Clock input interrupt
+void onClock()
+{
+  events.push(EVENT_CLOCK, 0, timerNow());
+}
+
+// ADC result ready , the ADC alternates between CV1 and CV2. CV1 is kept for recording ,
+// CV2 goes through the trigger detector.
+void ADC_Handler()
+{
+  uint16_t sample = ADC->RESULT.reg; // clears RESRDY
+  if (adc_cv2 == 0)
+  {
+    cv1_sample = sample;
+    ADC->INPUTCTRL.bit.MUXPOS = g_APinDescription[CV_2_IN_PIN].ulADCChannelNumber;
+  }
+  else
+  {
+    if (trig_detector.update(sample) < 0)
+    {
+      events.push(EVENT_TRIG, cv1_sample, timerNow());
+    }
+    ADC->INPUTCTRL.bit.MUXPOS = g_APinDescription[CV_1_IN_PIN].ulADCChannelNumber;
+  }
+  adc_cv2 = !adc_cv2;
+  while (ADC->STATUS.bit.SYNCBUSY)
+    ;
+  ADC->SWTRIG.bit.START = 1;
+}
+
+// Scan CV1 and CV2 from the ADC interrupt , one conversion every ~60us
+void ADC_begin()
+{
+  pinPeripheral(CV_1_IN_PIN, PIO_ANALOG);
+  pinPeripheral(CV_2_IN_PIN, PIO_ANALOG);
+  ADC->CTRLA.bit.ENABLE = 0;
+  while (ADC->STATUS.bit.SYNCBUSY)
+    ;
+  ADC->CTRLB.reg = ADC_CTRLB_PRESCALER_DIV256 | ADC_CTRLB_RESSEL_12BIT;
+  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_1 | ADC_AVGCTRL_ADJRES(0);
+  ADC->SAMPCTRL.reg = 2;
+  while (ADC->STATUS.bit.SYNCBUSY)
+    ;
+  ADC->INPUTCTRL.bit.MUXPOS = g_APinDescription[CV_1_IN_PIN].ulADCChannelNumber;
+  ADC->INTENSET.reg = ADC_INTENSET_RESRDY;
+  NVIC_SetPriority(ADC_IRQn, 0); // same as the clock input , both push to the event queue
+  NVIC_EnableIRQ(ADC_IRQn);
+  ADC->CTRLA.bit.ENABLE = 1;
+  while (ADC->STATUS.bit.SYNCBUSY)
+    ;
+  ADC->SWTRIG.bit.START = 1;
+}
+
 //-----------------------------DISPLAY----------------------------------------
+// Channel settings page , one row per setting , CH1 and CH2 columns. The rows scroll to keep
+// the selected one visible.
+void OLED_settings()
+{
+  int selected = (menu - MENU_SETTINGS) / 2;
+  int first = selected >= SETTING_ROWS ? selected - SETTING_ROWS + 1 : 0;
+  display.setCursor(46, 0);
+  display.print("CH1");
+  display.setCursor(88, 0);
+  display.print("CH2");
+  for (int row = first; row < NUM_SETTINGS && row < first + SETTING_ROWS; row++)
+  {
+    int y = (row - first + 1) * 9;
+    display.setCursor(8, y);
+    display.print(settingNames[row]);
+    for (int ch = 0; ch < 2; ch++)
+    {
+      display.setCursor(46 + ch * 42, y);
+      printSetting(row, *settingValues[row][ch]);
+      if (menu - MENU_SETTINGS == row * 2 + ch)
+      {
+        int x = 39 + ch * 42;
+        if (edit_setting == 1)
+        {
+          display.fillTriangle(x, y, x, y + 6, x + 5, y + 3, WHITE);
+        }
+        else
+        {
+          display.drawTriangle(x, y, x, y + 6, x + 5, y + 3, WHITE);
+        }
+      }
+    }
+  }
+}
+
+void printSetting(int row, byte value)
+{
+  switch (row)
+  {
+  case SETTING_PATTERN:
+    display.print(value + 1);
+    break;
+
+  case SETTING_GATE:
+    display.print(gateLengths[value].value);
+    display.print(gateLengths[value].mode == GATE_LENGTH_PERCENT ? "%" : "ms");
+    break;
+
+  case SETTING_LEGATO:
+    display.print(value ? "on" : "off");
+    break;
+
+  case SETTING_DIRECTION:
+    display.print(directionNames[value]);
+    break;
+
+  case SETTING_LOOP_START:
+    display.print(value + 1);
+    break;
+
+  case SETTING_SCALE:
+    display.print(scaleNames[value]);
+    break;
+
+  case SETTING_TRANSPOSE:
+    display.print(transposeNames[value]);
+    break;
+
+  case SETTING_PROBABILITY:
+    display.print((value + 1) * 100 / 8);
+    display.print("%");
+    break;
+
+  case SETTING_RATCHETS:
+    display.print(value + 1);
+    break;
+
+  case SETTING_LOOP_END:
+    if (value == 0)
+    {
+      display.print("LAST");
+    }
+    else
+    {
+      display.print(value);
+    }
+    break;
+  }
+}
+
+// clock division , or xN for a multiplication
+void printRate(byte rate)
+{
+  if (rates[rate].multiplication > 1)
+  {
+    display.print("x");
+    display.print(rates[rate].multiplication);
+  }
+  else
+  {
+    display.print(rates[rate].division);
+  }
+}
+
 void OLED_display()
 {
   display.clearDisplay();
   display.setTextSize(1);
   display.setTextColor(WHITE);
+  dirtyPages.markAll();
 
   // display step
-
-  for (disp_step1 = 0; disp_step1 <= max_step_ch1; disp_step1++)
+  if (menu >= MENU_SETTINGS)
   {
-    if ((step_ch1_play != disp_step1 + 1) || (max_step_ch1 == disp_step1))
-    { // not active step -> fillRect
-      display.fillRect(47 + (disp_step1 % 16) * 5, 3 - stepgate_ch1[disp_step1] + disp_step1 / 16 * 4, 4, 1 + stepgate_ch1[disp_step1] * 2, WHITE);
-    }
-  }
-  for (disp_step2 = 0; disp_step2 <= max_step_ch2; disp_step2++)
-  {
-    if (step_ch2_play != disp_step2 + 1)
-    { // not active step -> fillRect
-      display.fillRect(47 + (disp_step2 % 16) * 5, 35 - stepgate_ch2[disp_step2] + disp_step2 / 16 * 4, 4, 1 + stepgate_ch2[disp_step2] * 2, WHITE);
-    }
+    OLED_settings();
+    flushDirtyPages();
+    return;
   }
 
+  grid_ch1.clear();
+  grid_ch2.clear();
+  updateGrid(1);
+  updateGrid(2);
+
   // display menu
   if (menu <= 3)
   {
@@ -479,6 +875,10 @@ void OLED_display()
     {
       display.print("REC");
     }
+    else if (mode1 == 2)
+    {
+      display.print("DUB");
+    }
     else
     {
       display.print("PLAY");
@@ -487,7 +887,7 @@ void OLED_display()
     display.setCursor(8, 9);
     display.print("DIV:");
     display.setCursor(32, 9);
-    display.print(div_ch1[select_div_ch1]);
+    printRate(select_div_ch1);
 
     display.setCursor(8, 18);
     display.print("RESET");
@@ -497,6 +897,10 @@ void OLED_display()
     {
       display.print("REC");
     }
+    else if (mode2 == 2)
+    {
+      display.print("DUB");
+    }
     else
     {
       display.print("PLAY");
@@ -505,13 +909,13 @@ void OLED_display()
     display.setCursor(8, 45);
     display.print("DIV:");
     display.setCursor(32, 45);
-    display.print(div_ch2[select_div_ch2]);
+    printRate(select_div_ch2);
 
     display.setCursor(8, 54);
     display.print("RESET");
   }
 
-  if (menu >= 7)
+  if (menu >= 7 && menu <= 11)
   {
     display.setCursor(8, 0);
     display.print("MUTE");
@@ -549,57 +953,140 @@ void OLED_display()
     display.print("SAVE");
   }
 
-  display.display();
+  flushDirtyPages();
 }
 
-//-----------------------------OUTPUT CV----------------------------------------
-void intDAC(int intDAC_OUT)
+// Redraw the step cells that changed since the last frame , the menu text stays as it is
+void OLED_grid()
 {
-  analogWrite(DAC_INTERNAL_PIN, intDAC_OUT / 4); // "/4" -> 12bit to 10bit
+  if (menu >= MENU_SETTINGS)
+  {
+    return;
+  }
+  updateGrid(1);
+  updateGrid(2);
+  flushDirtyPages();
 }
 
-void MCP(int MCP_OUT)
+void updateGrid(byte ch)
 {
-  Wire.beginTransmission(0x60);
-  Wire.write((MCP_OUT >> 8) & 0x0F);
-  Wire.write(MCP_OUT);
-  Wire.endTransmission();
+  StepGrid &grid = ch == 1 ? grid_ch1 : grid_ch2;
+  grid.follow((ch == 1 ? transport_ch1 : transport_ch2).current, ch == 1 ? max_step_ch1 : max_step_ch2);
+  uint8_t n;
+  while (grid.nextStale(n))
+  {
+    byte cell = grid.state(n, n <= grid.last ? seqStep(ch, n) : 0);
+    if (!grid.show(n, cell, dirtyPages))
+    {
+      continue;
+    }
+    display.fillRect(grid.cellX(n), grid.cellY(n), GRID_CELL_WIDTH, GRID_CELL_HEIGHT, BLACK);
+    if (cell == CELL_GATE)
+    {
+      display.fillRect(grid.cellX(n), grid.cellY(n), GRID_CELL_WIDTH, GRID_CELL_HEIGHT, WHITE);
+    }
+    else if (cell == CELL_REST)
+    {
+      display.fillRect(grid.cellX(n), grid.cellY(n) + 1, GRID_CELL_WIDTH, 1, WHITE);
+    }
+  }
 }
 
-// Save data
-void save()
+// Send only the changed columns of each changed page
+void flushDirtyPages()
 {
-  delay(100);
-  // Save sequence 1 CV
-  for (int i = 0; i < 128; i++)
+  flushDirtyPages(display, Wire, OLED_ADDRESS, dirtyPages, OLED_BUS_CLOCK);
+}
+
+// Switch a channel to another pattern , no step data is copied
+void selectPattern(byte ch, byte pattern)
+{
+  if (ch == 1)
+  {
+    patterns.dir.lastStep[0][pattern_ch1] = max_step_ch1;
+    pattern_ch1 = pattern;
+    max_step_ch1 = patterns.dir.lastStep[0][pattern];
+  }
+  else
+  {
+    patterns.dir.lastStep[1][pattern_ch2] = max_step_ch2;
+    pattern_ch2 = pattern;
+    max_step_ch2 = patterns.dir.lastStep[1][pattern];
+  }
+  (ch == 1 ? grid_ch1 : grid_ch2).invalidateAll();
+}
+
+// Step of the pattern a channel plays , through the overlay while it is being recorded
+Step seqStep(byte ch, byte n)
+{
+  byte pattern = ch == 1 ? pattern_ch1 : pattern_ch2;
+  const Pattern *stored = patterns.pattern(ch - 1, pattern);
+  if (edit.matches(ch - 1, pattern))
+  {
+    return edit.stepAt(stored, n);
+  }
+  return stored->steps[n];
+}
+
+// Record a step into the overlay , a previous recording on another pattern is programmed first
+void recStep(byte ch, byte n, Step step)
+{
+  byte pattern = ch == 1 ? pattern_ch1 : pattern_ch2;
+  if (!edit.matches(ch - 1, pattern))
   {
-    EEPROM.write(i, stepcv_ch1[i]);
+    commitEdit();
+    edit.begin(ch - 1, pattern);
   }
-  // Save sequence 2 CV
-  for (int i = 0; i < 128; i++)
+  edit.write(n, step);
+  (ch == 1 ? grid_ch1 : grid_ch2).invalidate(n);
+}
+
+// Program the recorded pattern into its flash row
+void commitEdit()
+{
+  if (!edit.active())
   {
-    EEPROM.write(i + 128, stepcv_ch2[i]);
+    return;
   }
-  // Save sequence 1 Gate
-  for (int i = 0; i < 128; i++)
+  bool playing = edit.index == (edit.channel == 0 ? pattern_ch1 : pattern_ch2);
+  byte last_step = playing ? (edit.channel == 0 ? max_step_ch1 : max_step_ch2) : patterns.dir.lastStep[edit.channel][edit.index];
+  edit.commit(patterns, last_step);
+}
+
+void flashErase(const uint8_t *row)
+{
+  flash.erase(row, FLASH_ROW_SIZE);
+}
+
+void flashWrite(const uint8_t *dst, const void *src, uint32_t size)
+{
+  flash.write(dst, src, size);
+}
+
+// Save data , kept in the pattern directory next to the step lengths
+#define SAVE_MUTE 0
+#define SAVE_STOP 2
+#define SAVE_PATTERN 4
+#define SAVE_GATE 6 // gate length index , bit 7 = legato
+#define SAVE_DIRECTION 8
+#define SAVE_LOOP_START 10
+#define SAVE_LOOP_END 12
+#define SAVE_SCALE 14 // scale index , bits 6-7 = transpose mode
+#define SAVE_PROBABILITY 16 // stored as skip chance so a fresh directory plays every step
+#define SAVE_RATCHETS 18
+
+void save()
+{
+  delay(100);
+  storeSettings();
+  if (edit.active())
   {
-    EEPROM.write(i + 256, stepgate_ch1[i]);
+    commitEdit(); // programs the directory with the pattern
   }
-  // Save sequence 2 Gate
-  for (int i = 0; i < 128; i++)
+  else
   {
-    EEPROM.write(i + 384, stepgate_ch2[i]);
+    patterns.writeDirectory();
   }
-  // Save mute 1 and 2
-  EEPROM.write(512, mute_ch1);
-  EEPROM.write(513, mute_ch2);
-  // Save stop 1 and 2
-  EEPROM.write(514, stop_ch1);
-  EEPROM.write(515, stop_ch2);
-  // Save max step 1 and 2
-  EEPROM.write(516, max_step_ch1);
-  EEPROM.write(517, max_step_ch2);
-  EEPROM.commit();
   display.clearDisplay(); // clear display
   display.setTextSize(2);
   display.setTextColor(BLACK, WHITE);
@@ -609,36 +1096,145 @@ void save()
   delay(1000);
 }
 
+// Copy the lengths of the playing patterns and the settings into the directory (RAM)
+void storeSettings()
+{
+  patterns.dir.lastStep[0][pattern_ch1] = max_step_ch1;
+  patterns.dir.lastStep[1][pattern_ch2] = max_step_ch2;
+  patterns.dir.settings[SAVE_MUTE] = mute_ch1;
+  patterns.dir.settings[SAVE_MUTE + 1] = mute_ch2;
+  patterns.dir.settings[SAVE_STOP] = stop_ch1;
+  patterns.dir.settings[SAVE_STOP + 1] = stop_ch2;
+  patterns.dir.settings[SAVE_PATTERN] = pattern_ch1;
+  patterns.dir.settings[SAVE_PATTERN + 1] = pattern_ch2;
+  patterns.dir.settings[SAVE_GATE] = gate_length_ch1 | legato_ch1 << 7;
+  patterns.dir.settings[SAVE_GATE + 1] = gate_length_ch2 | legato_ch2 << 7;
+  patterns.dir.settings[SAVE_DIRECTION] = direction_ch1;
+  patterns.dir.settings[SAVE_DIRECTION + 1] = direction_ch2;
+  patterns.dir.settings[SAVE_LOOP_START] = loop_start_ch1;
+  patterns.dir.settings[SAVE_LOOP_START + 1] = loop_start_ch2;
+  patterns.dir.settings[SAVE_LOOP_END] = loop_end_ch1;
+  patterns.dir.settings[SAVE_LOOP_END + 1] = loop_end_ch2;
+  patterns.dir.settings[SAVE_SCALE] = scale_ch1 | transpose_ch1 << 6;
+  patterns.dir.settings[SAVE_SCALE + 1] = scale_ch2 | transpose_ch2 << 6;
+  patterns.dir.settings[SAVE_PROBABILITY] = 7 - probability_ch1;
+  patterns.dir.settings[SAVE_PROBABILITY + 1] = 7 - probability_ch2;
+  patterns.dir.settings[SAVE_RATCHETS] = ratchets_ch1;
+  patterns.dir.settings[SAVE_RATCHETS + 1] = ratchets_ch2;
+}
+
+// Only the directory is checked at boot , the patterns are read from flash when played
 void load()
 {
-  if (EEPROM.isValid() == 1)
-    // Load sequence 1 CV
-    for (int i = 0; i < 128; i++)
+  if (!patterns.begin(pattern_flash, flashErase, flashWrite))
+  {
+    return;
+  }
+  applySettings();
+}
+
+// Take the settings and pattern lengths over from the directory
+void applySettings()
+{
+  mute_ch1 = patterns.dir.settings[SAVE_MUTE];
+  mute_ch2 = patterns.dir.settings[SAVE_MUTE + 1];
+  stop_ch1 = patterns.dir.settings[SAVE_STOP];
+  stop_ch2 = patterns.dir.settings[SAVE_STOP + 1];
+  pattern_ch1 = patterns.dir.settings[SAVE_PATTERN] % PATTERNS_PER_CHANNEL;
+  pattern_ch2 = patterns.dir.settings[SAVE_PATTERN + 1] % PATTERNS_PER_CHANNEL;
+  gate_length_ch1 = (patterns.dir.settings[SAVE_GATE] & 0x7F) % NUM_GATE_LENGTHS;
+  gate_length_ch2 = (patterns.dir.settings[SAVE_GATE + 1] & 0x7F) % NUM_GATE_LENGTHS;
+  legato_ch1 = patterns.dir.settings[SAVE_GATE] >> 7;
+  legato_ch2 = patterns.dir.settings[SAVE_GATE + 1] >> 7;
+  direction_ch1 = patterns.dir.settings[SAVE_DIRECTION] % NUM_DIRECTIONS;
+  direction_ch2 = patterns.dir.settings[SAVE_DIRECTION + 1] % NUM_DIRECTIONS;
+  loop_start_ch1 = patterns.dir.settings[SAVE_LOOP_START] % MAX_STEPS;
+  loop_start_ch2 = patterns.dir.settings[SAVE_LOOP_START + 1] % MAX_STEPS;
+  loop_end_ch1 = constrain(patterns.dir.settings[SAVE_LOOP_END], 0, MAX_STEPS);
+  loop_end_ch2 = constrain(patterns.dir.settings[SAVE_LOOP_END + 1], 0, MAX_STEPS);
+  scale_ch1 = (patterns.dir.settings[SAVE_SCALE] & 0x3F) % NUM_SCALES;
+  scale_ch2 = (patterns.dir.settings[SAVE_SCALE + 1] & 0x3F) % NUM_SCALES;
+  transpose_ch1 = (patterns.dir.settings[SAVE_SCALE] >> 6) % NUM_TRANSPOSE_MODES;
+  transpose_ch2 = (patterns.dir.settings[SAVE_SCALE + 1] >> 6) % NUM_TRANSPOSE_MODES;
+  probability_ch1 = 7 - (patterns.dir.settings[SAVE_PROBABILITY] & 7);
+  probability_ch2 = 7 - (patterns.dir.settings[SAVE_PROBABILITY + 1] & 7);
+  ratchets_ch1 = patterns.dir.settings[SAVE_RATCHETS] % MAX_STEP_RATCHETS;
+  ratchets_ch2 = patterns.dir.settings[SAVE_RATCHETS + 1] % MAX_STEP_RATCHETS;
+  for (int ch = 0; ch < 2; ch++)
+  {
+    for (int n = 0; n < PATTERNS_PER_CHANNEL; n++)
     {
-      stepcv_ch1[i] = EEPROM.read(i);
+      patterns.dir.lastStep[ch][n] = constrain(patterns.dir.lastStep[ch][n], 0, MAX_STEPS - 1);
     }
-  // Load sequence 2 CV
-  for (int i = 0; i < 128; i++)
+  }
+  next_pattern_ch1 = pattern_ch1;
+  next_pattern_ch2 = pattern_ch2;
+  max_step_ch1 = patterns.dir.lastStep[0][pattern_ch1];
+  max_step_ch2 = patterns.dir.lastStep[1][pattern_ch2];
+}
+
+//-----------------------------USB LINK----------------------------------------
+// Send what the USB endpoint takes , then feed the decoder while a whole reply still fits
+void serviceLink()
+{
+  uint8_t chunk[64];
+  int room = constrain(Serial.availableForWrite(), 0, (int)sizeof(chunk));
+  int n = 0;
+  while (n < room && link_tx.pop(chunk[n]))
   {
-    stepcv_ch2[i] = EEPROM.read(i + 128);
+    n++;
   }
-  // Load sequence 1 Gate
-  for (int i = 0; i < 128; i++)
+  if (n > 0)
   {
-    stepgate_ch1[i] = EEPROM.read(i + 256);
+    Serial.write(chunk, n);
   }
-  // Load sequence 2 Gate
-  for (int i = 0; i < 128; i++)
+
+  for (n = 0; n < LINK_BYTES_PER_LOOP && link_tx.space() >= SLIP_ENCODED_SIZE(LINK_MAX_FRAME) && Serial.available() > 0; n++)
   {
-    stepgate_ch2[i] = EEPROM.read(i + 384);
+    uint16_t size = link_rx.feed(Serial.read());
+    if (size > 0)
+    {
+      linkRequest(size);
+    }
+  }
+}
+
+// Reads answer from what is saved , nothing is programmed for them. A write programs only
+// what it carries , unsaved settings and other recordings stay as they are until SAVE.
+void linkRequest(uint16_t size)
+{
+  int length = linkPayload(link_rx.frame, size);
+  if (length < 1)
+  {
+    return; // bad CRC , the host retries
+  }
+  uint16_t reply = linkHandle(patterns, link_rx.frame, length, link_reply);
+  linkSend(link_tx, link_reply, reply);
+
+  if (link_reply[0] == LINK_WRITE_PATTERN)
+  {
+    byte ch = link_rx.frame[1];
+    byte index = link_rx.frame[2];
+    if (edit.matches(ch, index))
+    {
+      edit.discard(); // the written pattern replaces the recording in progress
+    }
+    if (index == (ch == 0 ? pattern_ch1 : pattern_ch2))
+    {
+      (ch == 0 ? max_step_ch1 : max_step_ch2) = patterns.dir.lastStep[ch][index];
+    }
+    (ch == 0 ? grid_ch1 : grid_ch2).invalidateAll();
+    disp_refresh = 1;
+  }
+  else if (link_reply[0] == LINK_WRITE_SETTINGS)
+  {
+    // keep the lengths being played , only in RAM as selectPattern() does
+    patterns.dir.lastStep[0][pattern_ch1] = max_step_ch1;
+    patterns.dir.lastStep[1][pattern_ch2] = max_step_ch2;
+    applySettings();
+    buildScales();
+    grid_ch1.invalidateAll();
+    grid_ch2.invalidateAll();
+    disp_refresh = 1;
   }
-  // Load mute 1 and 2
-  mute_ch1 = EEPROM.read(512);
-  mute_ch2 = EEPROM.read(513);
-  // Load stop 1 and 2
-  stop_ch1 = EEPROM.read(514);
-  stop_ch2 = EEPROM.read(515);
-  // Load max step 1 and 2
-  max_step_ch1 = EEPROM.read(516);
-  max_step_ch2 = EEPROM.read(517);
 }
@@ -0,0 +1,237 @@
+#include <gtest/gtest.h>
+
+#include "gate.cpp"
+#include "input_events.cpp"
+#include "pattern_store.cpp"
+
+TEST(GateTest, ClosesAfterLength)
+{
+  GateScheduler gates;
+  uint32_t deadline;
+  EXPECT_FALSE(gates.nextDeadline(0, deadline));
+  EXPECT_TRUE(gates.open(0, 100, 10000, false));
+  ASSERT_TRUE(gates.nextDeadline(100, deadline));
+  EXPECT_EQ(10100u, deadline);
+  EXPECT_EQ(0, gates.expire(10099));
+  EXPECT_TRUE(gates.high[0]);
+  EXPECT_EQ(1, gates.expire(10100));
+  EXPECT_FALSE(gates.high[0]);
+  EXPECT_EQ(0, gates.expire(10101));
+  EXPECT_FALSE(gates.nextDeadline(10101, deadline));
+}
+
+TEST(GateTest, SurvivesTimerWrap)
+{
+  GateScheduler gates;
+  uint32_t deadline;
+  gates.open(1, 0xFFFFF000, 10000, false);
+  gates.open(0, 0xFFFFFF00, 20000, false);
+  ASSERT_TRUE(gates.nextDeadline(0xFFFFFF00, deadline));
+  EXPECT_EQ(0xFFFFF000 + 10000, deadline); // earliest even though it wrapped past zero
+  EXPECT_EQ(0, gates.expire(0xFFFFFFFF));
+  EXPECT_EQ(2, gates.expire(0x00001710));
+  EXPECT_EQ(1, gates.expire(0x00004E20));
+}
+
+TEST(GateTest, LegatoHoldsWithoutRetrigger)
+{
+  GateScheduler gates;
+  uint32_t deadline;
+  EXPECT_TRUE(gates.open(0, 0, 10000, true));
+  EXPECT_FALSE(gates.nextDeadline(0, deadline));
+  EXPECT_EQ(0, gates.expire(500000));
+  EXPECT_FALSE(gates.open(0, 500000, 10000, true));  // next gated step , no new edge
+  EXPECT_FALSE(gates.open(0, 1000000, 10000, false)); // last step of the phrase
+  EXPECT_EQ(1, gates.expire(1010000));
+}
+
+TEST(GateTest, TieThenRestCloses)
+{
+  GateScheduler gates;
+  gates.open(1, 0, 10000, true);
+  EXPECT_TRUE(gates.close(1));
+  EXPECT_FALSE(gates.close(1));
+  EXPECT_TRUE(gates.open(1, 20000, 10000, false));
+}
+
+TEST(GateTest, RatchetsRetriggerInsideTheStep)
+{
+  GateScheduler gates;
+  uint32_t deadline;
+  // 3 gates over a 30ms step , 5ms each
+  EXPECT_TRUE(gates.open(0, 1000, 5000, false));
+  gates.ratchet(0, 2, 10000);
+  int rises = 1, falls = 0;
+  uint32_t edges[6] = {1000};
+  for (uint32_t us = 1000; us < 40000; us++)
+  {
+    if (gates.nextDeadline(us, deadline) && deadline == us)
+    {
+      if (gates.expire(us) & 1)
+      {
+        edges[2 * falls++ + 1] = us;
+      }
+      if (gates.retrigger(us) & 1)
+      {
+        edges[2 * rises++] = us;
+      }
+    }
+  }
+  ASSERT_EQ(3, rises);
+  ASSERT_EQ(3, falls);
+  const uint32_t expected[6] = {1000, 6000, 11000, 16000, 21000, 26000};
+  for (int n = 0; n < 6; n++)
+  {
+    EXPECT_EQ(expected[n], edges[n]);
+  }
+}
+
+TEST(GateTest, NewStepCancelsRatchets)
+{
+  GateScheduler gates;
+  gates.open(1, 0, 5000, false);
+  gates.ratchet(1, 3, 10000);
+  EXPECT_EQ(2, gates.expire(5000));
+  gates.open(1, 8000, 5000, false);
+  EXPECT_EQ(0, gates.retrigger(10000));
+  EXPECT_EQ(2, gates.expire(13000));
+  EXPECT_EQ(0, gates.retrigger(20000));
+  gates.open(1, 30000, 5000, false);
+  gates.ratchet(1, 3, 10000);
+  EXPECT_TRUE(gates.close(1));
+  EXPECT_EQ(0, gates.retrigger(40000));
+}
+
+TEST(GateTest, GateLengthModes)
+{
+  EXPECT_EQ(10000u, gateLengthUs(gateLengths[DEFAULT_GATE_LENGTH], 0));
+  EXPECT_EQ(10000u, gateLengthUs(gateLengths[DEFAULT_GATE_LENGTH], 500000));
+  EXPECT_EQ(125000u, gateLengthUs({GATE_LENGTH_PERCENT, 25}, 500000));
+  EXPECT_EQ(10000u, gateLengthUs({GATE_LENGTH_PERCENT, 50}, 0)); // no clock yet
+  // longer than the step leaves a gap for the retrigger
+  EXPECT_EQ(47500u, gateLengthUs({GATE_LENGTH_MS, 100}, 50000));
+  EXPECT_EQ(uint32_t(MIN_GATE_US), gateLengthUs({GATE_LENGTH_PERCENT, 10}, 4000));
+}
+
+// RAM stand-in for the flash pattern area
+alignas(FLASH_ROW_SIZE) static uint8_t gateFlash[PATTERN_AREA_SIZE];
+
+static void gateFlashErase(const uint8_t *row)
+{
+  memset((uint8_t *)row, 0xFF, FLASH_ROW_SIZE);
+}
+
+static void gateFlashWrite(const uint8_t *dst, const void *src, uint32_t size)
+{
+  memcpy((uint8_t *)dst, src, size);
+}
+
+// CH1 records on trigger falls while CH2 plays a stored pattern on clock rises. The edges
+// go through the event queue like the interrupts push them, the loop is busy for a random
+// time between drains, and the compare interrupt ends the gates at their deadline whatever
+// the loop does.
+TEST(GateTest, RecordingDoesNotDelayPlayback)
+{
+  PatternStore store;
+  EditOverlay edit;
+  EventQueue<EVENT_QUEUE_SIZE> events;
+  GateScheduler gates;
+  memset(gateFlash, 0, sizeof(gateFlash));
+  store.begin(gateFlash, gateFlashErase, gateFlashWrite);
+  Pattern played = {};
+  for (int n = 0; n < 16; n++)
+  {
+    played.steps[n] = makeStep(n * 3, true);
+  }
+  store.writePattern(1, 0, played, 15);
+  store.writeDirectory();
+
+  uint32_t rise[GATE_CHANNELS] = {};
+  int clocks = 0, recs = 0, falls = 0;
+  uint8_t playStep = 0, recStep = 0;
+  uint32_t rng = 1;
+  uint32_t next_clock = 0, next_trig = 3000;
+  uint32_t loop_free = 0;
+  uint32_t deadline;
+
+  for (uint32_t us = 0; us < 2020000; us++) // the last 20 ms only close the open gates
+  {
+    // compare interrupt
+    if (gates.nextDeadline(us, deadline) && deadline == us)
+    {
+      uint8_t fall = gates.expire(us);
+      for (int ch = 0; ch < GATE_CHANNELS; ch++)
+      {
+        if (fall & (1 << ch))
+        {
+          EXPECT_EQ(ch == 0 ? uint32_t(REC_MONITOR_GATE_US) : 10000u, us - rise[ch]);
+          falls++;
+        }
+      }
+    }
+    // clock and trigger interrupts
+    if (us == next_clock && us < 2000000)
+    {
+      events.push(EVENT_CLOCK, 0, us);
+      next_clock += 12000;
+    }
+    if (us == next_trig && us < 2000000)
+    {
+      events.push(EVENT_TRIG, (recs * 7) % MAX_NOTE, us);
+      next_trig += 7000;
+      recs++;
+    }
+    if (us < loop_free)
+    {
+      continue; // loop busy , edges wait in the event queue
+    }
+    InputEvent event;
+    while (events.pop(event))
+    {
+      EXPECT_LT(us - event.us, 1500u);
+      if (event.type == EVENT_CLOCK)
+      {
+        Step step = store.pattern(1, 0)->steps[playStep];
+        EXPECT_EQ(played.steps[playStep], step);
+        playStep = (playStep + 1) % 16;
+        if (stepGate(step) && gates.open(1, us, gateLengthUs(gateLengths[DEFAULT_GATE_LENGTH], 12000), false))
+        {
+          rise[1] = us;
+        }
+        clocks++;
+      }
+      else
+      {
+        if (!edit.matches(0, 0))
+        {
+          edit.begin(0, 0);
+        }
+        edit.write(recStep, makeStep(event.value, true));
+        recStep = recStep < MAX_STEPS - 1 ? recStep + 1 : recStep;
+        if (gates.open(0, us, REC_MONITOR_GATE_US, false))
+        {
+          rise[0] = us;
+        }
+      }
+    }
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    loop_free = us + rng % 1500; // display and encoder work
+  }
+  EXPECT_EQ(0, events.dropped);
+  EXPECT_EQ(167, clocks);
+  EXPECT_EQ(286, recs);
+  EXPECT_EQ(clocks + recs, falls);
+
+  // the recording stays in RAM until it is committed , the steps past the last one are full
+  EXPECT_EQ(&emptyPattern, store.pattern(0, 0));
+  const Pattern *base = store.pattern(0, 0);
+  for (int n = 0; n < MAX_STEPS - 1; n++)
+  {
+    EXPECT_EQ(makeStep((n * 7) % MAX_NOTE, true), edit.stepAt(base, n)) << n;
+  }
+  edit.commit(store, recStep);
+  EXPECT_EQ(makeStep(7, true), store.pattern(0, 0)->steps[1]);
+  EXPECT_EQ(played.steps[5], store.pattern(1, 0)->steps[5]);
+}
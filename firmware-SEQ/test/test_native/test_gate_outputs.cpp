@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include "gate_outputs.cpp"
+
+// Run the compare interrupt at every deadline up to the time given
+static void runTimer(GateScheduler &gates, uint32_t until)
+{
+  uint32_t deadline;
+  while (gates.nextDeadline(halTrace.now, deadline) && int32_t(until - deadline) >= 0)
+  {
+    halTrace.now = deadline;
+    gateTimerEdges(gates, halTrace.now);
+  }
+  halTrace.now = until;
+}
+
+TEST(GateOutputsTest, RatchetsGoOutOnTime)
+{
+  GateScheduler gates;
+  halTrace = {};
+  halTrace.now = 1000;
+  // 3 gates over a 30ms step, 5ms each
+  openGate(gates, 0, halTrace.now, 5000, false, 2, 10000);
+  runTimer(gates, 40000);
+
+  ASSERT_EQ(6, halTrace.count);
+  const uint32_t expected[6] = {1000, 6000, 11000, 16000, 21000, 26000};
+  for (int n = 0; n < 6; n++)
+  {
+    const HalEvent &event = halTrace.events[n];
+    EXPECT_EQ(HAL_PIN, event.device);
+    EXPECT_EQ(ENV_OUT_PIN_1, event.channel);
+    EXPECT_EQ(expected[n], event.us) << n;
+    EXPECT_EQ(n & 1, event.value) << n; // LOW active: the gate is on while the pin is low
+  }
+}
+
+TEST(GateOutputsTest, FastRatchetsKeepAGap)
+{
+  // 4 ratchets asked on a 5ms step, 1250us apart they would rise as the last gate ends
+  GateScheduler gates;
+  halTrace = {};
+  uint32_t period = 5000;
+  uint8_t count = ratchetsFitting(4, period);
+  EXPECT_EQ(2, count);
+  uint32_t length = gateLengthUs(gateLengths[DEFAULT_GATE_LENGTH], period / count);
+  openGate(gates, 0, 0, length, false, count - 1, period / count);
+  runTimer(gates, period);
+
+  ASSERT_EQ(2 * count, halTrace.countOf(HAL_PIN, ENV_OUT_PIN_1));
+  for (int n = 1; n < halTrace.count; n++)
+  {
+    const HalEvent &from = halTrace.events[n - 1];
+    const HalEvent &to = halTrace.events[n];
+    EXPECT_NE(from.value, to.value) << n;
+    EXPECT_GE(to.us - from.us, from.value ? 1u : uint32_t(MIN_GATE_US)) << n; // a gap, a whole gate
+  }
+  EXPECT_TRUE(Pin<ENV_OUT_PIN_1>::read());
+}
+
+TEST(GateOutputsTest, EachChannelHasItsJack)
+{
+  GateScheduler gates;
+  halTrace = {};
+  openGate(gates, 1, 0, 10000, false, 0, 0);
+  halTrace.now = 2000;
+  openGate(gates, 0, 2000, 3000, false, 0, 0);
+  runTimer(gates, 6000);
+  EXPECT_FALSE(Pin<ENV_OUT_PIN_2>::read()); // still on
+  EXPECT_TRUE(Pin<ENV_OUT_PIN_1>::read());
+  EXPECT_EQ(5000u, halTrace.last(HAL_PIN, ENV_OUT_PIN_1)->us);
+  runTimer(gates, 20000);
+  EXPECT_TRUE(Pin<ENV_OUT_PIN_2>::read());
+  EXPECT_EQ(10000u, halTrace.last(HAL_PIN, ENV_OUT_PIN_2)->us);
+  EXPECT_EQ(4, halTrace.count);
+}
+
+TEST(GateOutputsTest, HeldGateWritesOnlyItsEdges)
+{
+  GateScheduler gates;
+  halTrace = {};
+  openGate(gates, 0, 0, 10000, true, 0, 0);
+  openGate(gates, 0, 50000, 10000, true, 0, 0); // tie, no new edge
+  runTimer(gates, 100000);
+  EXPECT_EQ(1, halTrace.countOf(HAL_PIN, ENV_OUT_PIN_1));
+  closeGate(gates, 0);
+  closeGate(gates, 0);
+  EXPECT_EQ(2, halTrace.countOf(HAL_PIN, ENV_OUT_PIN_1));
+  EXPECT_TRUE(Pin<ENV_OUT_PIN_1>::read());
+}
+
+TEST(GateOutputsTest, RestAfterBootKeepsTheGateOff)
+{
+  GateScheduler gates;
+  halTrace = {}; // pins low after reset
+  gatesBegin();
+  closeGate(gates, 0); // rest steps
+  closeGate(gates, 1);
+  EXPECT_TRUE(Pin<ENV_OUT_PIN_1>::read());
+  EXPECT_TRUE(Pin<ENV_OUT_PIN_2>::read());
+  EXPECT_EQ(2, halTrace.countOf(HAL_PIN));
+}
@@ -0,0 +1,114 @@
+#include <gtest/gtest.h>
+
+#include "input_events.cpp"
+
+TEST(InputEventsTest, QueueKeepsOrder)
+{
+  EventQueue<8> queue;
+  InputEvent event;
+  EXPECT_FALSE(queue.pop(event));
+  for (int n = 0; n < 300; n++)
+  { // runs the free running indexes past their wrap
+    EXPECT_TRUE(queue.push(n & 1, n, n * 10));
+    EXPECT_TRUE(queue.push(EVENT_CLOCK, n + 1, n * 10 + 5));
+    ASSERT_TRUE(queue.pop(event));
+    EXPECT_EQ(uint16_t(n), event.value);
+    EXPECT_EQ(uint32_t(n * 10), event.us);
+    EXPECT_EQ(n & 1, event.type);
+    ASSERT_TRUE(queue.pop(event));
+    EXPECT_EQ(uint16_t(n + 1), event.value);
+  }
+  EXPECT_EQ(0, queue.count());
+  EXPECT_EQ(0, queue.dropped);
+}
+
+TEST(InputEventsTest, FullQueueDropsNewEvents)
+{
+  EventQueue<4> queue;
+  for (int n = 0; n < 6; n++)
+  {
+    queue.push(EVENT_CLOCK, n, 0);
+  }
+  EXPECT_EQ(4, queue.count());
+  EXPECT_EQ(2, queue.dropped);
+  InputEvent event;
+  queue.pop(event);
+  EXPECT_EQ(0, event.value); // the oldest events are kept
+}
+
+TEST(InputEventsTest, DetectorHysteresis)
+{
+  ThresholdDetector trig(TRIG_LOW_THRESHOLD, TRIG_HIGH_THRESHOLD);
+  EXPECT_EQ(0, trig.update(0));
+  EXPECT_EQ(0, trig.update(2200)); // inside the band
+  EXPECT_EQ(1, trig.update(2400));
+  EXPECT_EQ(0, trig.update(2000)); // noise inside the band does not retrigger
+  EXPECT_EQ(0, trig.update(2400));
+  EXPECT_EQ(-1, trig.update(1700));
+  EXPECT_EQ(0, trig.update(1900));
+  EXPECT_EQ(0, trig.update(100));
+}
+
+// 1 kHz clock and 0.5 ms record triggers while the loop only drains the queue every 60 ms
+// (a full display redraw). The ADC scans CV1/CV2 alternately at 16 kHz.
+TEST(InputEventsTest, NoEdgeLostAtOneKilohertz)
+{
+  EventQueue<EVENT_QUEUE_SIZE> queue;
+  ThresholdDetector trig(TRIG_LOW_THRESHOLD, TRIG_HIGH_THRESHOLD);
+  const uint32_t adc_period_us = 62;
+  uint32_t next_adc = 0;
+  uint32_t next_drain = 60000;
+  int clocks = 0, trigs = 0;
+  uint32_t last_clock = 0, last_trig = 0;
+  uint16_t cv1 = 0;
+  bool cv2_turn = false;
+  InputEvent event;
+
+  for (uint32_t us = 0; us < 1000000; us++)
+  {
+    if (us % 1000 == 0)
+    { // clock pin interrupt
+      queue.push(EVENT_CLOCK, 0, us);
+    }
+    if (us == next_adc)
+    { // ADC result ready interrupt
+      next_adc += adc_period_us;
+      if (!cv2_turn)
+      {
+        cv1 = (us / 1000) % 4096;
+      }
+      else
+      {
+        uint16_t cv2 = (us % 1000) < 500 ? 4000 : 50 + us % 37; // noisy low level
+        if (trig.update(cv2) < 0)
+        {
+          queue.push(EVENT_TRIG, cv1, us);
+        }
+      }
+      cv2_turn = !cv2_turn;
+    }
+    if (us == next_drain)
+    {
+      next_drain += 60000;
+      while (queue.pop(event))
+      {
+        if (event.type == EVENT_CLOCK)
+        {
+          EXPECT_TRUE(clocks == 0 || event.us - last_clock == 1000);
+          last_clock = event.us;
+          clocks++;
+        }
+        else
+        {
+          EXPECT_TRUE(trigs == 0 || event.us - last_trig <= 1000 + adc_period_us * 2);
+          EXPECT_EQ((event.us / 1000) % 4096, event.value);
+          last_trig = event.us;
+          trigs++;
+        }
+      }
+    }
+  }
+  EXPECT_EQ(0, queue.dropped);
+  EXPECT_GE(clocks, 959); // everything up to the last drain
+  EXPECT_GE(trigs, 958);
+}
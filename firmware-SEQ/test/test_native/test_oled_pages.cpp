@@ -0,0 +1,214 @@
+#include <gtest/gtest.h>
+
+#include "oled_pages.cpp"
+
+TEST(oledPages, StartsClean)
+{
+  DirtyPages dirty;
+  EXPECT_EQ(0, dirty.mask);
+  EXPECT_EQ(0, dirty.dirtyBytes());
+}
+
+TEST(oledPages, IndicatorSquareIsOnePage)
+{
+  DirtyPages dirty;
+  dirty.mark(32, 40, 8, 8);
+  EXPECT_EQ(1 << 5, dirty.mask);
+  EXPECT_EQ(32, dirty.colStart[5]);
+  EXPECT_EQ(39, dirty.colEnd[5]);
+  EXPECT_EQ(8, dirty.dirtyBytes());
+}
+
+TEST(oledPages, SpansMergePerPage)
+{
+  DirtyPages dirty;
+  dirty.mark(0, 40, 8, 8);
+  dirty.mark(96, 40, 8, 8);
+  EXPECT_EQ(0, dirty.colStart[5]);
+  EXPECT_EQ(103, dirty.colEnd[5]);
+}
+
+TEST(oledPages, RowsCrossingPages)
+{
+  DirtyPages dirty;
+  dirty.mark(70, 0, 58, 24);
+  EXPECT_EQ(0x07, dirty.mask);
+  EXPECT_EQ(3 * 58, dirty.dirtyBytes());
+  dirty.clear();
+  dirty.mark(10, 6, 2, 4);
+  EXPECT_EQ(0x03, dirty.mask);
+}
+
+TEST(oledPages, ClipsToScreen)
+{
+  DirtyPages dirty;
+  dirty.mark(-5, -5, 10, 10);
+  EXPECT_EQ(0x01, dirty.mask);
+  EXPECT_EQ(0, dirty.colStart[0]);
+  EXPECT_EQ(4, dirty.colEnd[0]);
+  dirty.clear();
+  dirty.mark(200, 10, 10, 10);
+  EXPECT_EQ(0, dirty.mask);
+  dirty.markAll();
+  EXPECT_EQ(OLED_PAGES * OLED_COLUMNS, dirty.dirtyBytes());
+}
+
+// Records what a flush sends
+struct FakeDisplay
+{
+  uint8_t buffer[OLED_PAGES * OLED_COLUMNS];
+
+  uint8_t *getBuffer()
+  {
+    return buffer;
+  }
+};
+
+struct FakeWire
+{
+  uint8_t address = 0;
+  uint32_t clock = 100000;
+  uint8_t sent[OLED_PAGES * OLED_COLUMNS]; // data bytes
+  int sentCount = 0;
+  uint8_t commands[64];
+  int commandCount = 0;
+  int commandTransfers = 0;
+  int transfers = 0; // data transfers
+  int slowTransfers = 0; // below OLED_BUS_CLOCK
+  int longestTransfer = 0;
+  uint8_t control = 0;
+  int transferBytes = 0;
+
+  void setClock(uint32_t hz)
+  {
+    clock = hz;
+  }
+
+  void beginTransmission(uint8_t to)
+  {
+    address = to;
+    transferBytes = 0;
+  }
+
+  void write(uint8_t data)
+  {
+    if (transferBytes++ == 0)
+    {
+      control = data;
+    }
+    else if (control == 0x00)
+    {
+      commands[commandCount++] = data;
+    }
+    else
+    {
+      sent[sentCount++] = data;
+    }
+  }
+
+  void endTransmission()
+  {
+    if (control == 0x00)
+    {
+      commandTransfers++;
+    }
+    else
+    {
+      transfers++;
+    }
+    slowTransfers += clock < OLED_BUS_CLOCK;
+    longestTransfer = transferBytes > longestTransfer ? transferBytes : longestTransfer;
+  }
+};
+
+static int betweenCalls = 0;
+static void countBetween()
+{
+  betweenCalls++;
+}
+
+static void fillBuffer(FakeDisplay &display)
+{
+  for (int n = 0; n < OLED_PAGES * OLED_COLUMNS; n++)
+  {
+    display.buffer[n] = n * 7;
+  }
+}
+
+TEST(oledPages, FlushSendsOnlyTheDirtySpans)
+{
+  static FakeDisplay display;
+  static FakeWire wire;
+  fillBuffer(display);
+  DirtyPages dirty;
+  dirty.mark(10, 8, 40, 8);  // page 1, 40 columns
+  dirty.mark(100, 56, 3, 1); // page 7, 3 columns
+  betweenCalls = 0;
+  flushDirtyPages(display, wire, 0x3C, dirty, 100000, countBetween);
+
+  EXPECT_EQ(0, dirty.mask);
+  EXPECT_EQ(0x3C, wire.address);
+  ASSERT_EQ(43, wire.sentCount);
+  EXPECT_EQ(display.buffer[OLED_COLUMNS + 10], wire.sent[0]);
+  EXPECT_EQ(display.buffer[OLED_COLUMNS + 49], wire.sent[39]);
+  EXPECT_EQ(display.buffer[7 * OLED_COLUMNS + 100], wire.sent[40]);
+  EXPECT_EQ(3, wire.transfers); // 31 + 9 columns, then 3
+  EXPECT_EQ(OLED_CHUNK + 1, wire.longestTransfer);
+  EXPECT_EQ(3, betweenCalls);
+
+  // each page is addressed in a single command transfer
+  EXPECT_EQ(2, wire.commandTransfers);
+  const uint8_t addresses[12] = {OLED_PAGE_ADDRESS, 1, 1, OLED_COLUMN_ADDRESS, 10, 49,
+                                 OLED_PAGE_ADDRESS, 7, 7, OLED_COLUMN_ADDRESS, 100, 102};
+  ASSERT_EQ(12, wire.commandCount);
+  for (int n = 0; n < 12; n++)
+  {
+    EXPECT_EQ(addresses[n], wire.commands[n]) << n;
+  }
+
+  // all of it at 400 kHz, then the bus goes back to the clock given
+  EXPECT_EQ(0, wire.slowTransfers);
+  EXPECT_EQ(100000u, wire.clock);
+}
+
+TEST(oledPages, FullRedrawStreamsLikeDisplay)
+{
+  static FakeDisplay display;
+  static FakeWire wire;
+  fillBuffer(display);
+  DirtyPages dirty;
+  dirty.markAll();
+  flushDirtyPages(display, wire, 0x3C, dirty, OLED_BUS_CLOCK);
+
+  // one address window over the whole screen, the transfers display() would make
+  EXPECT_EQ(1, wire.commandTransfers);
+  const uint8_t window[6] = {OLED_PAGE_ADDRESS, 0, OLED_PAGES - 1, OLED_COLUMN_ADDRESS, 0, OLED_COLUMNS - 1};
+  ASSERT_EQ(6, wire.commandCount);
+  for (int n = 0; n < 6; n++)
+  {
+    EXPECT_EQ(window[n], wire.commands[n]) << n;
+  }
+  EXPECT_EQ((OLED_PAGES * OLED_COLUMNS + OLED_CHUNK - 1) / OLED_CHUNK, wire.transfers);
+  ASSERT_EQ(OLED_PAGES * OLED_COLUMNS, wire.sentCount);
+  EXPECT_EQ(0, memcmp(display.buffer, wire.sent, sizeof(display.buffer)));
+  EXPECT_EQ(0, wire.slowTransfers);
+  EXPECT_EQ(uint32_t(OLED_BUS_CLOCK), wire.clock);
+}
+
+TEST(oledPages, PagesWithTheSameSpanShareAWindow)
+{
+  static FakeDisplay display;
+  static FakeWire wire;
+  fillBuffer(display);
+  DirtyPages dirty;
+  dirty.mark(20, 16, 10, 24); // pages 2 to 4, columns 20 to 29
+  flushDirtyPages(display, wire, 0x3C, dirty, OLED_BUS_CLOCK);
+
+  EXPECT_EQ(1, wire.commandTransfers);
+  EXPECT_EQ(2, wire.commands[1]);
+  EXPECT_EQ(4, wire.commands[2]);
+  ASSERT_EQ(30, wire.sentCount);
+  EXPECT_EQ(display.buffer[2 * OLED_COLUMNS + 29], wire.sent[9]);
+  EXPECT_EQ(display.buffer[3 * OLED_COLUMNS + 20], wire.sent[10]);
+  EXPECT_EQ(display.buffer[4 * OLED_COLUMNS + 29], wire.sent[29]);
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+
+#include "pattern_link.cpp"
+
+// RAM stand-in for the flash area , writes can only clear bits like real flash
+alignas(FLASH_ROW_SIZE) static uint8_t link_flash[PATTERN_AREA_SIZE];
+
+static void linkErase(const uint8_t *row)
+{
+  memset((uint8_t *)row, 0xFF, FLASH_ROW_SIZE);
+}
+
+static void linkWrite(const uint8_t *dst, const void *src, uint32_t size)
+{
+  for (uint32_t n = 0; n < size; n++)
+  {
+    ((uint8_t *)dst)[n] &= ((const uint8_t *)src)[n];
+  }
+}
+
+class PatternLinkTest : public ::testing::Test
+{
+protected:
+  PatternStore store;
+  uint8_t reply[LINK_MAX_FRAME];
+
+  void SetUp() override
+  {
+    memset(link_flash, 0, sizeof(link_flash));
+    store.begin(link_flash, linkErase, linkWrite);
+  }
+};
+
+TEST_F(PatternLinkTest, Info)
+{
+  const uint8_t request[] = {LINK_INFO};
+  ASSERT_EQ(LINK_INFO_SIZE, linkHandle(store, request, 1, reply));
+  EXPECT_EQ(LINK_INFO, reply[0]);
+  EXPECT_EQ(LINK_VERSION, reply[1]);
+  EXPECT_EQ(PATTERNS_PER_CHANNEL, reply[3]);
+  EXPECT_EQ(MAX_STEPS, reply[4]);
+}
+
+TEST_F(PatternLinkTest, WriteThenReadPattern)
+{
+  uint8_t request[LINK_PATTERN_SIZE] = {LINK_WRITE_PATTERN, 1, 5, 31};
+  Pattern data = {};
+  for (int n = 0; n < MAX_STEPS; n++)
+  {
+    data.steps[n] = makeStep(n % 61, n & 1, false, n % 8, 1 + n % 4);
+  }
+  memcpy(request + 4, &data, sizeof(data));
+  ASSERT_EQ(1, linkHandle(store, request, sizeof(request), reply));
+  EXPECT_EQ(LINK_WRITE_PATTERN, reply[0]);
+
+  // the directory was programmed , a reboot finds the pattern
+  PatternStore reloaded;
+  ASSERT_TRUE(reloaded.begin(link_flash, linkErase, linkWrite));
+  const uint8_t read[] = {LINK_READ_PATTERN, 1, 5};
+  ASSERT_EQ(LINK_PATTERN_SIZE, linkHandle(reloaded, read, sizeof(read), reply));
+  EXPECT_EQ(31, reply[3]);
+  EXPECT_EQ(0, memcmp(&data, reply + 4, sizeof(data)));
+}
+
+TEST_F(PatternLinkTest, Settings)
+{
+  uint8_t request[1 + PATTERN_SETTINGS] = {LINK_WRITE_SETTINGS};
+  for (int n = 0; n < PATTERN_SETTINGS; n++)
+  {
+    request[1 + n] = n * 3;
+  }
+  ASSERT_EQ(1, linkHandle(store, request, sizeof(request), reply));
+  const uint8_t read[] = {LINK_READ_SETTINGS};
+  ASSERT_EQ(1 + PATTERN_SETTINGS, linkHandle(store, read, 1, reply));
+  EXPECT_EQ(0, memcmp(request + 1, reply + 1, PATTERN_SETTINGS));
+}
+
+TEST_F(PatternLinkTest, Errors)
+{
+  const uint8_t unknown[] = {'x'};
+  ASSERT_EQ(3, linkHandle(store, unknown, 1, reply));
+  EXPECT_EQ(LINK_ERROR, reply[0]);
+  EXPECT_EQ('x', reply[1]);
+  EXPECT_EQ(LINK_ERR_COMMAND, reply[2]);
+
+  const uint8_t range[] = {LINK_READ_PATTERN, 2, 0};
+  linkHandle(store, range, sizeof(range), reply);
+  EXPECT_EQ(LINK_ERR_RANGE, reply[2]);
+
+  const uint8_t shortWrite[] = {LINK_WRITE_PATTERN, 0, 0, 0};
+  linkHandle(store, shortWrite, sizeof(shortWrite), reply);
+  EXPECT_EQ(LINK_ERR_LENGTH, reply[2]);
+}
+
+TEST_F(PatternLinkTest, NotesPastTheTableAreRejected)
+{
+  uint8_t request[LINK_PATTERN_SIZE] = {LINK_WRITE_PATTERN, 0, 2, 15};
+  Pattern data = {};
+  data.steps[9] = makeStep(MAX_NOTE, true);
+  data.steps[10] = STEP_GATE | (MAX_NOTE + 1); // 6 note bits hold up to 63
+  memcpy(request + 4, &data, sizeof(data));
+  ASSERT_EQ(3, linkHandle(store, request, sizeof(request), reply));
+  EXPECT_EQ(LINK_ERROR, reply[0]);
+  EXPECT_EQ(LINK_ERR_RANGE, reply[2]);
+
+  // nothing was written
+  PatternStore reloaded;
+  reloaded.begin(link_flash, linkErase, linkWrite);
+  EXPECT_EQ(&emptyPattern, reloaded.pattern(0, 2));
+}
+
+TEST_F(PatternLinkTest, FramesCarryACRC)
+{
+  ByteRing<1024> ring;
+  SlipDecoder<LINK_MAX_FRAME> decoder;
+  uint8_t payload[LINK_MAX_FRAME] = {LINK_READ_PATTERN, 0, 3};
+  ASSERT_TRUE(linkSend(ring, payload, 3));
+
+  uint8_t byte;
+  uint16_t size = 0;
+  while (ring.pop(byte) && !size)
+  {
+    size = decoder.feed(byte);
+  }
+  ASSERT_EQ(3 + LINK_CRC_SIZE, size);
+  EXPECT_EQ(3, linkPayload(decoder.frame, size));
+  decoder.frame[1] ^= 1;
+  EXPECT_EQ(-1, linkPayload(decoder.frame, size));
+  EXPECT_EQ(-1, linkPayload(decoder.frame, LINK_CRC_SIZE));
+}
@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include "pattern_store.cpp"
+
+// RAM stand-in for the flash area. Writes can only clear bits like real flash, so a
+// missing erase shows up as corrupted data.
+alignas(FLASH_ROW_SIZE) static uint8_t flash[PATTERN_AREA_SIZE];
+static int erases = 0;
+
+static void fakeErase(const uint8_t *row)
+{
+  memset((uint8_t *)row, 0xFF, FLASH_ROW_SIZE);
+  erases++;
+}
+
+static void fakeWrite(const uint8_t *dst, const void *src, uint32_t size)
+{
+  uint8_t *out = (uint8_t *)dst;
+  const uint8_t *in = (const uint8_t *)src;
+  for (uint32_t n = 0; n < size; n++)
+  {
+    out[n] &= in[n];
+  }
+}
+
+class PatternStoreTest : public ::testing::Test
+{
+protected:
+  PatternStore store;
+  EditOverlay overlay;
+
+  void SetUp() override
+  {
+    memset(flash, 0, sizeof(flash)); // freshly uploaded firmware
+    erases = 0;
+  }
+};
+
+TEST_F(PatternStoreTest, LayoutFitsFlashRows)
+{
+  EXPECT_EQ(FLASH_ROW_SIZE, int(sizeof(Pattern)));
+  EXPECT_EQ((1 + 2 * PATTERNS_PER_CHANNEL) * FLASH_ROW_SIZE, PATTERN_AREA_SIZE);
+}
+
+TEST_F(PatternStoreTest, StepRAMBelowTheOldArrays)
+{
+  // the old stepcv and stepgate arrays took 2 x 2 x 128 bytes, now only the edit is in RAM
+  EXPECT_LT(sizeof(EditOverlay), 2u * 2 * 128);
+}
+
+TEST_F(PatternStoreTest, BlankFlashStartsEmpty)
+{
+  EXPECT_FALSE(store.begin(flash, fakeErase, fakeWrite));
+  for (int ch = 0; ch < 2; ch++)
+  {
+    for (int p = 0; p < PATTERNS_PER_CHANNEL; p++)
+    {
+      EXPECT_EQ(&emptyPattern, store.pattern(ch, p));
+      EXPECT_EQ(0, store.dir.lastStep[ch][p]);
+    }
+  }
+  EXPECT_EQ(0, erases); // nothing is written at boot
+}
+
+TEST_F(PatternStoreTest, PatternsAreReadInPlace)
+{
+  store.begin(flash, fakeErase, fakeWrite);
+  overlay.begin(1, 3);
+  overlay.write(0, makeStep(24, true));
+  overlay.commit(store, 0);
+
+  const Pattern *played = store.pattern(1, 3);
+  EXPECT_EQ((const Pattern *)(flash + (1 + PATTERNS_PER_CHANNEL + 3) * FLASH_ROW_SIZE), played);
+  EXPECT_EQ(24, stepNote(played->steps[0]));
+  EXPECT_TRUE(stepGate(played->steps[0]));
+}
+
+TEST_F(PatternStoreTest, OverlayMergesOverFlash)
+{
+  store.begin(flash, fakeErase, fakeWrite);
+  overlay.begin(0, 0);
+  for (int n = 0; n < 8; n++)
+  {
+    overlay.write(n, makeStep(n, true));
+  }
+  overlay.commit(store, 7);
+
+  // Re-record two steps, the others still come from flash
+  overlay.begin(0, 0);
+  overlay.write(2, makeStep(40, false));
+  overlay.write(5, makeStep(41, true, true));
+  const Pattern *base = store.pattern(0, 0);
+  for (int n = 0; n < 8; n++)
+  {
+    Step step = overlay.stepAt(base, n);
+    if (n == 2)
+    {
+      EXPECT_EQ(makeStep(40, false), step);
+    }
+    else if (n == 5)
+    {
+      EXPECT_EQ(makeStep(41, true, true), step);
+    }
+    else
+    {
+      EXPECT_EQ(makeStep(n, true), step);
+    }
+  }
+  EXPECT_EQ(makeStep(3, true), base->steps[3]);
+  EXPECT_EQ(makeStep(2, true), base->steps[2]); // flash untouched until commit
+
+  overlay.commit(store, 7);
+  EXPECT_FALSE(overlay.active());
+  EXPECT_EQ(makeStep(40, false), store.pattern(0, 0)->steps[2]);
+  EXPECT_EQ(makeStep(41, true, true), store.pattern(0, 0)->steps[5]);
+  EXPECT_EQ(makeStep(7, true), store.pattern(0, 0)->steps[7]);
+}
+
+TEST_F(PatternStoreTest, SurvivesReboot)
+{
+  store.begin(flash, fakeErase, fakeWrite);
+  overlay.begin(0, 1);
+  overlay.write(10, makeStep(33, true));
+  store.dir.settings[0] = 1;
+  overlay.commit(store, 10);
+
+  PatternStore rebooted;
+  EXPECT_TRUE(rebooted.begin(flash, fakeErase, fakeWrite));
+  EXPECT_EQ(10, rebooted.dir.lastStep[0][1]);
+  EXPECT_EQ(1, rebooted.dir.settings[0]);
+  EXPECT_EQ(makeStep(33, true), rebooted.pattern(0, 1)->steps[10]);
+  EXPECT_EQ(&emptyPattern, rebooted.pattern(0, 0));
+}
+
+TEST_F(PatternStoreTest, CorruptDirectoryIsRejected)
+{
+  store.begin(flash, fakeErase, fakeWrite);
+  overlay.begin(0, 0);
+  overlay.write(0, makeStep(1, true));
+  overlay.commit(store, 0);
+  flash[offsetof(PatternDirectory, lastStep)] ^= 0x01;
+
+  PatternStore rebooted;
+  EXPECT_FALSE(rebooted.begin(flash, fakeErase, fakeWrite));
+  EXPECT_EQ(&emptyPattern, rebooted.pattern(0, 0));
+}
+
+TEST_F(PatternStoreTest, CommitOnlyTouchesItsRow)
+{
+  store.begin(flash, fakeErase, fakeWrite);
+  overlay.begin(0, 0);
+  overlay.write(0, makeStep(5, true));
+  overlay.commit(store, 0);
+  erases = 0;
+  overlay.begin(1, 7);
+  overlay.write(0, makeStep(6, true));
+  overlay.commit(store, 0);
+  EXPECT_EQ(2, erases); // pattern row + directory
+  EXPECT_EQ(makeStep(5, true), store.pattern(0, 0)->steps[0]);
+  EXPECT_EQ(makeStep(6, true), store.pattern(1, 7)->steps[0]);
+}
@@ -0,0 +1,145 @@
+#include <gtest/gtest.h>
+
+#include "quantize.cpp"
+
+// Input threshold table of the original scan
+static const int cv_qnt_thr[62] = {
+    0, 9, 26, 43, 60, 77, 94, 111, 128, 145, 162, 179, 196, 213, 230, 247, 264, 281, 298, 315, 332, 349, 366, 383, 400, 417, 434, 451, 468, 485, 502, 519, 536, 553, 570, 587, 604, 621, 638, 655, 672, 689, 706, 723, 740, 757, 774, 791, 808, 825, 842, 859, 876, 893, 910, 927, 944, 961, 978, 995, 1012, 1024};
+
+TEST(QuantizeTest, MatchesThresholdTable)
+{
+  for (int code = 0; code < 1024; code++)
+  {
+    int expected = -1;
+    for (int n = 0; n < 61; n++)
+    {
+      if (code >= cv_qnt_thr[n] && code < cv_qnt_thr[n + 1])
+      {
+        expected = n;
+      }
+    }
+    ASSERT_EQ(expected, noteFromADC(code)) << "code " << code;
+  }
+}
+
+TEST(QuantizeTest, ClampsOutOfRange)
+{
+  EXPECT_EQ(0, noteFromADC(-5));
+  EXPECT_EQ(MAX_NOTE, noteFromADC(1024)); // calibration can push the reading past 10 bit
+  EXPECT_EQ(MAX_NOTE, noteFromADC(1110));
+}
+
+TEST(QuantizeTest, ChromaticDoesNotSnap)
+{
+  ScaleSnap scale;
+  scale.build(scaleMask(0));
+  for (int note = 0; note <= MAX_NOTE; note++)
+  {
+    EXPECT_EQ(note, scale.snap(note));
+  }
+}
+
+TEST(QuantizeTest, SnapsToNearestScaleNote)
+{
+  ScaleSnap major;
+  major.build(scaleMask(1));
+  EXPECT_EQ(0, major.snap(1));   // C# ties between C and D , goes down
+  EXPECT_EQ(4, major.snap(4));
+  EXPECT_EQ(5, major.snap(6));   // F# -> F
+  EXPECT_EQ(35, major.snap(35)); // B
+  EXPECT_EQ(24 + 9, major.snap(24 + 10)); // A# -> A
+
+  ScaleSnap pentatonic;
+  pentatonic.build(scaleMask(8));
+  EXPECT_EQ(12, pentatonic.snap(13)); // C# -> C
+  EXPECT_EQ(15, pentatonic.snap(14)); // D -> D#
+  EXPECT_EQ(22, pentatonic.snap(23)); // B ties between A# and C , goes down
+  EXPECT_EQ(24, pentatonic.snap(25)); // C# -> C
+  for (int note = 0; note <= MAX_NOTE; note++)
+  {
+    uint8_t snapped = pentatonic.snap(note);
+    EXPECT_LE(snapped, MAX_NOTE);
+    EXPECT_TRUE(scaleMask(8) & (1 << (snapped % 12))) << note;
+  }
+}
+
+TEST(QuantizeTest, MasksFromTheSharedScales)
+{
+  const uint16_t expected[] = {0xFFF, 0xAB5, 0x5AD, 0x6AD, 0x5AB, 0xAD5, 0x6B5, 0x56B, 0x4A9, 0x9AD, 0xAAD, 0x555, 0x2DB};
+  ASSERT_EQ(sizeof(expected) / sizeof(expected[0]), size_t(NUM_SCALES));
+  for (int n = 0; n < NUM_SCALES; n++)
+  {
+    EXPECT_EQ(expected[n], scaleMask(n)) << scaleNames[n];
+  }
+}
+
+TEST(QuantizeTest, TransposeBySemitones)
+{
+  ScaleSnap chromatic;
+  chromatic.build(scaleMask(0));
+  ScaleDegrees degrees;
+  degrees.build(scaleMask(0));
+  EXPECT_EQ(17, transposeNote(10, 7, TRANSPOSE_SEMITONE, chromatic, degrees));
+  EXPECT_EQ(50, transposeNote(50, 12, TRANSPOSE_SEMITONE, chromatic, degrees)); // 62 folds to 50
+  EXPECT_EQ(10, transposeNote(10, 7, TRANSPOSE_OFF, chromatic, degrees));
+
+  ScaleSnap major;
+  major.build(scaleMask(1));
+  degrees.build(scaleMask(1));
+  EXPECT_EQ(5, transposeNote(0, 6, TRANSPOSE_SEMITONE, major, degrees)); // F# snaps to F
+}
+
+// Reference fold , one octave (of semitones or of degrees) per pass
+static int foldByLoop(int value, int limit, int octave)
+{
+  while (value > limit)
+  {
+    value -= octave;
+  }
+  return value;
+}
+
+TEST(QuantizeTest, TransposeFoldsEveryInput)
+{
+  for (int scale = 0; scale < NUM_SCALES; scale++)
+  {
+    ScaleSnap snap;
+    snap.build(scaleMask(scale));
+    ScaleDegrees degrees;
+    degrees.build(scaleMask(scale));
+    for (int stored = 0; stored < 256; stored++)
+    {
+      for (int amount = 0; amount < 256; amount++)
+      {
+        int s = stored > MAX_NOTE ? MAX_NOTE : stored;
+        int a = amount > MAX_NOTE ? MAX_NOTE : amount;
+        ASSERT_EQ(snap.snap(foldByLoop(s + a, MAX_NOTE, 12)), transposeNote(stored, amount, TRANSPOSE_SEMITONE, snap, degrees));
+        int degree = foldByLoop(degrees.degree[snap.snap(s)] + a, degrees.count - 1, degrees.perOctave);
+        ASSERT_EQ(degrees.note[degree], transposeNote(stored, amount, TRANSPOSE_DEGREE, snap, degrees));
+      }
+    }
+  }
+}
+
+TEST(QuantizeTest, TransposeByDegrees)
+{
+  ScaleSnap major;
+  major.build(scaleMask(1));
+  ScaleDegrees degrees;
+  degrees.build(scaleMask(1));
+  EXPECT_EQ(7, degrees.perOctave);
+  EXPECT_EQ(36, degrees.count); // 5 octaves of 7 plus the top C
+  EXPECT_EQ(4, transposeNote(0, 2, TRANSPOSE_DEGREE, major, degrees));    // C + 2 degrees = E
+  EXPECT_EQ(12, transposeNote(11, 1, TRANSPOSE_DEGREE, major, degrees));  // B + 1 = C
+  EXPECT_EQ(14, transposeNote(9, 3, TRANSPOSE_DEGREE, major, degrees));   // A + 3 = B , C , D
+  EXPECT_EQ(2, transposeNote(1, 1, TRANSPOSE_DEGREE, major, degrees));    // C# snaps to C first
+  for (int stored = 0; stored <= MAX_NOTE; stored++)
+  {
+    for (int amount = 0; amount <= MAX_NOTE; amount++)
+    {
+      uint8_t note = transposeNote(stored, amount, TRANSPOSE_DEGREE, major, degrees);
+      ASSERT_LE(note, MAX_NOTE);
+      ASSERT_TRUE(scaleMask(1) & (1 << (note % 12)));
+    }
+  }
+}
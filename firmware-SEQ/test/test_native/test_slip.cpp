@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include "slip.cpp"
+
+template <uint16_t SIZE, uint16_t MAX>
+static uint16_t decodeAll(ByteRing<SIZE> &ring, SlipDecoder<MAX> &decoder)
+{
+  uint8_t byte;
+  uint16_t size = 0;
+  while (ring.pop(byte))
+  {
+    uint16_t n = decoder.feed(byte);
+    if (n)
+    {
+      size = n;
+    }
+  }
+  return size;
+}
+
+TEST(slip, EscapesEndAndEsc)
+{
+  ByteRing<16> ring;
+  const uint8_t data[] = {1, SLIP_END, SLIP_ESC, 2};
+  ASSERT_TRUE(slipEncode(ring, data, sizeof(data)));
+  const uint8_t expected[] = {SLIP_END, 1, SLIP_ESC, SLIP_ESC_END, SLIP_ESC, SLIP_ESC_ESC, 2, SLIP_END};
+  ASSERT_EQ(sizeof(expected), ring.count());
+  for (uint8_t byte : expected)
+  {
+    uint8_t out;
+    ring.pop(out);
+    EXPECT_EQ(byte, out);
+  }
+}
+
+TEST(slip, RoundTripAllByteValues)
+{
+  ByteRing<1024> ring;
+  SlipDecoder<256> decoder;
+  uint8_t data[256];
+  for (int n = 0; n < 256; n++)
+  {
+    data[n] = n;
+  }
+  ASSERT_TRUE(slipEncode(ring, data, sizeof(data)));
+  ASSERT_EQ(256, decodeAll(ring, decoder));
+  EXPECT_EQ(0, memcmp(data, decoder.frame, sizeof(data)));
+}
+
+TEST(slip, DecodesByteByByteAcrossFrames)
+{
+  ByteRing<64> ring;
+  SlipDecoder<8> decoder;
+  const uint8_t first[] = {'a', 'b'};
+  const uint8_t second[] = {SLIP_END, 'c', 'd'};
+  slipEncode(ring, first, sizeof(first));
+  slipEncode(ring, second, sizeof(second));
+
+  uint8_t byte;
+  int frames = 0;
+  while (ring.pop(byte))
+  {
+    uint16_t size = decoder.feed(byte);
+    if (size == 2)
+    {
+      EXPECT_EQ(0, memcmp(first, decoder.frame, 2));
+      frames++;
+    }
+    else if (size == 3)
+    {
+      EXPECT_EQ(0, memcmp(second, decoder.frame, 3));
+      frames++;
+    }
+  }
+  EXPECT_EQ(2, frames);
+}
+
+TEST(slip, DropsOversizedFrames)
+{
+  ByteRing<64> ring;
+  SlipDecoder<4> decoder;
+  const uint8_t big[] = {1, 2, 3, 4, 5, 6};
+  const uint8_t small[] = {7, 8};
+  slipEncode(ring, big, sizeof(big));
+  EXPECT_EQ(0, decodeAll(ring, decoder));
+  slipEncode(ring, small, sizeof(small));
+  EXPECT_EQ(2, decodeAll(ring, decoder));
+}
+
+TEST(slip, RefusesFramesThatMayNotFit)
+{
+  ByteRing<8> ring;
+  const uint8_t data[] = {1, 2, 3, 4};
+  EXPECT_FALSE(slipEncode(ring, data, sizeof(data)));
+  EXPECT_EQ(0, ring.count());
+  EXPECT_TRUE(slipEncode(ring, data, 3));
+  EXPECT_EQ(5, ring.count());
+}
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+
+#include "step_grid.cpp"
+
+// Check every stale cell the way the display does , returns the cells drawn
+static int update(StepGrid &grid, const Step *steps, DirtyPages &dirty)
+{
+  int drawn = 0;
+  uint8_t n;
+  while (grid.nextStale(n))
+  {
+    if (grid.show(n, grid.state(n, steps[n]), dirty))
+    {
+      drawn++;
+    }
+  }
+  return drawn;
+}
+
+TEST(stepGrid, FirstUpdateDrawsThePattern)
+{
+  Step steps[MAX_STEPS] = {makeStep(1, 1), makeStep(2, 0), makeStep(3, 1), makeStep(4, 1)};
+  StepGrid grid(0);
+  DirtyPages dirty;
+  grid.follow(0, 3);
+  // step 0 is under the playhead and stays empty
+  EXPECT_EQ(3, update(grid, steps, dirty));
+  EXPECT_EQ(CELL_REST, grid.shown[1]);
+  EXPECT_EQ(CELL_GATE, grid.shown[2]);
+  EXPECT_EQ(CELL_EMPTY, grid.shown[4]);
+  EXPECT_EQ(0x01, dirty.mask);
+}
+
+TEST(stepGrid, ClockRedrawsOnlyThePlayheadCells)
+{
+  Step steps[MAX_STEPS] = {makeStep(1, 1), makeStep(2, 1), makeStep(3, 1), makeStep(4, 1)};
+  StepGrid grid(32);
+  DirtyPages dirty;
+  grid.follow(0, 3);
+  update(grid, steps, dirty);
+  dirty.clear();
+
+  grid.follow(1, 3);
+  EXPECT_EQ(2, update(grid, steps, dirty));
+  EXPECT_EQ(1 << 4, dirty.mask);
+  EXPECT_EQ(GRID_X, dirty.colStart[4]);
+  EXPECT_EQ(GRID_X + GRID_CELL_PITCH + GRID_CELL_WIDTH - 1, dirty.colEnd[4]);
+
+  dirty.clear();
+  grid.follow(1, 3);
+  EXPECT_EQ(0, update(grid, steps, dirty));
+  EXPECT_EQ(0, dirty.mask);
+}
+
+TEST(stepGrid, RecordedStepAndLengthChanges)
+{
+  Step steps[MAX_STEPS] = {makeStep(1, 1), makeStep(2, 1)};
+  StepGrid grid(0);
+  DirtyPages dirty;
+  grid.follow(0, 1);
+  update(grid, steps, dirty);
+
+  steps[1] = makeStep(2, 0);
+  grid.invalidate(1);
+  EXPECT_EQ(1, update(grid, steps, dirty));
+  EXPECT_EQ(CELL_REST, grid.shown[1]);
+
+  steps[2] = makeStep(5, 1);
+  steps[17] = makeStep(5, 1);
+  grid.follow(0, 17);
+  EXPECT_EQ(16, update(grid, steps, dirty));
+  EXPECT_EQ(CELL_GATE, grid.shown[17]);
+
+  grid.follow(0, 1);
+  EXPECT_EQ(16, update(grid, steps, dirty));
+  EXPECT_EQ(CELL_EMPTY, grid.shown[17]);
+}
+
+TEST(stepGrid, CellGeometry)
+{
+  StepGrid grid(32);
+  EXPECT_EQ(GRID_X, grid.cellX(0));
+  EXPECT_EQ(34, grid.cellY(0));
+  EXPECT_EQ(GRID_X + 15 * GRID_CELL_PITCH, grid.cellX(31));
+  EXPECT_EQ(38, grid.cellY(31));
+  EXPECT_EQ(62, grid.cellY(MAX_STEPS - 1));
+}
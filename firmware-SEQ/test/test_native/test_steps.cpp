@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+
+#include "steps.cpp"
+
+TEST(steps, ZeroIsSilentLowestNote)
+{
+  Step step = 0;
+  EXPECT_EQ(0, stepNote(step));
+  EXPECT_FALSE(stepGate(step));
+  EXPECT_FALSE(stepTie(step));
+  EXPECT_EQ(0, stepSkip(step));
+}
+
+TEST(steps, FieldsRoundTrip)
+{
+  for (uint8_t note = 0; note <= MAX_NOTE; note++)
+  {
+    for (uint8_t skip = 0; skip < 8; skip++)
+    {
+      Step step = makeStep(note, note & 1, note & 2, skip);
+      EXPECT_EQ(note, stepNote(step));
+      EXPECT_EQ(bool(note & 1), stepGate(step));
+      EXPECT_EQ(bool(note & 2), stepTie(step));
+      EXPECT_EQ(skip, stepSkip(step));
+    }
+  }
+}
+
+TEST(steps, RatchetsRoundTrip)
+{
+  EXPECT_EQ(1, stepRatchets(0));
+  for (uint8_t ratchets = 1; ratchets <= MAX_STEP_RATCHETS; ratchets++)
+  {
+    Step step = makeStep(MAX_NOTE, true, true, 7, ratchets);
+    EXPECT_EQ(ratchets, stepRatchets(step));
+    EXPECT_EQ(MAX_NOTE, stepNote(step));
+    EXPECT_EQ(7, stepSkip(step));
+    EXPECT_TRUE(stepTie(step));
+  }
+}
+
+TEST(steps, ChanceFollowsSkip)
+{
+  StepChance chance;
+  for (uint8_t skip = 0; skip < 8; skip++)
+  {
+    Step step = makeStep(0, true, false, skip);
+    int played = 0;
+    for (int n = 0; n < 8000; n++)
+    {
+      played += chance.plays(step);
+    }
+    int expected = 8000 * (8 - skip) / 8;
+    EXPECT_NEAR(expected, played, 250) << "skip " << int(skip);
+  }
+}
+
+TEST(steps, NoteIsClamped)
+{
+  EXPECT_EQ(MAX_NOTE, stepNote(makeStep(99, true)));
+  EXPECT_EQ(MAX_NOTE, stepNote(setStepNote(0, 70)));
+}
+
+TEST(steps, SettersKeepOtherFields)
+{
+  Step step = makeStep(12, true, true, 3);
+  step = setStepNote(step, 40);
+  EXPECT_EQ(40, stepNote(step));
+  EXPECT_TRUE(stepGate(step));
+  EXPECT_TRUE(stepTie(step));
+  EXPECT_EQ(3, stepSkip(step));
+  step = setStepGate(step, false);
+  EXPECT_FALSE(stepGate(step));
+  EXPECT_EQ(40, stepNote(step));
+}
+
+TEST(steps, PatternIsTwoBytesPerStep)
+{
+  EXPECT_EQ(2u, sizeof(Step));
+  EXPECT_EQ(MAX_STEPS * 2u, sizeof(Pattern));
+}
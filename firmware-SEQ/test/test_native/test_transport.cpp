@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+
+#include "transport.cpp"
+
+TEST(TransportTest, ForwardWrapsAtLoopEnd)
+{
+  Transport transport;
+  transport.configure(2, 5, DIR_FORWARD);
+  for (int n = 0; n < 4000; n++)
+  {
+    ASSERT_TRUE(transport.clock(1));
+    EXPECT_EQ(2 + n % 4, transport.next());
+  }
+}
+
+TEST(TransportTest, ReverseRunsBackwards)
+{
+  Transport transport;
+  transport.configure(0, 15, DIR_REVERSE);
+  for (int n = 0; n < 4000; n++)
+  {
+    EXPECT_EQ(15 - n % 16, transport.next());
+  }
+}
+
+TEST(TransportTest, PingPongDoesNotRepeatEnds)
+{
+  Transport transport;
+  transport.configure(3, 6, DIR_PINGPONG);
+  const uint8_t pass[] = {3, 4, 5, 6, 5, 4};
+  EXPECT_EQ(6, transport.length);
+  for (int n = 0; n < 6000; n++)
+  {
+    EXPECT_EQ(pass[n % 6], transport.next());
+  }
+  transport.configure(7, 7, DIR_PINGPONG); // single step loop
+  for (int n = 0; n < 100; n++)
+  {
+    EXPECT_EQ(7, transport.next());
+  }
+  transport.configure(0, MAX_STEPS - 1, DIR_PINGPONG);
+  EXPECT_EQ(ORDER_SIZE, transport.length);
+}
+
+TEST(TransportTest, RandomPlaysEveryStepOncePerPass)
+{
+  Transport transport;
+  transport.configure(8, 23, DIR_RANDOM);
+  int same_as_forward = 0;
+  for (int pass = 0; pass < 500; pass++)
+  {
+    uint32_t seen = 0;
+    bool forward = true;
+    for (int n = 0; n < 16; n++)
+    {
+      uint8_t step = transport.next();
+      ASSERT_GE(step, 8);
+      ASSERT_LE(step, 23);
+      seen |= 1UL << (step - 8);
+      forward = forward && step == 8 + n;
+    }
+    EXPECT_EQ(0xFFFFu, seen);
+    same_as_forward += forward;
+  }
+  EXPECT_LT(same_as_forward, 2);
+}
+
+TEST(TransportTest, DivisionCountsClocks)
+{
+  for (unsigned r = 0; r < NUM_RATES; r++)
+  {
+    Transport transport;
+    int steps = 0;
+    for (int tick = 0; tick < 6400; tick++)
+    {
+      bool due = transport.clock(rates[r].division);
+      EXPECT_EQ(tick % rates[r].division == 0, due);
+      steps += due ? rates[r].multiplication : 0;
+    }
+    EXPECT_EQ(6400 / rates[r].division * rates[r].multiplication, steps);
+  }
+}
+
+TEST(TransportTest, LoopChangeKeepsPlayheadInRange)
+{
+  Transport transport;
+  transport.configure(0, 63, DIR_PINGPONG);
+  uint32_t rng = 1;
+  for (int tick = 0; tick < 10000; tick++)
+  {
+    if (tick % 37 == 0)
+    {
+      rng = rng * 1103515245 + 12345;
+      uint8_t a = (rng >> 8) % MAX_STEPS;
+      uint8_t b = (rng >> 16) % MAX_STEPS;
+      transport.configure(a, b, (rng >> 24) % NUM_DIRECTIONS);
+    }
+    uint8_t step = transport.next();
+    ASSERT_GE(step, transport.start);
+    ASSERT_LE(step, transport.end);
+    ASSERT_LT(transport.position, transport.length);
+  }
+}
+
+TEST(TransportTest, ResetRestartsTheLoop)
+{
+  Transport transport;
+  transport.configure(4, 9, DIR_FORWARD);
+  transport.clock(4);
+  transport.next();
+  transport.next();
+  transport.reset();
+  EXPECT_TRUE(transport.clock(4));
+  EXPECT_EQ(4, transport.next());
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+// CRC-16/CCITT-FALSE
+inline uint16_t crc16(const void *data, uint32_t size, uint16_t crc = 0xFFFF)
+{
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (size--)
+  {
+    crc ^= uint16_t(*bytes++) << 8;
+    for (uint8_t bit = 0; bit < 8; bit++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
@@ -0,0 +1,224 @@
+#pragma once
+#include <stdint.h>
+
+// Hardware of the module, shared by the four firmwares
+// The XIAO SAMD21 board: pins, the internal DAC (CV1), the MCP4725 (CV2) on I2C, the gate
+// and envelope outputs, and the OLED. On the board the output writes are inline register
+// accesses so they can run in the clock interrupts. In the native build the same calls go
+// to a fake that records every write with a virtual timestamp. The tests can then check
+// what an edge puts on the outputs, in which order, and how long the bus keeps it busy.
+
+#ifdef ARDUINO_ARCH_SAMD
+#include <Arduino.h>
+#include <Wire.h>
+#include <Adafruit_SSD1306.h>
+#endif
+
+// Pins
+#ifndef IN_SIMULATOR
+#define CLK_IN_PIN 7     // Clock input pin
+#define CV_1_IN_PIN 8    // channel 1 analog in
+#define CV_2_IN_PIN 9    // channel 2 analog in
+#define ENC_PIN_1 3      // rotary encoder left pin
+#define ENC_PIN_2 6      // rotary encoder right pin
+#define ENC_CLICK_PIN 10 // pin for encoder switch
+#else
+// Pins of the simulator
+#define CLK_IN_PIN 12
+#define ENC_PIN_1 4
+#define ENC_PIN_2 3
+#define ENC_CLICK_PIN 2
+#endif
+#define OUT_PIN_1 1 // gate / envelope outputs
+#define OUT_PIN_2 2
+#ifdef ARDUINO_ARCH_SAMD
+#define DAC_INTERNAL_PIN A0 // DAC output pin (internal). Second DAC output goes to MCP4725 via I2C
+#endif
+
+#define MCP4725_ADDRESS 0x60
+#define OLED_ADDRESS 0x3C
+#define SCREEN_WIDTH 128
+#define SCREEN_HEIGHT 64
+
+#define PWM_FREQUENCY 46000
+
+#ifndef ARDUINO_ARCH_SAMD
+// Native fake: the outputs of the module as a list of timestamped writes
+#define HAL_TRACE_SIZE 256
+#define HAL_PINS 16
+#define HAL_I2C_BYTE_US 23 // a byte and its ack at 400 kHz
+
+enum
+{
+  HAL_PIN, // channel = pin, value = level
+  HAL_DAC, // value = 12 bit code
+  HAL_MCP, // value = 12 bit code
+  HAL_PWM  // channel = pin, value = duty
+};
+
+struct HalEvent
+{
+  uint32_t us;
+  uint8_t device;
+  uint8_t channel;
+  uint16_t value;
+};
+
+struct HalTrace
+{
+  uint32_t now = 0;                 // virtual microseconds
+  HalEvent events[HAL_TRACE_SIZE];
+  uint16_t count = 0;
+  bool overflow = 0;                // writes were dropped
+  bool level[HAL_PINS];             // what the pins read
+
+  void clear()
+  {
+    count = 0;
+    overflow = 0;
+  }
+
+  void advance(uint32_t us)
+  {
+    now += us;
+  }
+
+  void record(uint8_t device, uint8_t channel, uint16_t value)
+  {
+    if (count == HAL_TRACE_SIZE)
+    {
+      overflow = 1;
+      return;
+    }
+    events[count++] = {now, device, channel, value};
+  }
+
+  // Writes to a device (and channel) since the last clear
+  int countOf(uint8_t device, int channel = -1) const
+  {
+    int n = 0;
+    for (int k = 0; k < count; k++)
+    {
+      n += events[k].device == device && (channel < 0 || events[k].channel == channel);
+    }
+    return n;
+  }
+
+  // Newest write to a device (and channel), nullptr when there is none
+  const HalEvent *last(uint8_t device, int channel = -1) const
+  {
+    for (int k = count - 1; k >= 0; k--)
+    {
+      if (events[k].device == device && (channel < 0 || events[k].channel == channel))
+      {
+        return &events[k];
+      }
+    }
+    return nullptr;
+  }
+};
+
+inline HalTrace halTrace;
+#endif
+
+// Digital pin fixed at compile time. A write is one store to the set or clear register of its port.
+template <uint8_t PIN>
+struct Pin
+{
+  static void write(bool high)
+  {
+#ifdef ARDUINO_ARCH_SAMD
+    const PinDescription &pin = g_APinDescription[PIN];
+    if (high)
+    {
+      PORT->Group[pin.ulPort].OUTSET.reg = 1UL << pin.ulPin;
+    }
+    else
+    {
+      PORT->Group[pin.ulPort].OUTCLR.reg = 1UL << pin.ulPin;
+    }
+#else
+    halTrace.record(HAL_PIN, PIN, high);
+    halTrace.level[PIN] = high;
+#endif
+  }
+
+  static bool read()
+  {
+#ifdef ARDUINO_ARCH_SAMD
+    const PinDescription &pin = g_APinDescription[PIN];
+    return (PORT->Group[pin.ulPort].IN.reg >> pin.ulPin) & 1;
+#else
+    return halTrace.level[PIN];
+#endif
+  }
+};
+
+// 10 bit PWM, resolution set by halBegin()
+inline void PWM1(int duty)
+{
+#ifdef ARDUINO_ARCH_SAMD
+  pwm(OUT_PIN_1, PWM_FREQUENCY, duty);
+#else
+  halTrace.record(HAL_PWM, OUT_PIN_1, duty);
+#endif
+}
+
+inline void PWM2(int duty)
+{
+#ifdef ARDUINO_ARCH_SAMD
+  pwm(OUT_PIN_2, PWM_FREQUENCY, duty);
+#else
+  halTrace.record(HAL_PWM, OUT_PIN_2, duty);
+#endif
+}
+
+// CV1: a 12 bit code on the 10 bit internal DAC
+inline void intDAC(int code)
+{
+#ifdef ARDUINO_ARCH_SAMD
+  while (DAC->STATUS.bit.SYNCBUSY)
+    ;
+  DAC->DATA.reg = code / 4; // "/4" -> 12bit to 10bit
+#else
+  halTrace.record(HAL_DAC, 0, code);
+#endif
+}
+
+// CV2: a 12 bit code to the MCP4725 in fast write mode (address and two bytes). It waits
+// for the bus, so it is never called from an interrupt.
+inline void MCP(int code)
+{
+#ifdef ARDUINO_ARCH_SAMD
+  Wire.beginTransmission(MCP4725_ADDRESS);
+  Wire.write((code >> 8) & 0x0F);
+  Wire.write(code);
+  Wire.endTransmission();
+#else
+  halTrace.record(HAL_MCP, 0, code & 0x0FFF);
+  halTrace.advance(3 * HAL_I2C_BYTE_US);
+#endif
+}
+
+#ifdef ARDUINO_ARCH_SAMD
+// DAC and ADC resolutions. The first write enables the DAC, so intDAC() only loads its data.
+inline void halBegin()
+{
+  analogWriteResolution(10);
+  analogReadResolution(12);
+  analogWrite(DAC_INTERNAL_PIN, 0);
+}
+
+// ADC settings. These increase ADC reading stability but at the cost of cycle time. Takes around 0.7ms for one reading with these
+inline void adcAveraging()
+{
+  REG_ADC_AVGCTRL |= ADC_AVGCTRL_SAMPLENUM_1;
+  ADC->AVGCTRL.reg = ADC_AVGCTRL_SAMPLENUM_128 | ADC_AVGCTRL_ADJRES(4);
+}
+
+inline void displayBegin(Adafruit_SSD1306 &display)
+{
+  display.begin(SSD1306_SWITCHCAPVCC, OLED_ADDRESS);
+  display.clearDisplay();
+}
+#endif
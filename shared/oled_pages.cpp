@@ -0,0 +1,168 @@
+#pragma once
+#include <stdint.h>
+
+// Dirty region tracking for the SSD1306 display
+// The controller is written in pages of 8 pixel rows, so for each page we keep the
+// span of columns that changed since the last flush and only send those bytes.
+
+#define OLED_PAGES 8
+#define OLED_COLUMNS 128
+#define OLED_CHUNK 31 // data bytes per I2C transfer, the Wire buffer holds 32 with the control byte
+#define OLED_BUS_CLOCK 400000 // I2C fast mode during a flush
+
+// SSD1306 commands used by the flush
+#define OLED_COLUMN_ADDRESS 0x21
+#define OLED_PAGE_ADDRESS 0x22
+
+struct DirtyPages
+{
+  uint8_t mask = 0; // bit n set when page n has changed
+  uint8_t colStart[OLED_PAGES];
+  uint8_t colEnd[OLED_PAGES]; // inclusive
+
+  // Mark a rectangle as changed, clipped to the screen
+  void mark(int x, int y, int w, int h)
+  {
+    if (w <= 0 || h <= 0)
+    {
+      return;
+    }
+    int x1 = x + w - 1;
+    int y1 = y + h - 1;
+    if (x < 0)
+    {
+      x = 0;
+    }
+    if (y < 0)
+    {
+      y = 0;
+    }
+    if (x1 >= OLED_COLUMNS)
+    {
+      x1 = OLED_COLUMNS - 1;
+    }
+    if (y1 >= OLED_PAGES * 8)
+    {
+      y1 = OLED_PAGES * 8 - 1;
+    }
+    if (x > x1 || y > y1)
+    {
+      return;
+    }
+    for (int page = y >> 3; page <= (y1 >> 3); page++)
+    {
+      if (mask & (1 << page))
+      {
+        if (x < colStart[page])
+        {
+          colStart[page] = x;
+        }
+        if (x1 > colEnd[page])
+        {
+          colEnd[page] = x1;
+        }
+      }
+      else
+      {
+        mask |= 1 << page;
+        colStart[page] = x;
+        colEnd[page] = x1;
+      }
+    }
+  }
+
+  void markAll()
+  {
+    mark(0, 0, OLED_COLUMNS, OLED_PAGES * 8);
+  }
+
+  void clear()
+  {
+    mask = 0;
+  }
+
+  // Bytes that a flush would send
+  int dirtyBytes() const
+  {
+    int bytes = 0;
+    for (int page = 0; page < OLED_PAGES; page++)
+    {
+      if (mask & (1 << page))
+      {
+        bytes += colEnd[page] - colStart[page] + 1;
+      }
+    }
+    return bytes;
+  }
+};
+
+// Send the changed columns of each changed page in short I2C transfers. between() runs
+// after every transfer, so a firmware can keep its MCP4725 or step preparation going while
+// a large update is still on the bus. Display is the Adafruit_SSD1306 (only its buffer is
+// used) and Bus the TwoWire it sits on.
+// The page and column addresses go out as one command transfer on the bus, not through
+// ssd1306_command(), which sets the clock back to 100 kHz after every byte. Neighbouring
+// pages with the same column span share one address window and their bytes stream through
+// it like display() does, so a full redraw costs no more than display(). The bus runs at
+// OLED_BUS_CLOCK for the whole flush and is set to restoreClock at the end.
+template <class Display, class Bus>
+void flushDirtyPages(Display &display, Bus &wire, uint8_t address, DirtyPages &dirty, uint32_t restoreClock, void (*between)() = nullptr)
+{
+  uint8_t *buffer = display.getBuffer();
+  wire.setClock(OLED_BUS_CLOCK);
+  int page = 0;
+  while (page < OLED_PAGES)
+  {
+    if (!(dirty.mask & (1 << page)))
+    {
+      page++;
+      continue;
+    }
+    uint8_t start = dirty.colStart[page];
+    uint8_t end = dirty.colEnd[page];
+    int last = page;
+    while (last + 1 < OLED_PAGES && (dirty.mask & (1 << (last + 1))) && dirty.colStart[last + 1] == start && dirty.colEnd[last + 1] == end)
+    {
+      last++;
+    }
+
+    wire.beginTransmission(address);
+    wire.write(0x00); // command stream
+    wire.write(OLED_PAGE_ADDRESS);
+    wire.write(page);
+    wire.write(last);
+    wire.write(OLED_COLUMN_ADDRESS);
+    wire.write(start);
+    wire.write(end);
+    wire.endTransmission();
+
+    // the controller moves on to the next page of the window at the end column
+    int row = page;
+    int col = start;
+    while (row <= last)
+    {
+      wire.beginTransmission(address);
+      wire.write(0x40); // data stream
+      for (int n = 0; n < OLED_CHUNK && row <= last; n++)
+      {
+        wire.write(buffer[row * OLED_COLUMNS + col]);
+        if (++col > end)
+        {
+          col = start;
+          row++;
+        }
+      }
+      wire.endTransmission();
+      if (between)
+      {
+        between();
+      }
+    }
+    page = last + 1;
+  }
+  if (restoreClock != OLED_BUS_CLOCK)
+  {
+    wire.setClock(restoreClock);
+  }
+  dirty.clear();
+}
@@ -1,3 +1,4 @@
+#pragma once
 #ifdef UNIT_TEST
 #include "ArduinoFake.h"
 #else
@@ -9,7 +10,7 @@
 //   note: array of 12 booleans, one for each note in an octave
 // Outputs:
 //   buff: array of 62 integers, the quantizer buffer
-void initializeQuantBuffer(bool note[], int buff[])
+inline void initializeQuantBuffer(bool note[], int buff[])
 {
   int k = 0;
   for (byte j = 0; j <= 62; j++)
@@ -22,7 +23,7 @@ void initializeQuantBuffer(bool note[], int buff[])
   }
 };
 
-void buildQuantBuffer(bool note[], int buff[])
+inline void buildQuantBuffer(bool note[], int buff[])
 {
   int k = 0;
   for (byte j = 0; j <= 62; j++)
@@ -35,7 +36,7 @@ void buildQuantBuffer(bool note[], int buff[])
   }
 };
 
-void quantizeCV(float AD_CH, int cv_qnt_thr_buf[], int sensitivity_ch, int oct, float *CV_out)
+inline void quantizeCV(float AD_CH, const int cv_qnt_thr_buf[], int sensitivity_ch, int oct, float *CV_out)
 {
   int cmp1, cmp2; // Detect closest note
   byte search_qnt = 0;
@@ -1,15 +1,18 @@
+#pragma once
+#include <stdint.h>
+
 // Add presets for common scales
 
 // Major, Minor, Dorian, Phrygian, Lydian, Mixolydian, Locrian, Pentatonic Minor, Harmonic Minor, Melodic Minor, Whole Tone, Diminished, Chromatic
-char const *scaleNames[] = {"Chrom", "Maj", "Min", "Dor", "Phr", "Lyd", "Mix", "Loc", "PenMin", "HarMin", "MelMin", "Whol", "Dim"};
-char const *noteNames[] = {"C", "C#/Db", "D", "D#/Eb", "E", "F", "F#/Gb", "G", "G#/Ab", "A", "A#/Bb", "B"};
+inline char const *scaleNames[] = {"Chrom", "Maj", "Min", "Dor", "Phr", "Lyd", "Mix", "Loc", "PenMin", "HarMin", "MelMin", "Whol", "Dim"};
+inline char const *noteNames[] = {"C", "C#/Db", "D", "D#/Eb", "E", "F", "F#/Gb", "G", "G#/Ab", "A", "A#/Bb", "B"};
 int const numScales = sizeof(scaleNames) / sizeof(scaleNames[0]);
 
 // ScaleNotes contains the note indexes for each scale
 // Eg. 0 for root, 2 for major second, 4 for major third, 5 for perfect fourth, 7 for perfect fifth, 9 for major sixth, 11 for major seventh
 // C  C# D  D# E F F# G G# A A# B
 // 0  1  2  3  4 5 6  7 8  9 10 11
-int scaleNotes[numScales][7] = {
+inline int scaleNotes[numScales][7] = {
     {},                     // Chromatic (This does not matter for this array but we need the index 0)
     {0, 2, 4, 5, 7, 9, 11}, // Major
     {0, 2, 3, 5, 7, 8, 10}, // Minor
@@ -27,7 +30,7 @@ int scaleNotes[numScales][7] = {
 
 // Build the scale for each note in the scale bases on scaleNotes and each note in the scale
 // Receives the scale index and the note index and fills a boolean array with the notes
-void buildScale(int scaleIndex, int noteIndex, bool *note)
+inline void buildScale(int scaleIndex, int noteIndex, bool *note)
 {
   // Chromatic scale
   if (scaleIndex == 0)
@@ -50,3 +53,16 @@ void buildScale(int scaleIndex, int noteIndex, bool *note)
     }
   }
 }
+
+// The same scale as a 12 bit mask, bit n = note index n
+inline uint16_t scaleMask(int scaleIndex, int noteIndex = 0)
+{
+  bool note[12];
+  buildScale(scaleIndex, noteIndex, note);
+  uint16_t mask = 0;
+  for (int i = 0; i < 12; i++)
+  {
+    mask |= note[i] << i;
+  }
+  return mask;
+}
@@ -0,0 +1,251 @@
+#pragma once
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "pattern_link.cpp"
+
+// Host side of the SEQ USB pattern link , same framing and CRC as the firmware
+
+#define CLIENT_TIMEOUT_MS 1000
+#define CLIENT_RETRIES 3
+
+// Backup file: "SEQB" , the module info reply , every pattern as lastStep + steps ,
+// the settings and a CRC-16 of everything before it (low byte first)
+#define BACKUP_MAGIC "SEQB"
+#define BACKUP_PATTERN_SIZE (1 + sizeof(Pattern))
+#define BACKUP_SIZE (4 + LINK_INFO_SIZE + PATTERN_ROWS * BACKUP_PATTERN_SIZE + PATTERN_SETTINGS + 2)
+
+struct LinkClient
+{
+  int fd = -1;
+  SlipDecoder<LINK_MAX_FRAME> rx;
+  uint8_t reply[LINK_MAX_FRAME];
+  uint8_t input[256]; // bytes read from the port but not fed to the decoder yet
+  int inputLength = 0;
+  int inputPos = 0;
+
+  bool open(const char *path)
+  {
+    fd = ::open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+    {
+      return false;
+    }
+    termios tty;
+    if (tcgetattr(fd, &tty) == 0)
+    {
+      cfmakeraw(&tty);
+      cfsetispeed(&tty, B115200);
+      cfsetospeed(&tty, B115200);
+      tcsetattr(fd, TCSANOW, &tty);
+    }
+    tcflush(fd, TCIOFLUSH);
+    return true;
+  }
+
+  void close()
+  {
+    if (fd >= 0)
+    {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  bool send(const uint8_t *payload, uint16_t length)
+  {
+    static ByteRing<1024> out;
+    uint8_t frame[LINK_MAX_FRAME];
+    memcpy(frame, payload, length);
+    if (!linkSend(out, frame, length))
+    {
+      return false;
+    }
+    uint8_t bytes[1024];
+    int size = 0;
+    while (out.pop(bytes[size]))
+    {
+      size++;
+    }
+    for (int sent = 0; sent < size;)
+    {
+      int n = write(fd, bytes + sent, size - sent);
+      if (n <= 0)
+      {
+        return false;
+      }
+      sent += n;
+    }
+    return true;
+  }
+
+  // Wait for a frame with a good CRC , returns its payload length in reply[] or -1 on timeout
+  int receive(int timeoutMs)
+  {
+    for (;;)
+    {
+      while (inputPos < inputLength)
+      {
+        uint16_t size = rx.feed(input[inputPos++]);
+        int length = size ? linkPayload(rx.frame, size) : -1;
+        if (length > 0)
+        {
+          memcpy(reply, rx.frame, length);
+          return length;
+        }
+      }
+      pollfd ready = {fd, POLLIN, 0};
+      if (poll(&ready, 1, timeoutMs) <= 0)
+      {
+        return -1;
+      }
+      inputLength = read(fd, input, sizeof(input));
+      inputPos = 0;
+      if (inputLength <= 0)
+      {
+        inputLength = 0;
+        return -1;
+      }
+    }
+  }
+
+  // Send a request and wait for its reply , the request is repeated when no reply comes.
+  // Returns the reply length , -1 when the module did not answer or answered an error.
+  int transact(const uint8_t *payload, uint16_t length)
+  {
+    for (int attempt = 0; attempt < CLIENT_RETRIES; attempt++)
+    {
+      if (!send(payload, length))
+      {
+        return -1;
+      }
+      int size;
+      while ((size = receive(CLIENT_TIMEOUT_MS)) > 0)
+      {
+        if (reply[0] == payload[0])
+        {
+          return size;
+        }
+        if (reply[0] == LINK_ERROR && size == 3 && reply[1] == payload[0])
+        {
+          return -1;
+        }
+        // a late reply to an earlier attempt , keep waiting
+      }
+    }
+    return -1;
+  }
+
+  bool info(uint8_t *out)
+  {
+    const uint8_t request[] = {LINK_INFO};
+    if (transact(request, sizeof(request)) != LINK_INFO_SIZE)
+    {
+      return false;
+    }
+    memcpy(out, reply, LINK_INFO_SIZE);
+    return true;
+  }
+
+  // lastStep followed by the steps , BACKUP_PATTERN_SIZE bytes
+  bool readPattern(uint8_t ch, uint8_t index, uint8_t *out)
+  {
+    const uint8_t request[] = {LINK_READ_PATTERN, ch, index};
+    if (transact(request, sizeof(request)) != (int)LINK_PATTERN_SIZE || reply[1] != ch || reply[2] != index)
+    {
+      return false;
+    }
+    memcpy(out, reply + 3, BACKUP_PATTERN_SIZE);
+    return true;
+  }
+
+  bool writePattern(uint8_t ch, uint8_t index, const uint8_t *data)
+  {
+    uint8_t request[LINK_PATTERN_SIZE] = {LINK_WRITE_PATTERN, ch, index};
+    memcpy(request + 3, data, BACKUP_PATTERN_SIZE);
+    return transact(request, sizeof(request)) == 1;
+  }
+
+  bool readSettings(uint8_t *out)
+  {
+    const uint8_t request[] = {LINK_READ_SETTINGS};
+    if (transact(request, sizeof(request)) != 1 + PATTERN_SETTINGS)
+    {
+      return false;
+    }
+    memcpy(out, reply + 1, PATTERN_SETTINGS);
+    return true;
+  }
+
+  bool writeSettings(const uint8_t *data)
+  {
+    uint8_t request[1 + PATTERN_SETTINGS] = {LINK_WRITE_SETTINGS};
+    memcpy(request + 1, data, PATTERN_SETTINGS);
+    return transact(request, sizeof(request)) == 1;
+  }
+};
+
+// Read every pattern and the settings of a module into a backup image
+inline bool backupModule(LinkClient &client, uint8_t *image)
+{
+  uint8_t *out = image;
+  memcpy(out, BACKUP_MAGIC, 4);
+  out += 4;
+  if (!client.info(out))
+  {
+    return false;
+  }
+  out += LINK_INFO_SIZE;
+  for (int row = 0; row < PATTERN_ROWS; row++)
+  {
+    if (!client.readPattern(row / PATTERNS_PER_CHANNEL, row % PATTERNS_PER_CHANNEL, out))
+    {
+      return false;
+    }
+    out += BACKUP_PATTERN_SIZE;
+  }
+  if (!client.readSettings(out))
+  {
+    return false;
+  }
+  out += PATTERN_SETTINGS;
+  uint16_t crc = crc16(image, out - image);
+  out[0] = crc;
+  out[1] = crc >> 8;
+  return true;
+}
+
+// Check a backup image against itself and the module it goes to
+inline bool backupMatches(const uint8_t *image, const uint8_t *moduleInfo)
+{
+  uint16_t crc = image[BACKUP_SIZE - 2] | image[BACKUP_SIZE - 1] << 8;
+  if (memcmp(image, BACKUP_MAGIC, 4) != 0 || crc16(image, BACKUP_SIZE - 2) != crc)
+  {
+    return false;
+  }
+  // same link and store version , pattern count , steps and settings layout
+  return memcmp(image + 4, moduleInfo, LINK_INFO_SIZE) == 0;
+}
+
+inline bool restoreModule(LinkClient &client, const uint8_t *image)
+{
+  uint8_t moduleInfo[LINK_INFO_SIZE];
+  if (!client.info(moduleInfo) || !backupMatches(image, moduleInfo))
+  {
+    return false;
+  }
+  const uint8_t *in = image + 4 + LINK_INFO_SIZE;
+  for (int row = 0; row < PATTERN_ROWS; row++)
+  {
+    if (!client.writePattern(row / PATTERNS_PER_CHANNEL, row % PATTERNS_PER_CHANNEL, in))
+    {
+      return false;
+    }
+    in += BACKUP_PATTERN_SIZE;
+  }
+  return client.writeSettings(in);
+}
@@ -0,0 +1,107 @@
+// seqlink , back up and deploy SEQ patterns over USB serial
+//
+//   seqlink info PORT...
+//   seqlink backup FILE PORT
+//   seqlink restore FILE PORT...
+//
+// restore writes the same backup to every module given , one after the other.
+
+#include <stdlib.h>
+
+#include "link_client.cpp"
+
+static int usage()
+{
+  fprintf(stderr, "usage: seqlink info PORT...\n"
+                  "       seqlink backup FILE PORT\n"
+                  "       seqlink restore FILE PORT...\n");
+  return 2;
+}
+
+static int info(int count, char **ports)
+{
+  int failed = 0;
+  for (int n = 0; n < count; n++)
+  {
+    LinkClient client;
+    uint8_t reply[LINK_INFO_SIZE];
+    if (!client.open(ports[n]) || !client.info(reply))
+    {
+      fprintf(stderr, "%s: no answer\n", ports[n]);
+      failed++;
+    }
+    else
+    {
+      printf("%s: link %d , store %d , %d patterns per channel , %d steps , %d setting bytes\n",
+             ports[n], reply[1], reply[2], reply[3], reply[4], reply[5]);
+    }
+    client.close();
+  }
+  return failed ? 1 : 0;
+}
+
+static int backup(const char *file, const char *port)
+{
+  static uint8_t image[BACKUP_SIZE];
+  LinkClient client;
+  if (!client.open(port) || !backupModule(client, image))
+  {
+    fprintf(stderr, "%s: backup failed\n", port);
+    return 1;
+  }
+  client.close();
+  FILE *out = fopen(file, "wb");
+  if (!out || fwrite(image, 1, BACKUP_SIZE, out) != BACKUP_SIZE || fclose(out) != 0)
+  {
+    fprintf(stderr, "%s: can't write\n", file);
+    return 1;
+  }
+  printf("%s: saved to %s\n", port, file);
+  return 0;
+}
+
+static int restore(const char *file, int count, char **ports)
+{
+  static uint8_t image[BACKUP_SIZE];
+  FILE *in = fopen(file, "rb");
+  if (!in || fread(image, 1, BACKUP_SIZE, in) != BACKUP_SIZE)
+  {
+    fprintf(stderr, "%s: not a backup\n", file);
+    return 1;
+  }
+  fclose(in);
+
+  int failed = 0;
+  for (int n = 0; n < count; n++)
+  {
+    LinkClient client;
+    if (!client.open(ports[n]) || !restoreModule(client, image))
+    {
+      fprintf(stderr, "%s: restore failed (no answer or a backup of another firmware version)\n", ports[n]);
+      failed++;
+    }
+    else
+    {
+      printf("%s: restored from %s\n", ports[n], file);
+    }
+    client.close();
+  }
+  return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc >= 3 && strcmp(argv[1], "info") == 0)
+  {
+    return info(argc - 2, argv + 2);
+  }
+  if (argc == 4 && strcmp(argv[1], "backup") == 0)
+  {
+    return backup(argv[2], argv[3]);
+  }
+  if (argc >= 4 && strcmp(argv[1], "restore") == 0)
+  {
+    return restore(argv[2], argc - 3, argv + 3);
+  }
+  return usage();
+}
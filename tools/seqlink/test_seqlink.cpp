@@ -0,0 +1,157 @@
+#include <gtest/gtest.h>
+#include <pty.h>
+#include <atomic>
+#include <thread>
+
+#include "link_client.cpp"
+
+// Module stand-in on the master side of a pseudo-terminal , running the firmware handler
+// on a RAM flash area. The client talks to the slave side like to the USB serial port.
+struct FakeModule
+{
+  alignas(FLASH_ROW_SIZE) uint8_t flash[PATTERN_AREA_SIZE];
+  PatternStore store;
+  int master = -1;
+  std::atomic<int> dropRequests{0}; // requests ignored before answering , to test the retry
+  std::atomic<bool> running{true};
+  std::thread thread;
+
+  static void erase(const uint8_t *row)
+  {
+    memset((uint8_t *)row, 0xFF, FLASH_ROW_SIZE);
+  }
+
+  static void program(const uint8_t *dst, const void *src, uint32_t size)
+  {
+    for (uint32_t n = 0; n < size; n++)
+    {
+      ((uint8_t *)dst)[n] &= ((const uint8_t *)src)[n];
+    }
+  }
+
+  void start(int fd)
+  {
+    memset(flash, 0, sizeof(flash));
+    store.begin(flash, erase, program);
+    master = fd;
+    thread = std::thread([this] { run(); });
+  }
+
+  void stop()
+  {
+    running = false;
+    thread.join();
+  }
+
+  void run()
+  {
+    SlipDecoder<LINK_MAX_FRAME> rx;
+    ByteRing<1024> tx;
+    uint8_t reply[LINK_MAX_FRAME];
+    uint8_t bytes[1024];
+    while (running)
+    {
+      pollfd ready = {master, POLLIN, 0};
+      if (poll(&ready, 1, 10) <= 0)
+      {
+        continue;
+      }
+      int count = read(master, bytes, sizeof(bytes));
+      for (int n = 0; n < count; n++)
+      {
+        uint16_t size = rx.feed(bytes[n]);
+        int length = size ? linkPayload(rx.frame, size) : -1;
+        if (length < 1)
+        {
+          continue;
+        }
+        if (dropRequests > 0)
+        {
+          dropRequests--;
+          continue;
+        }
+        linkSend(tx, reply, linkHandle(store, rx.frame, length, reply));
+        int out = 0;
+        while (tx.pop(bytes[out]))
+        {
+          out++;
+        }
+        ASSERT_EQ(out, write(master, bytes, out));
+      }
+    }
+  }
+};
+
+class SeqLinkTest : public ::testing::Test
+{
+protected:
+  FakeModule module;
+  LinkClient client;
+  char path[64];
+
+  void SetUp() override
+  {
+    int master, slave;
+    ASSERT_EQ(0, openpty(&master, &slave, path, nullptr, nullptr));
+    close(slave); // the client opens it by name like a real port
+    ASSERT_TRUE(client.open(path));
+    module.start(master);
+  }
+
+  void TearDown() override
+  {
+    module.stop();
+    client.close();
+    close(module.master);
+  }
+};
+
+TEST_F(SeqLinkTest, Info)
+{
+  uint8_t info[LINK_INFO_SIZE];
+  ASSERT_TRUE(client.info(info));
+  EXPECT_EQ(LINK_VERSION, info[1]);
+  EXPECT_EQ(PATTERN_STORE_VERSION, info[2]);
+  EXPECT_EQ(PATTERN_SETTINGS, info[5]);
+}
+
+TEST_F(SeqLinkTest, BackupAndRestore)
+{
+  Pattern data;
+  for (int n = 0; n < MAX_STEPS; n++)
+  {
+    // SLIP END and ESC bytes show up in the step data
+    data.steps[n] = n % 2 ? 0xC0DB : makeStep(n % 61, 1);
+  }
+  uint8_t row[BACKUP_PATTERN_SIZE] = {17};
+  memcpy(row + 1, &data, sizeof(data));
+  ASSERT_TRUE(client.writePattern(1, 7, row));
+
+  static uint8_t image[BACKUP_SIZE];
+  ASSERT_TRUE(backupModule(client, image));
+  const uint8_t *saved = image + 4 + LINK_INFO_SIZE + (PATTERN_ROWS - 1) * BACKUP_PATTERN_SIZE;
+  EXPECT_EQ(0, memcmp(row, saved, BACKUP_PATTERN_SIZE));
+
+  // a blank module gets the same patterns
+  memset(module.flash, 0, sizeof(module.flash));
+  module.store.begin(module.flash, FakeModule::erase, FakeModule::program);
+  ASSERT_TRUE(restoreModule(client, image));
+  EXPECT_EQ(17, module.store.dir.lastStep[1][7]);
+  EXPECT_EQ(0, memcmp(&data, module.store.pattern(1, 7), sizeof(data)));
+}
+
+TEST_F(SeqLinkTest, RefusesCorruptBackups)
+{
+  static uint8_t image[BACKUP_SIZE];
+  ASSERT_TRUE(backupModule(client, image));
+  image[100] ^= 1;
+  EXPECT_FALSE(restoreModule(client, image));
+}
+
+TEST_F(SeqLinkTest, RetriesLostRequests)
+{
+  module.dropRequests = 1;
+  uint8_t settings[PATTERN_SETTINGS];
+  ASSERT_TRUE(client.readSettings(settings));
+  EXPECT_EQ(0, module.dropRequests);
+}